@@ -0,0 +1,81 @@
+/**
+ * @file board.h
+ * @brief Board description: which client GPIOs are switchable devices.
+ *
+ * Every GPIO a client may drive is a device slot. Slots are numbered in GPIO
+ * order, so slot n is the n-th usable GPIO. The set of usable GPIOs is the
+ * only board-specific input; the mask, the slot count and both translation
+ * tables (see board.c) are derived from it at compile time.
+ *
+ * The default describes the Pico form factor, shared by Pico / Pico W (RP2040)
+ * and Pico 2 / Pico 2 W (RP2350A): GPIO 23-25 drive the SMPS mode, VBUS sense
+ * and LED (or the wireless chip), GPIO 29 senses VSYS. Other boards (RP2350B
+ * or custom layouts) set `BOARD_DESCRIPTION_HEADER` to a header defining
+ * `BOARD_DEVICE_GPIOS(X)`, e.g. `X(0) X(1) X(2) ...`, without code changes.
+ *
+ * GPIO states travel as 32-bit masks, so only GPIO 0-31 can be devices: on
+ * an RP2350B, GPIO 32-47 stay unused, and listing one fails the build
+ * (see board.c).
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef BOARD_DESCRIPTION_HEADER
+#include BOARD_DESCRIPTION_HEADER
+#endif
+
+#ifndef BOARD_DEVICE_GPIOS
+#define BOARD_DEVICE_GPIOS(X) \
+    X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  \
+    X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15) \
+    X(16) X(17) X(18) X(19) X(20) X(21) X(22)       \
+    X(26) X(27) X(28)
+#endif
+
+#define BOARD_GPIO_BIT_(gpio) | (1u << (gpio))
+#define BOARD_GPIO_ONE_(gpio) + 1
+
+/// GPIOs a client may drive as devices (bit n = GPIO n).
+#define BOARD_DEVICE_GPIO_MASK (0u BOARD_DEVICE_GPIOS(BOARD_GPIO_BIT_))
+
+/// Number of device slots per client.
+#define BOARD_DEVICE_COUNT (0 BOARD_DEVICE_GPIOS(BOARD_GPIO_ONE_))
+
+/// Width of the GPIO masks, and of the GPIO to slot table.
+#define BOARD_MASK_GPIOS 32
+
+/// `board_gpio_to_device()` result for a GPIO that is not a device.
+#define BOARD_NO_DEVICE 0xFF
+
+/// GPIO of each device slot.
+extern const uint8_t board_device_gpio[BOARD_DEVICE_COUNT];
+
+/// Device slot of each GPIO, `BOARD_NO_DEVICE` if it is not a device.
+extern const uint8_t board_gpio_device[BOARD_MASK_GPIOS];
+
+/**
+ * @brief Returns the GPIO driven by device slot `device_index`.
+ */
+static inline uint8_t board_device_to_gpio(uint8_t device_index){
+    return board_device_gpio[device_index];
+}
+
+/**
+ * @brief Returns the device slot of `gpio`, or `BOARD_NO_DEVICE`.
+ */
+static inline uint8_t board_gpio_to_device(uint8_t gpio){
+    return gpio < BOARD_MASK_GPIOS ? board_gpio_device[gpio] : BOARD_NO_DEVICE;
+}
+
+/**
+ * @brief Returns true if `gpio` may be driven as a device.
+ */
+static inline bool board_gpio_is_device(uint8_t gpio){
+    return gpio < BOARD_MASK_GPIOS && ((BOARD_DEVICE_GPIO_MASK >> gpio) & 1u);
+}
+
+#endif
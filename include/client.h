@@ -26,6 +26,40 @@
 #include "config.h"
 #include "types.h"
 
+/// Size of the interrupt-fed UART RX ring buffer (must be a power of two).
+#ifndef CLIENT_RX_BUFFER_SIZE
+#define CLIENT_RX_BUFFER_SIZE 64
+#endif
+
+/// Watchdog scratch registers holding the learned baud rate ceiling (value, value ^ magic).
+/// Scratch 4-7 are used by the SDK's `watchdog_reboot()`.
+#ifndef CLIENT_BAUDRATE_CEILING_SCRATCH
+#define CLIENT_BAUDRATE_CEILING_SCRATCH 0
+#endif
+
+#ifndef CLIENT_BAUDRATE_CEILING_MAGIC
+#define CLIENT_BAUDRATE_CEILING_MAGIC 0xBA0DCE11u
+#endif
+
+/// Watchdog scratch registers holding the last connected pin pair (packed, packed ^ magic).
+#ifndef CLIENT_LAST_CONNECTION_SCRATCH
+#define CLIENT_LAST_CONNECTION_SCRATCH 2
+#endif
+
+#ifndef CLIENT_LAST_CONNECTION_MAGIC
+#define CLIENT_LAST_CONNECTION_MAGIC 0xC0AA3C7Eu
+#endif
+
+/// Link error score added for each corrupted frame; each valid frame removes 1.
+#ifndef CLIENT_LINK_ERROR_WEIGHT
+#define CLIENT_LINK_ERROR_WEIGHT 8
+#endif
+
+/// Link error score at which the client lowers its baud rate and reconnects.
+#ifndef CLIENT_LINK_ERROR_THRESHOLD
+#define CLIENT_LINK_ERROR_THRESHOLD 64
+#endif
+
 /**
  * @brief Global UART connection used by the client.
  *
@@ -35,20 +69,42 @@
 extern uart_connection_t active_uart_client_connection;
 
 extern bool go_dormant_flag;
-extern bool woke_up_from_dormant;
+
+/**
+ * @brief Baud rate agreed with the server during the handshake.
+ *
+ * Used every time the UART is reinitialized (power saving, wake-up).
+ */
+extern uint32_t client_link_baudrate;
+
+/**
+ * @brief Feeds the result of a received frame into the link quality estimate.
+ *
+ * Keeps a leaky error score: corrupted frames add `CLIENT_LINK_ERROR_WEIGHT`,
+ * valid frames remove 1. Once the score reaches `CLIENT_LINK_ERROR_THRESHOLD`
+ * on a link faster than `DEFAULT_BAUDRATE`, the next lower negotiable rate is
+ * stored as the client's ceiling (it survives watchdog reboots) and the client
+ * handshakes again on the same pin pair, starting at `DEFAULT_BAUDRATE`. GPIO
+ * outputs are kept. Only if the server never answers does the client reboot.
+ *
+ * @param is_valid true for a valid frame, false for a corrupted one.
+ * @return true if the link was negotiated again: bytes received before are
+ *         dropped, and a partially received frame must be discarded.
+ */
+bool client_link_record_frame(bool is_valid);
 
 /**
  * @brief Main loop that listens for UART commands and manages power-saving state.
  *
- * Continuously receives data over UART and checks if the client is in a wake-up state.
- * If not, the system enters low-power mode (`dormant`) and waits to be woken up.
- * Low-power mode is currently supported only on boards without Wi-Fi. (CYW43).
- * After waking up, it resumes listening for commands.
+ * Applies every complete command buffered by the UART RX interrupt, then checks
+ * if the client is in a wake-up state. If not, the system enters low-power mode
+ * (`dormant`) and waits to be woken up. Low-power mode is currently supported
+ * only on boards without Wi-Fi. (CYW43). Otherwise the core sleeps with WFI
+ * until the next interrupt.
  *
  * @note The `go_dormant_flag` should be managed externally to reflect the wake-up status.
  *
- * @warning This loop runs indefinitely. Ensure that `receive_data()` is non-blocking
- *          or times out appropriately to allow power-saving checks.
+ * @warning This loop runs indefinitely.
  *
  * @see enter_dormant_mode()
  * @see wake_up()
@@ -56,22 +112,62 @@ extern bool woke_up_from_dormant;
  */
 void client_listen_for_commands(void);
 
+/**
+ * @brief Enables interrupt-driven reception on the active UART connection.
+ *
+ * Installs the RX interrupt handler (once) and enables the UART RX and RX timeout
+ * interrupts. Must be called again after every UART reinitialization, since
+ * reinitializing the UART clears its interrupt mask.
+ */
+void client_uart_rx_irq_enable(void);
+
+/**
+ * @brief Pops the oldest received byte from the RX ring buffer.
+ *
+ * @param byte Output for the received byte.
+ * @return true if a byte was available, false if the buffer is empty.
+ */
+bool client_uart_rx_pop(uint8_t *byte);
+
+/**
+ * @brief Checks whether the RX ring buffer holds no bytes.
+ *
+ * @return true if no received bytes are pending.
+ */
+bool client_uart_rx_is_empty(void);
+
+/**
+ * @brief Drops every byte in the RX ring buffer.
+ *
+ * Must be called with the RX interrupt disabled.
+ */
+void client_uart_rx_discard(void);
+
 /**
  * @brief Performs a full scan of all available UART pin pairs until a valid connection is found.
  *
- * Tries all UART0 and UART1 pin pair combinations. Once a working connection is found,
- * the onboard LED blinks to signal success.
+ * After a watchdog reboot, first retries the pin pair of the previous connection.
+ * Tries all UART0 and UART1 pin pair combinations. Once a working connection is found
+ * and its baud rate negotiated, the onboard LED blinks in the background to signal success.
  *
  * @return true if a valid connection is found, false otherwise.
  */
 bool client_detect_uart_connection(void);
 
 /**
- * @brief Reduces power consumption by disabling unused clocks and reconfiguring system clocks.
+ * @brief Switches clk_ref, clk_sys and clk_peri to the 12 MHz XOSC and disables the system PLL.
+ *
+ * Runs before the handshake, so the link baud rate is negotiated and probed
+ * at the clk_peri the client keeps using.
+ */
+void client_set_low_power_clocks(void);
+
+/**
+ * @brief Reduces power consumption by disabling unused clocks.
  *
- * This function turns off unnecessary peripherals and clock outputs (e.g., ADC, RTC, GPOUT),
- * switches to lower-frequency XOSC-based system clocks (12 MHz), disables the system PLL,
- * and enables only essential clock domains for sleep mode operation.
+ * This function turns off unnecessary peripherals and clock outputs (e.g., USB, ADC, RTC, GPOUT),
+ * disables the USB PLL, and enables only essential clock domains for sleep mode operation.
+ * The system clocks are lowered beforehand by `client_set_low_power_clocks()`.
  */
 void client_turn_off_unused_power_consumers(void);
 
@@ -108,7 +204,8 @@ void enter_dormant_mode(void);
  * @brief Wakes up the system from dormant mode and reinitializes UART.
  *
  * Restores clocks and peripherals using `sleep_power_up()`, then reinitializes
- * UART with stored settings (instance, TX/RX pins, and baud rate).
+ * UART with stored settings (instance, TX/RX pins, and baud rate) and re-enables
+ * interrupt-driven reception.
  *
  * @note Assumes `active_uart_client_connection` is valid.
  *
@@ -9,6 +9,8 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "board.h"
+
 
 // === Enable Periodic Blink ===
 #ifndef PERIODIC_ONBOARD_LED_BLINK_SERVER
@@ -32,6 +34,47 @@
 #define CONNECTION_ACCEPTED_MESSAGE "Connection Accepted"
 #endif
 
+/// Highest baud rate offered during the handshake-time negotiation.
+#ifndef MAX_NEGOTIATED_BAUDRATE
+#define MAX_NEGOTIATED_BAUDRATE 3000000u
+#endif
+
+#ifndef NEGOTIABLE_BAUDRATES_LEN
+#define NEGOTIABLE_BAUDRATES_LEN 6
+#endif
+
+/// Largest deviation between requested and generated baud rate accepted for a candidate.
+#ifndef UART_BAUDRATE_MAX_ERROR_PERCENT
+#define UART_BAUDRATE_MAX_ERROR_PERCENT 2
+#endif
+
+#ifndef BAUDRATE_CAPABILITY_MESSAGE
+#define BAUDRATE_CAPABILITY_MESSAGE "Max Baud"
+#endif
+
+#ifndef BAUDRATE_PROPOSAL_MESSAGE
+#define BAUDRATE_PROPOSAL_MESSAGE "Set Baud"
+#endif
+
+#ifndef BAUDRATE_PROBE_MESSAGE
+#define BAUDRATE_PROBE_MESSAGE "Probe"
+#endif
+
+#ifndef BAUDRATE_CONFIRMED_MESSAGE
+#define BAUDRATE_CONFIRMED_MESSAGE "Baud Confirmed"
+#endif
+
+/// Frames that can wait in each client's outbound queue on the server.
+#ifndef UART_TX_QUEUE_DEPTH
+#define UART_TX_QUEUE_DEPTH 8
+#endif
+
+/// Longest wait for a client's queue to drain before it is handshaken again:
+/// a full queue of frames, each after a wake-up pulse. Past it, the handshake is skipped.
+#ifndef UART_TX_SUSPEND_TIMEOUT_MS
+#define UART_TX_SUSPEND_TIMEOUT_MS (UART_TX_QUEUE_DEPTH * (2 * WAKE_UP_PULSE_MS + 5))
+#endif
+
 
 // === UART Connection Scan ===
 #ifndef PIN_PAIRS_UART0_LEN
@@ -42,8 +85,40 @@
 #define PIN_PAIRS_UART1_LEN 2
 #endif
 
+/// Server pin pairs driven by PIO UART channels (0 disables PIO channels).
+#ifndef PIN_PAIRS_PIO_LEN
+#define PIN_PAIRS_PIO_LEN 8
+#endif
+
 #ifndef MAX_SERVER_CONNECTIONS
-#define MAX_SERVER_CONNECTIONS (PIN_PAIRS_UART0_LEN + PIN_PAIRS_UART1_LEN)
+#define MAX_SERVER_CONNECTIONS (PIN_PAIRS_UART0_LEN + PIN_PAIRS_UART1_LEN + PIN_PAIRS_PIO_LEN)
+#endif
+
+
+// === Client Registry ===
+/// Clients whose state the server keeps, connected or not (at least `MAX_SERVER_CONNECTIONS`).
+#ifndef MAX_REGISTERED_CLIENTS
+#define MAX_REGISTERED_CLIENTS 32
+#endif
+
+/// Clients that may hold preset configurations at the same time (at most 32).
+#ifndef MAX_CLIENT_PRESET_SETS
+#define MAX_CLIENT_PRESET_SETS 16
+#endif
+
+/// `client_t.preset_set` of a client without preset configurations.
+#ifndef CLIENT_NO_PRESET_SET
+#define CLIENT_NO_PRESET_SET 0xFF
+#endif
+
+/// Client ID of a client that did not report one.
+#ifndef CLIENT_ID_NONE
+#define CLIENT_ID_NONE 0ull
+#endif
+
+/// Client IDs derived from the server pin pair (clients that report none): this prefix | tx << 8 | rx.
+#ifndef CLIENT_ID_LEGACY_PREFIX
+#define CLIENT_ID_LEGACY_PREFIX 0xFFFFFFFF00000000ull
 #endif
 
 
@@ -52,11 +127,22 @@
 #define LED_DELAY_MS 125
 #endif
 
+/// Number of blinks confirming a new connection, each lasting 2 * LED_DELAY_MS.
+#ifndef LED_BLINK_COUNT
+#define LED_BLINK_COUNT 5
+#endif
+
 #ifndef FAST_LED_DELAY_MS
 #define FAST_LED_DELAY_MS 25
 #endif
 
-/// Timeout in milliseconds for receiving a UART connection request.
+/// Length of each phase (high, then low) of the pulse that wakes a dormant client.
+#ifndef WAKE_UP_PULSE_MS
+#define WAKE_UP_PULSE_MS 5
+#endif
+
+/// Timeout in milliseconds for receiving a UART connection request, and length
+/// of each parallel discovery window.
 /// Minimum effective value is ~350ms. 500ms provides more robustness.
 #ifndef SERVER_TIMEOUT_MS
 #define SERVER_TIMEOUT_MS 500
@@ -67,6 +153,40 @@
 #define CLIENT_TIMEOUT_MS 50
 #endif
 
+/// Discovery window on the known pin pairs after a watchdog reboot.
+/// Must exceed two client attempts on the same pair (2 * CLIENT_TIMEOUT_MS plus the request).
+#ifndef SERVER_RECONNECT_TIMEOUT_MS
+#define SERVER_RECONNECT_TIMEOUT_MS 120
+#endif
+
+/// Attempts on its last pin pair a client makes after a watchdog reboot, before scanning all pairs.
+/// Must cover the server's own reboot (~20 * 53ms).
+#ifndef CLIENT_RECONNECT_ATTEMPTS
+#define CLIENT_RECONNECT_ATTEMPTS 20
+#endif
+
+/// Pause after a baud rate switch, so the other end has switched too.
+#ifndef BAUDRATE_SWITCH_DELAY_MS
+#define BAUDRATE_SWITCH_DELAY_MS 2
+#endif
+
+/// Timeout for each probe/echo/confirm step of the baud rate negotiation.
+#ifndef BAUDRATE_STEP_TIMEOUT_MS
+#define BAUDRATE_STEP_TIMEOUT_MS 10
+#endif
+
+/// Client timeout waiting for the next baud rate proposal.
+/// Must exceed the server's retry delay (2 * BAUDRATE_STEP_TIMEOUT_MS + BAUDRATE_SWITCH_DELAY_MS).
+#ifndef BAUDRATE_PROPOSAL_TIMEOUT_MS
+#define BAUDRATE_PROPOSAL_TIMEOUT_MS 50
+#endif
+
+/// Time a client needs after the server's last handshake message before it receives
+/// commands: it may still wait BAUDRATE_PROPOSAL_TIMEOUT_MS for another proposal.
+#ifndef CLIENT_LINK_SETTLE_MS
+#define CLIENT_LINK_SETTLE_MS (BAUDRATE_PROPOSAL_TIMEOUT_MS + 10)
+#endif
+
 #ifndef PERIODIC_ONBOARD_LED_BLINK_TIME_MS
 #define PERIODIC_ONBOARD_LED_BLINK_TIME_MS 2500
 #endif
@@ -81,8 +201,9 @@
 
 
 // === GPIO State ===
+/// Device slots per client, one per usable GPIO of the board (see board.h).
 #ifndef MAX_NUMBER_OF_GPIOS
-#define MAX_NUMBER_OF_GPIOS 26
+#define MAX_NUMBER_OF_GPIOS BOARD_DEVICE_COUNT
 #endif
 
 #ifndef UART_CONNECTION_FLAG_NUMBER
@@ -110,6 +231,15 @@
 #define DORMANT_FLAG_NUMBER 44
 #endif
 
+/// Full state frame: "[FULL_STATE_FLAG_NUMBER,mask]", bit n of mask = GPIO n ON.
+#ifndef FULL_STATE_FLAG_NUMBER
+#define FULL_STATE_FLAG_NUMBER 88
+#endif
+
+#ifndef FULL_STATE_MESSAGE_MAX_LEN
+#define FULL_STATE_MESSAGE_MAX_LEN 16
+#endif
+
 // === Flash Memory Layout === 
 #ifndef SERVER_SECTOR_SIZE
 #define SERVER_SECTOR_SIZE    4096
@@ -119,16 +249,47 @@
 #define SERVER_PAGE_SIZE      256
 #endif
 
+/// Sectors reserved at the end of flash for the persistent state log, split into two banks (snapshot + change records each).
+#ifndef SERVER_FLASH_SECTORS
+#define SERVER_FLASH_SECTORS  8
+#endif
+
+/// Quiet time after the last edit before the cached state is written to flash.
+#ifndef SERVER_STATE_COMMIT_DEBOUNCE_MS
+#define SERVER_STATE_COMMIT_DEBOUNCE_MS 1500
+#endif
+
+/// Longest time an edit may stay only in RAM, even while edits keep coming.
+#ifndef SERVER_STATE_COMMIT_MAX_AGE_MS
+#define SERVER_STATE_COMMIT_MAX_AGE_MS 10000
+#endif
+
+/// How often core 0 checks the commit policy while waiting for CLI input.
+#ifndef SERVER_STATE_SERVICE_PERIOD_MS
+#define SERVER_STATE_SERVICE_PERIOD_MS 100
+#endif
+
+/// 1 to time the CRC32 engines once the CLI connects (`server_state_crc32_benchmark()`).
+#ifndef SERVER_CRC32_BENCHMARK
+#define SERVER_CRC32_BENCHMARK 0
+#endif
+
+/// Passes over the benchmarked block, so short runs stay above the timer resolution.
+#ifndef SERVER_CRC32_BENCHMARK_ROUNDS
+#define SERVER_CRC32_BENCHMARK_ROUNDS 64
+#endif
+
 #ifndef SERVER_FLASH_OFFSET
-#define SERVER_FLASH_OFFSET   (PICO_FLASH_SIZE_BYTES - SERVER_SECTOR_SIZE) ///< Offset from flash end
+#define SERVER_FLASH_OFFSET   (PICO_FLASH_SIZE_BYTES - SERVER_FLASH_SECTORS * SERVER_SECTOR_SIZE) ///< Offset from flash end
 #endif
 
 #ifndef SERVER_FLASH_ADDR
 #define SERVER_FLASH_ADDR     (XIP_BASE + SERVER_FLASH_OFFSET)             ///< Runtime address of flash state
 #endif
 
-#ifndef INVALID_CLIENT_INDEX
-#define INVALID_CLIENT_INDEX -1
+/// Index table entry of a client with no active connection (or no saved entry).
+#ifndef CLIENT_INDEX_NOT_CONNECTED
+#define CLIENT_INDEX_NOT_CONNECTED 0xFF
 #endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,69 @@
+/**
+ * @file crc32.h
+ * @brief Software CRC32 (IEEE 802.3, reflected, polynomial 0xEDB88320).
+ *
+ * Two engines compute the same checksum:
+ * - Slicing-by-8: eight 256-entry tables, 8 bytes per iteration
+ * - Bitwise: the original loop, 8 iterations per byte, kept as reference
+ *
+ * Nothing here depends on the Pico SDK, so the benchmark in
+ * `tools/crc32_benchmark` builds the same code on the host.
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+/// Seed of a running CRC32; the checksum is the complement of the running value.
+#define CRC32_INITIAL_VALUE 0xFFFFFFFFu
+
+/**
+ * @brief Fills the slicing-by-8 tables.
+ *
+ * Must run once before `crc32_update()` or `crc32_compute()`, before the
+ * second core starts.
+ */
+void crc32_init(void);
+
+/**
+ * @brief Feeds a block of memory into a running CRC32, 8 bytes per iteration.
+ *
+ * @param crc Running CRC, `CRC32_INITIAL_VALUE` to start.
+ * @param data Pointer to the data block.
+ * @param length Number of bytes to process.
+ * @return Updated running CRC.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t length);
+
+/**
+ * @brief Computes the CRC32 checksum of a block of memory with the slicing-by-8 tables.
+ *
+ * @param data Pointer to the data block.
+ * @param length Number of bytes to process.
+ * @return CRC32 checksum.
+ */
+uint32_t crc32_compute(const void *data, uint32_t length);
+
+/**
+ * @brief Feeds a block of memory into a running CRC32, one bit at a time.
+ *
+ * Needs no table; reference for the other engines.
+ *
+ * @param crc Running CRC, `CRC32_INITIAL_VALUE` to start.
+ * @param data Pointer to the data block.
+ * @param length Number of bytes to process.
+ * @return Updated running CRC.
+ */
+uint32_t crc32_update_bitwise(uint32_t crc, const void *data, uint32_t length);
+
+/**
+ * @brief Computes the CRC32 checksum of a block of memory, one bit at a time.
+ *
+ * @param data Pointer to the data block.
+ * @param length Number of bytes to process.
+ * @return CRC32 checksum.
+ */
+uint32_t crc32_compute_bitwise(const void *data, uint32_t length);
+
+#endif
@@ -50,6 +50,8 @@ void uart_init_with_single_pin(uart_inst_t* uart, uint8_t pin_number, uint32_t b
  * @brief Extracts a [tx,rx] pair from a UART message.
  *
  * Parses strings in the format "[tx,rx]" and stores the result in a byte array.
+ * Parsing stops after the second number, or at the first number that would
+ * overflow a byte.
  *
  * @param result_array Pointer to array of 2 bytes to store TX and RX values.
  * @param message Input string containing the UART message (e.g., "[4,5]").
@@ -71,6 +73,43 @@ void get_number_pair(uint8_t *result_array, char *message);
  */
 void get_uart_buffer(uart_inst_t *uart, char *buffer, uint8_t buffer_size, uint32_t timeout_ms);
 
+/**
+ * @brief Extracts the number from a "<message>-<number>" UART message.
+ *
+ * Looks for `message` followed by '-' anywhere in `buf`, so a missing leading
+ * '[' does not matter. The number must be followed by ']' and fit in 32 bits.
+ *
+ * @param buf Received message (e.g., "[Set Baud-921600]").
+ * @param message Expected message text (e.g., `BAUDRATE_PROPOSAL_MESSAGE`).
+ * @param number Output for the parsed number.
+ * @return true if the message was found and the number is valid.
+ */
+bool get_message_number(const char *buf, const char *message, uint32_t *number);
+
+/**
+ * @brief Extracts the hexadecimal number from a "<message>-<hex>" UART message.
+ *
+ * Same rules as `get_message_number()`, for up to 16 hexadecimal digits.
+ *
+ * @param buf Received message (e.g., "[Connection Accepted-e6614103e7452d2f]").
+ * @param message Expected message text (e.g., `CONNECTION_ACCEPTED_MESSAGE`).
+ * @param number Output for the parsed number.
+ * @return true if the message was found and the number is valid.
+ */
+bool get_message_hex_number(const char *buf, const char *message, uint64_t *number);
+
+/**
+ * @brief Checks whether a UART can generate a baud rate from a given peripheral clock.
+ *
+ * Mirrors the divisor calculation of `uart_set_baudrate()` and accepts the rate
+ * if the generated baud rate is within `UART_BAUDRATE_MAX_ERROR_PERCENT`.
+ *
+ * @param peri_hz Frequency of clk_peri in Hz.
+ * @param baudrate Requested baud rate.
+ * @return true if the rate can be generated accurately enough.
+ */
+bool uart_baudrate_is_reachable(uint32_t peri_hz, uint32_t baudrate);
+
 /**
  * @brief Turns the onboard LED on or off.
  * 
@@ -79,9 +118,12 @@ void get_uart_buffer(uart_inst_t *uart, char *buffer, uint8_t buffer_size, uint3
 void pico_set_onboard_led(bool state);
 
 /**
- * @brief Blinks the onboard LED 5 times with a defined delay.
+ * @brief Blinks the onboard LED `LED_BLINK_COUNT` times without blocking.
+ *
+ * The LED is switched by a repeating alarm every `LED_DELAY_MS`, and ends OFF.
+ * A call while the sequence is still running is ignored.
  */
-void blink_onboard_led_blocking(void);
+void blink_onboard_led(void);
 
 /**
  * @brief Performs a quick blink of the onboard LED.
@@ -20,7 +20,7 @@
 #endif
 
 #ifndef MAXIMUM_MENU_OPTION_INDEX_INPUT
-#define MAXIMUM_MENU_OPTION_INDEX_INPUT 9
+#define MAXIMUM_MENU_OPTION_INDEX_INPUT 10
 #endif
 
 #ifndef MINIMUM_SAVING_OPTION_INPUT 
@@ -83,7 +83,7 @@ bool read_user_choice_in_range(const char* message, uint32_t* out, uint32_t min,
  * @brief Prompts the user to select a menu option from the main CLI.
  *
  * This function displays a message prompting the user to pick a number
- * between 1 and 9, representing the available menu options.
+ * between 1 and 10, representing the available menu options.
  * It reads and validates the input, and stores the selected option in `menu_option`.
  *
  * The valid range is:
@@ -96,6 +96,7 @@ bool read_user_choice_in_range(const char* message, uint32_t* out, uint32_t min,
  * - 7: Reset configuration
  * - 8: Clear Screen
  * - 9. Restart System
+ * - 10: Set several devices at once
  *
  * @param[out] menu_option Pointer to store the selected menu option.
  * @return true if a valid input was received, false otherwise.
@@ -25,6 +25,11 @@
 #define BLINK_LED_WAKEUP_MESSAGE 0xEDEDEDED
 #endif
 
+/// Messages core 1 has not handled yet; must be a power of two.
+#ifndef CORE1_MESSAGE_QUEUE_SIZE
+#define CORE1_MESSAGE_QUEUE_SIZE 8
+#endif
+
 extern volatile char reconnection_buffer[BUFFER_MAX_NUMBER_OF_STRINGS][BUFFER_MAX_STRING_SIZE];
 extern volatile uint32_t reconnection_buffer_len;
 extern volatile uint32_t reconnection_buffer_index;
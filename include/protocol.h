@@ -0,0 +1,107 @@
+/**
+ * @file protocol.h
+ * @brief Command framing between the server and its clients.
+ *
+ * Every command carries a code (a GPIO number or one of the `*_FLAG_NUMBER`
+ * flags) and a value (device state, GPIO mask, or nothing for flags).
+ * Two wire formats are available, selected at build time:
+ *
+ * - Binary (`PROTOCOL_BINARY_FRAMING` = 1, default):
+ *   `COBS(code, length, payload[length], crc8) 0x00`
+ *   The 0x00 delimiter acts as the sync byte: COBS stuffing guarantees it never
+ *   appears inside a frame, so frame boundaries are found without timeouts.
+ *   The payload is the value in little-endian order (0 bytes for flags,
+ *   1 byte for device states, 4 bytes for full state masks) and the CRC-8
+ *   covers code, length and payload.
+ *
+ * - ASCII (`PROTOCOL_BINARY_FRAMING` = 0): `"[code,value]"`
+ *   Kept for compatibility and benchmarking against the binary format.
+ *
+ * The handshake (`CONNECTION_REQUEST_MESSAGE` / `CONNECTION_ACCEPTED_MESSAGE`)
+ * always uses plain text and is not affected by this setting.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config.h"
+
+#ifndef PROTOCOL_BINARY_FRAMING
+#define PROTOCOL_BINARY_FRAMING 1
+#endif
+
+#ifndef PROTOCOL_FRAME_DELIMITER
+#define PROTOCOL_FRAME_DELIMITER 0x00
+#endif
+
+#ifndef PROTOCOL_MAX_PAYLOAD_LEN
+#define PROTOCOL_MAX_PAYLOAD_LEN 4
+#endif
+
+/// Largest encoded command for either format, including the delimiter.
+#ifndef PROTOCOL_MAX_FRAME_LEN
+#define PROTOCOL_MAX_FRAME_LEN FULL_STATE_MESSAGE_MAX_LEN
+#endif
+
+/**
+ * @brief A single command exchanged between server and client.
+ */
+typedef struct{
+    uint8_t code;       ///< GPIO number or command flag (e.g., `DORMANT_FLAG_NUMBER`)
+    uint32_t value;     ///< Device state, GPIO mask, or unused for flags
+}protocol_command_t;
+
+/**
+ * @brief Incremental frame extractor fed one byte at a time.
+ *
+ * Keeps a partially received frame between calls, so a frame split across
+ * several reads is never lost.
+ */
+typedef struct{
+    uint8_t buffer[PROTOCOL_MAX_FRAME_LEN];
+    uint8_t length;
+    bool is_discarding;     ///< Current frame overflowed, skip until the next delimiter
+    bool is_in_frame;       ///< ASCII only: an opening '[' has been received
+    uint32_t error_count;   ///< Frames dropped due to CRC, length or format errors
+}protocol_receiver_t;
+
+/**
+ * @brief Computes a CRC-8 (polynomial 0x07, initial value 0x00) over a byte block.
+ *
+ * @param data Pointer to the data block.
+ * @param length Number of bytes to process.
+ * @return CRC-8 checksum.
+ */
+uint8_t protocol_crc8(const uint8_t *data, size_t length);
+
+/**
+ * @brief Encodes a command in the wire format selected at build time.
+ *
+ * @param command Command to encode.
+ * @param frame Output buffer, at least `PROTOCOL_MAX_FRAME_LEN` bytes.
+ * @return Number of bytes written to `frame`.
+ */
+size_t protocol_encode_command(const protocol_command_t *command, uint8_t *frame);
+
+/**
+ * @brief Clears any partially received frame.
+ *
+ * @param receiver Receiver to reset. The error counter is preserved.
+ */
+void protocol_receiver_reset(protocol_receiver_t *receiver);
+
+/**
+ * @brief Feeds one received byte into the frame extractor.
+ *
+ * @param receiver Receiver state.
+ * @param byte Received byte.
+ * @param command Output command, written only when a valid frame completes.
+ * @return true if `byte` completed a valid frame, false otherwise.
+ */
+bool protocol_receiver_push_byte(protocol_receiver_t *receiver, uint8_t byte, protocol_command_t *command);
+
+#endif
@@ -23,17 +23,40 @@
 #include <stdio.h>
 
 #include "hardware/uart.h"
+#include "hardware/irq.h"
 #include "pico/multicore.h"
 
 #include "menu.h"
 #include "types.h"
 #include "config.h"
 
-#ifndef UART_SPINLOCK_ID
-#define UART_SPINLOCK_ID 0
+/// One PIO UART channel per PIO pin pair, each owning one TX state machine.
+#ifndef PIO_UART_MAX_CHANNELS
+#define PIO_UART_MAX_CHANNELS PIN_PAIRS_PIO_LEN
 #endif
 
-extern spin_lock_t *uart_lock;
+/// At most one RX-only listener per state machine.
+#ifndef PIO_UART_MAX_LISTENERS
+#define PIO_UART_MAX_LISTENERS (NUM_PIOS * NUM_PIO_STATE_MACHINES)
+#endif
+
+/**
+ * @brief One spinlock per hardware UART, indexed by `uart_get_index()`.
+ *
+ * Each lock protects the transmit engine, the client queues and the pin
+ * routing of its UART only, so `uart0` and `uart1` traffic never wait on each
+ * other. Critical sections are kept short and never sleep.
+ */
+extern spin_lock_t *uart_locks[NUM_UARTS];
+
+/// Shared by the transmit engines of all PIO UART channels.
+extern spin_lock_t *pio_uart_lock;
+
+/// Serializes use of the DMA sniffer computing the persistent state CRC32.
+extern spin_lock_t *state_crc_lock;
+
+/// Serializes updates of the active/saved client index tables and of the pending links and handshakes (both cores add connections).
+extern spin_lock_t *client_index_map_lock;
 
 /**
  * @brief Active UART server connections detected at runtime.
@@ -48,33 +71,305 @@ extern server_uart_connection_t active_uart_server_connections[MAX_SERVER_CONNEC
 extern uint8_t active_server_connections_number;
 
 /**
- * @brief Sends a UART message safely using spinlock protection.
+ * @brief Called by the transmit engine once a frame has completely left the UART.
+ *
+ * Runs in interrupt context on core 0 and must not block.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ * @param context Value given when the frame was queued.
+ */
+typedef void (*uart_tx_complete_callback_t)(uint8_t client_index, uint32_t context);
+
+/**
+ * @brief Queues a command for a client and returns immediately.
+ *
+ * Thin wrapper over `uart_tx_queue_send()` without wake-up pulse or callback.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ * @param code GPIO number or command flag (e.g., `DORMANT_FLAG_NUMBER`).
+ * @param value Device state, GPIO mask for `FULL_STATE_FLAG_NUMBER`, ignored for other flags.
+ * @return true if the command was queued, false if it was dropped.
+ */
+bool queue_uart_message(uint8_t client_index, uint8_t code, uint32_t value);
+
+/**
+ * @brief Claims one DMA channel per hardware UART and per connected PIO UART
+ *        channel, and installs the transmit interrupt.
+ *
+ * Must be called on core 0 after the client scan and before anything is queued.
+ */
+void uart_tx_queue_init(void);
+
+/**
+ * @brief Encodes a command and appends it to a client's outbound queue.
+ *
+ * Encodes the command in the wire format selected by `PROTOCOL_BINARY_FRAMING`
+ * and returns without waiting for the transmission. Frames for the same client
+ * are sent in queue order; the transmit engine routes the UART to the client's
+ * TX pin and streams the frame by DMA. Never waits: the frame is dropped if the
+ * client's queue is full or suspended for a new handshake.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ * @param code GPIO number or command flag.
+ * @param value Device state, GPIO mask for `FULL_STATE_FLAG_NUMBER`, ignored for other flags.
+ * @param wake_up_first true to pulse the client's wake-up line before the frame.
+ * @param on_complete Optional callback run when the frame has been transmitted, may be NULL.
+ * @param context Value passed to `on_complete`.
+ * @return true if the frame was queued, false if it was dropped.
+ *
+ * @see protocol_encode_command()
+ */
+bool uart_tx_queue_send(uint8_t client_index, uint8_t code, uint32_t value, bool wake_up_first,
+                        uart_tx_complete_callback_t on_complete, uint32_t context);
+
+/**
+ * @brief Waits until every queued frame has been transmitted.
+ *
+ * Used before rebooting, so no command is lost. Must not be called with
+ * interrupts disabled on core 0.
+ */
+void uart_tx_queue_flush(void);
+
+/**
+ * @brief Sets up the transmit engine of a PIO UART channel, if not done yet.
+ *
+ * Called by `uart_tx_queue_init()` for the channels found at boot, and by the
+ * background discovery before a new PIO client is published.
+ *
+ * @param pio_channel PIO UART channel of the client.
+ */
+void uart_tx_queue_add_pio_channel(uint8_t pio_channel);
+
+/**
+ * @brief Stops all traffic to a client so it can be handshaken again.
+ *
+ * New frames for the client are dropped, queued ones are sent first, for at
+ * most `UART_TX_SUSPEND_TIMEOUT_MS`. On success, the client's TX pin is no
+ * longer routed to a hardware UART.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ * @return false if the queue did not drain in time: the client stays
+ *         suspended, and must be resumed with `uart_tx_queue_resume_client()`.
+ */
+bool uart_tx_queue_suspend_client(uint8_t client_index);
+
+/**
+ * @brief Accepts frames for a client again after `uart_tx_queue_suspend_client()`.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ */
+void uart_tx_queue_resume_client(uint8_t client_index);
+
+/**
+ * @brief Configures a client's RX pin as its wake-up line.
+ *
+ * The line idles as an input with pull-down and is only driven during a
+ * wake-up pulse, so the client's TX output is never driven against and the
+ * background discovery can listen on it.
+ *
+ * @param pin Server-side RX pin of the client.
+ */
+void uart_tx_queue_init_wake_up_line(uint8_t pin);
+
+/**
+ * @brief Returns the number of frames queued for a client, including the one in flight.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ */
+uint8_t uart_tx_queue_get_depth(uint8_t client_index);
+
+/**
+ * @brief Returns the largest queue depth a client has reached since boot.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ */
+uint8_t uart_tx_queue_get_high_water_mark(uint8_t client_index);
+
+/**
+ * @brief Routes a hardware UART to a client's TX pin at the client's baud rate.
+ *
+ * - Initializes the UART instance on first use only.
+ * - Changes the baud rate only if it differs from the current one.
+ * - If another client's TX pin is routed to the same UART, parks it as an
+ *   SIO output at idle level and routes the new TX pin instead.
+ * - Does nothing if the requested pin pair is already selected.
+ *
+ * The RX pin is left under SIO control, where it serves as the wake-up line.
+ *
+ * @note Must be called with the lock of `uart` (`uart_locks`) held.
+ *
+ * @param uart Pointer to the UART instance (e.g., uart0 or uart1).
+ * @param pin_pair Server-side TX/RX pin pair of the target client.
+ * @param baudrate Baud rate negotiated with the target client.
+ */
+void uart_channel_select(uart_inst_t *uart, uart_pin_pair_t pin_pair, uint32_t baudrate);
+
+/**
+ * @brief Disconnects a client's TX pin from its hardware UART, if it is routed there.
+ *
+ * The pin is parked at idle level; the next `uart_channel_select()` for the
+ * client routes it again.
+ *
+ * @note Must be called with the lock of `uart` (`uart_locks`) held.
+ *
+ * @param uart Pointer to the UART instance of the client.
+ * @param pin_pair Server-side TX/RX pin pair of the client.
+ */
+void uart_channel_release(uart_inst_t *uart, uart_pin_pair_t pin_pair);
+
+/**
+ * @brief Opens a PIO UART channel transmitting on `pin_pair.tx`.
+ *
+ * Loads the PIO programs on first use and claims a free TX state machine
+ * from any PIO block.
+ *
+ * @param pin_pair Server-side TX/RX pin pair of the client.
+ * @param baudrate Initial baud rate.
+ * @return Channel index, or -1 if no channel or state machine is free.
+ */
+int pio_uart_channel_open(uart_pin_pair_t pin_pair, uint32_t baudrate);
+
+/**
+ * @brief Closes a PIO UART channel, releasing its state machines and pins.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+void pio_uart_channel_close(uint8_t channel_index);
+
+/**
+ * @brief Attaches an RX state machine to a channel, on `pin_pair.rx`.
+ *
+ * Only needed during the handshake.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ * @return true on success, false if no state machine is free.
+ */
+bool pio_uart_rx_open(uint8_t channel_index);
+
+/**
+ * @brief Detaches the RX state machine of a channel and returns its pin to SIO.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+void pio_uart_rx_close(uint8_t channel_index);
+
+/**
+ * @brief Changes the baud rate of a channel (TX and, if attached, RX).
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ * @param baudrate New baud rate.
+ */
+void pio_uart_set_baudrate(uint8_t channel_index, uint32_t baudrate);
+
+/**
+ * @brief Writes bytes to a channel, waiting for TX FIFO space.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ * @param data Bytes to send.
+ * @param length Number of bytes.
+ */
+void pio_uart_write_blocking(uint8_t channel_index, const uint8_t *data, size_t length);
+
+/**
+ * @brief Waits until the last written byte has completely left the channel.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+void pio_uart_tx_wait_blocking(uint8_t channel_index);
+
+/**
+ * @brief Returns true if the channel's RX state machine holds a received byte.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+bool pio_uart_is_readable(uint8_t channel_index);
+
+/**
+ * @brief Reads one byte from the channel, waiting until one is available.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+char pio_uart_getc(uint8_t channel_index);
+
+/**
+ * @brief Returns the TX FIFO register of a channel, used as DMA destination.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+volatile void *pio_uart_get_tx_fifo(uint8_t channel_index);
+
+/**
+ * @brief Returns the DREQ pacing DMA writes to the channel's TX FIFO.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+uint pio_uart_get_tx_dreq(uint8_t channel_index);
+
+/**
+ * @brief Clears the TX stall flag of a channel.
+ *
+ * Must be called after the last byte of a transfer has been written, so
+ * `pio_uart_is_tx_busy()` reports the end of that transfer.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+void pio_uart_clear_tx_stall(uint8_t channel_index);
+
+/**
+ * @brief Returns true while the channel still has bits to shift out.
+ *
+ * @param channel_index Channel returned by `pio_uart_channel_open()`.
+ */
+bool pio_uart_is_tx_busy(uint8_t channel_index);
+
+/**
+ * @brief Starts an RX-only listener on a GPIO, used by the client discovery.
  *
- * This function first wakes up the client by sending a pulse on its RX pin.
- * Then it initializes the UART peripheral with the specified TX/RX pins and baudrate,
- * sends the message, waits for the transmission to complete, and resets the GPIO pins.
- * All UART operations are protected by a spinlock to ensure thread/core safety.
+ * @param pin GPIO to receive on.
+ * @param baudrate Baud rate to receive at.
+ * @param is_passive true to leave the pin under its current (SIO) control and
+ *        only sample it, false to hand the pin over to the PIO with a pull-up.
+ * @return Listener index, or -1 if no state machine is free.
+ */
+int pio_uart_listener_open(uint8_t pin, uint32_t baudrate, bool is_passive);
+
+/**
+ * @brief Stops a listener, releasing its state machine and returning its pin to SIO.
+ *
+ * @param listener_index Listener returned by `pio_uart_listener_open()`.
+ */
+void pio_uart_listener_close(uint8_t listener_index);
+
+/**
+ * @brief Returns true if the listener holds a received byte.
+ *
+ * @param listener_index Listener returned by `pio_uart_listener_open()`.
+ */
+bool pio_uart_listener_is_readable(uint8_t listener_index);
+
+/**
+ * @brief Reads one byte from a listener, waiting until one is available.
  *
- * @param uart Pointer to the UART instance to use (e.g., uart0 or uart1).
- * @param pins Struct containing the TX and RX GPIO pin numbers.
- * @param msg Null-terminated string to be sent via UART.
+ * @param listener_index Listener returned by `pio_uart_listener_open()`.
  */
-void send_uart_message_safe(uart_inst_t* uart, uart_pin_pair_t pins, const char* msg);
+char pio_uart_listener_getc(uint8_t listener_index);
 
 /**
- * @brief Wakes up a dormant client if needed, based on its persistent state.
+ * @brief Enables or disables the "RX FIFO not empty" interrupt of a listener.
  *
- * Checks whether the client at the specified index is dormant. If so, it
- * sends a wake-up pulse via UART to ensure the client is active before communication.
+ * The interrupt is raised on IRQ 0 of the listener's PIO block.
  *
- * @param flash_client_index Index of the client in the persistent state table.
- * @param state              Pointer to the global persistent state structure.
- * @param pin_pair           UART TX/RX pins used to wake up the client.
- * @param uart               Pointer to the UART instance used for transmission.
+ * @param listener_index Listener returned by `pio_uart_listener_open()`.
+ * @param enabled true to enable.
+ */
+void pio_uart_listener_set_irq_enabled(uint8_t listener_index, bool enabled);
+
+/**
+ * @brief Installs `handler` on IRQ 0 of every PIO block, on the calling core.
  *
- * @see wake_up_client()
+ * @param handler Interrupt handler draining the listeners.
  */
-void send_wakeup_if_dormant(uint32_t flash_client_index, server_persistent_state_t *const state, uart_pin_pair_t pin_pair, uart_inst_t *const uart);
+void pio_uart_listener_set_irq_handler(irq_handler_t handler);
 
 /**
  * @brief Sends a dormant flag message to a specific client over UART.
@@ -109,54 +404,230 @@ void send_fast_blink_onboard_led_to_clients();
 void send_dormant_to_standby_clients(void);
 
 /**
- * @brief Sends the entire current client state over UART.
+ * @brief Brings a client's GPIOs in line with a desired state, sending only what changed.
+ *
+ * Compares the desired state with the last state queued for the client
+ * (`synced_gpio_mask` of its connection) and:
+ * - Sends nothing if both match
+ * - Sends a single device command if exactly one device differs
+ * - Sends one full state command (`FULL_STATE_FLAG_NUMBER` with the GPIO mask) otherwise
+ *
+ * A dormant client is woken up before anything is sent, then the frames are queued.
+ * `synced_gpio_mask` only follows once the state frame is queued; a dropped
+ * frame is sent again by `server_sync_clients_service()`.
+ *
+ * @param client_index Index of the client in `active_uart_server_connections`.
+ * @param state Pointer to the desired client state.
+ * @return true if the client is in sync or the frames were queued.
+ */
+bool server_sync_client_state(uint8_t client_index, const client_state_t* state);
+
+/**
+ * @brief Sends again the state of the connected clients whose last sync was dropped.
  *
- * @param pin_pair UART TX/RX pin pair to use.
- * @param uart UART instance.
- * @param state Pointer to the client_state_t to send.
+ * Syncs every linked client with its running state, which only queues
+ * something for the clients whose `synced_gpio_mask` lags behind. Called by
+ * core 0 while it waits for CLI input.
  */
-void server_send_client_state(uart_pin_pair_t pin_pair, uart_inst_t* uart, const client_state_t* state);
+void server_sync_clients_service(void);
 
 /**
  * @brief Core1 wakeup handler triggered by inter-core messages.
  *
+ * Registers core 1 with `flash_guard_register_core1()`, so core 0 can park
+ * it while writing flash. Messages therefore come through
+ * `server_post_core1_message()` rather than the SIO FIFO.
+ *
  * Handles two commands:
  * - `DUMP_BUFFER_WAKEUP_MESSAGE`: Reprints stored output to CLI.
  * - `BLINK_LED_WAKEUP_MESSAGE`: Triggers fast onboard LED blink and mirrors to clients.
+ *
+ * Between commands, runs the background client discovery (`server_hot_plug_service()`).
  */
 void periodic_wakeup(void);
 
+/**
+ * @brief Queues a message for `periodic_wakeup()` and wakes core 1.
+ *
+ * Core 0 only (main loop and its timer callbacks). A message is dropped if
+ * `CORE1_MESSAGE_QUEUE_SIZE - 1` are already pending.
+ *
+ * @param message `DUMP_BUFFER_WAKEUP_MESSAGE` or `BLINK_LED_WAKEUP_MESSAGE`.
+ */
+void server_post_core1_message(uint32_t message);
+
+/**
+ * @brief Registers the calling core (core 1) to be parked during flash writes.
+ *
+ * Installs the `multicore_lockout` handler, which owns the SIO FIFO from then on.
+ */
+void flash_guard_register_core1(void);
+
+/**
+ * @brief Waits until core 1 has called `flash_guard_register_core1()`.
+ *
+ * Called by core 0 right after launching core 1, before any flash write.
+ */
+void flash_guard_wait_for_core1(void);
+
+/**
+ * @brief Makes flash safe to erase or program: parks core 1, disables interrupts.
+ *
+ * Core 0 only. Keep the guarded section to one sector erase or page program.
+ *
+ * @return Interrupt state to pass to `flash_guard_end()`.
+ */
+uint32_t flash_guard_begin(void);
+
+/**
+ * @brief Restores interrupts and releases core 1 after `flash_guard_begin()`.
+ */
+void flash_guard_end(uint32_t interrupts);
+
+/**
+ * @brief Starts the background discovery of clients plugged in or reset after boot.
+ *
+ * Installs the PIO listener interrupt on the calling core (core 1) and
+ * attaches the first batch of passive listeners.
+ */
+void server_hot_plug_init(void);
+
+/**
+ * @brief Handles connection requests heard by the background discovery.
+ *
+ * Completes the handshake of a client that requested a connection, adds or
+ * updates its connection and pushes only its running state. Also rotates the
+ * listeners when not every pin pair can be watched at once.
+ *
+ * @return Time at which the service must run again, even without any event.
+ */
+absolute_time_t server_hot_plug_service(void);
+
 /**
  * @brief Scans all possible UART pin pairs to detect connected clients.
  *
- * Performs UART handshakes and fills `active_uart_server_connections` with
+ * Listens on the `uart0`, `uart1` and PIO pin pairs in parallel, in as few
+ * `SERVER_TIMEOUT_MS` windows as the available receivers allow, and completes
+ * each handshake as soon as its request arrives. Pairs that already have a
+ * client are skipped. Performs UART handshakes and fills `active_uart_server_connections` with
  * valid connections.
  *
  * @return true if at least one client is found and validated, false otherwise.
  */
 bool server_find_connections(void);
 
+/**
+ * @brief Reconnects the clients recorded in the flash topology, with short windows.
+ *
+ * Listens only on the last pin pair of the registered clients whose
+ * `topology.is_known` is set, for
+ * `SERVER_RECONNECT_TIMEOUT_MS` per window. Meant for watchdog reboots, when
+ * the clients have just been reset and retry their last pin pair first.
+ *
+ * @return true if every known client reconnected, false if the topology is
+ *         missing or at least one known pair stayed silent.
+ */
+bool server_reconnect_known_clients(void);
+
+/**
+ * @brief Completes a handshake over a PIO channel, for a request heard by a listener.
+ *
+ * Used by the background discovery, which never touches the hardware UARTs:
+ * hardware pin pairs are handshaken through a temporary PIO channel too.
+ *
+ * @param pio_channel Open PIO channel with its RX state machine attached.
+ * @param link_uart Hardware UART that will carry the link (limits the baud rate), NULL for PIO links.
+ * @param request Received request of the form "Requesting Connection-[tx,rx]".
+ * @param connection Receives the client's reverse pin pair and the agreed baud rate on success.
+ * @return true if the handshake succeeded, the channel is left at the agreed baud rate.
+ */
+bool server_complete_pio_handshake(uint8_t pio_channel, uart_inst_t *link_uart, const char *request, server_uart_connection_t *connection);
+
+/**
+ * @brief Records the current topology in the persistent state.
+ *
+ * Sets `topology` of every registered client from its linked connection in
+ * `active_uart_server_connections`: whether it is connected, and its reverse
+ * pin pair. Connected clients also get their current server pin pair and the
+ * UART pin reservations of their reverse pin pair, and rank as the most
+ * recently connected clients (`server_client_registry_touch_connected()`).
+ *
+ * @param server_persistent_state Persistent state to update (not saved).
+ * @return true if the stored topology changed.
+ */
+bool server_update_topology(server_persistent_state_t *server_persistent_state);
+
 /**
  * @brief Sets the state of a single device and updates flash accordingly.
  *
- * - Sends the updated GPIO state to the client via UART.
- * - Loads a copy of the persistent state from flash.
- * - Updates the state in RAM and saves the structure back to flash.
+ * - Updates the in-RAM persistent state (committed to flash later).
+ * - Syncs it to the client via UART
+ *   (nothing is sent if the device already has the requested state).
  *
- * @param pin_pair TX/RX pins for the UART connection to the client.
- * @param uart_instance UART peripheral used.
- * @param gpio_index GPIO number to modify on the client.
+ * @param device_index Index of the device in the client state (0-based).
  * @param device_state true = ON, false = OFF.
  * @param flash_client_index Index of the client in flash storage.
  */
-void server_set_device_state_and_update_flash(uart_pin_pair_t pin_pair, uart_inst_t* uart_instance, uint8_t gpio_index, bool device_state, uint32_t flash_client_index);
+void server_set_device_state_and_update_flash(uint8_t device_index, bool device_state, uint32_t flash_client_index);
+
+/**
+ * @brief Marks a connected client dormant once all its devices are OFF, active otherwise.
+ *
+ * A dormant client is told so, an active one was woken up by the state sync.
+ *
+ * @param active_client_index Index of the client in the active connections.
+ * @param client Saved state of the client.
+ */
+void server_update_dormant_state(uint8_t active_client_index, const client_t *client);
+
+/**
+ * @brief Starts an empty device transaction.
+ *
+ * @param transaction Transaction to clear.
+ */
+void server_device_transaction_begin(server_device_transaction_t *transaction);
+
+/**
+ * @brief Stages a device state in a transaction, nothing is applied yet.
+ *
+ * @param transaction Transaction started by `server_device_transaction_begin()`.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @param device_index Index of the device in the client state (0-based).
+ * @param device_state true = ON, false = OFF.
+ * @return false if the client or device index is out of range, nothing is staged then.
+ */
+bool server_device_transaction_stage(server_device_transaction_t *transaction, uint32_t flash_client_index, uint8_t device_index, bool device_state);
+
+/**
+ * @brief Returns the running state of a client with its staged changes applied.
+ *
+ * Nothing is applied, the copy only shows what `server_device_transaction_commit()` would set.
+ *
+ * @param transaction Staged changes.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @return client_state_t Running state of the client after the commit.
+ */
+client_state_t server_device_transaction_preview(const server_device_transaction_t *transaction, uint32_t flash_client_index);
+
+/**
+ * @brief Applies every staged change in one step.
+ *
+ * - Updates the running states of all staged clients in a single edit
+ *   (devices reserved for the UART link stay OFF).
+ * - Syncs each connected client whose state changed with one frame
+ *   (`server_sync_client_state()`), and updates its dormant state.
+ * - Commits the state to flash once.
+ *
+ * @param transaction Staged changes.
+ * @return Number of clients whose running state changed.
+ */
+uint8_t server_device_transaction_commit(const server_device_transaction_t *transaction);
 
 /**
  * @brief Saves the current running configuration of a client into a preset slot.
  *
- * Loads the full persistent server state from flash, copies the active running state
- * of the specified client into the selected preset configuration slot, and saves
- * the updated structure back to flash.
+ * Copies the active running state of the specified client into the selected
+ * preset configuration slot of the in-RAM persistent state (committed to flash later).
  *
  * @param flash_configuration_index Index of the target preset configuration [0..(NUMBER_OF_POSSIBLE_PRESETS - 1)].
  * @param flash_client_index Index of the client within the persistent flash state.
@@ -211,9 +682,8 @@ void reset_all_client_data(uint32_t flash_client_index);
 /**
  * @brief Resets the running configuration of a specified client to its default state.
  *
- * Loads the server's persistent state, resets the client's current configuration,
- * sends the updated state to the client, marks the client as dormant, and saves
- * the updated state back to flash.
+ * Resets the client's current configuration in the persistent state, sends the
+ * updated state to the client and marks the client as dormant.
  *
  * @param flash_client_index Index of the client in the persistent flash state array.
  */
@@ -222,9 +692,8 @@ void reset_running_configuration(uint32_t flash_client_index);
 /**
  * @brief Resets a specific preset configuration for a given client in flash.
  *
- * This function loads the current persistent server state from flash,
- * resets the specified preset configuration for the given client (excluding UART flags),
- * and then saves the updated state back to flash memory.
+ * Resets the specified preset configuration for the given client (excluding UART flags)
+ * in the persistent state.
  *
  * @param[in] flash_client_index Index of the client in the flash-stored client list.
  * @param[in] flash_configuration_index Index of the preset configuration to reset (1-based).
@@ -232,65 +701,357 @@ void reset_running_configuration(uint32_t flash_client_index);
 void reset_preset_configuration(uint32_t flash_client_index, uint32_t flash_configuration_index);
 
 /**
- * @brief Fills the entire persistent state structure and saves it to flash.
+ * @brief Starts an empty client registry, saved to flash later.
  *
  * - Called when flash is empty or invalid.
- * - Configures all known clients.
+ * - Connected clients are registered as they are linked (see `server_client_registry_link()`).
+ * - Keeps the state saved by the first releases (`load_legacy_server_state()`).
+ */
+void server_configure_persistent_state(void);
+
+/**
+ * @brief Returns the client ID of a client that reports none, derived from its server pin pair.
+ */
+static inline client_id_t server_legacy_client_id(uart_pin_pair_t pin_pair){
+    return CLIENT_ID_LEGACY_PREFIX | ((client_id_t)pin_pair.tx << 8) | pin_pair.rx;
+}
+
+/**
+ * @brief Returns the registry entry of a client ID, by scanning the registry.
+ *
+ * Only used when a client connects; afterwards its entry is reached through
+ * `server_flash_index_of_active()`.
+ *
+ * @return Index in the persistent state, or `CLIENT_INDEX_NOT_CONNECTED`.
+ */
+uint8_t server_client_registry_find(const server_persistent_state_t *state, client_id_t client_id);
+
+/**
+ * @brief Returns the registry entry of a connection's client, registering it if needed.
+ *
+ * A client without an entry takes over the entry of its pin pair (kept for a
+ * client without ID), else gets a free entry, else reuses a disconnected one.
+ *
+ * @param state Persistent state being edited.
+ * @param connection Connection of the client.
+ * @return Index in the persistent state.
+ */
+uint8_t server_client_registry_register(server_persistent_state_t *state, const server_uart_connection_t *connection);
+
+/**
+ * @brief Ranks every connected client above every disconnected one.
+ *
+ * Connected clients that rank at or below a disconnected one become the most
+ * recently connected ones, in index order. Nothing changes while the ranking
+ * already holds, so reconnecting the same clients writes nothing to flash.
+ *
+ * @param state Persistent state being edited.
+ * @return true if a rank changed.
+ */
+bool server_client_registry_touch_connected(server_persistent_state_t *state);
+
+/**
+ * @brief Empties the registry and the preset pool.
+ *
+ * @param state Persistent state being edited.
+ */
+void server_client_registry_clear(server_persistent_state_t *state);
+
+/**
+ * @brief Links an active connection to its registry entry, registering the client if needed (core 0 only).
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @return Index in the persistent state.
+ */
+uint8_t server_client_registry_link(uint8_t active_client_index);
+
+/**
+ * @brief Asks core 0 to link a connection added or changed after boot.
+ *
+ * Called by the background discovery on core 1, which must not edit the state.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ */
+void server_client_registry_request_link(uint8_t active_client_index);
+
+/**
+ * @brief Hands the new handshake of a known connection over to core 0.
+ *
+ * Called by the background discovery on core 1 with the client's traffic
+ * suspended. Core 0 updates the connection, resumes its traffic, then links it
+ * or loads its saved state. A later handshake of the same connection replaces
+ * a result core 0 has not applied yet.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @param connection Result of the handshake, NULL if it failed.
+ */
+void server_client_registry_request_handshake(uint8_t active_client_index, const server_uart_connection_t *connection);
+
+/**
+ * @brief Links the connections requested by core 1 and loads their saved state.
+ *
+ * Applies the handshakes of known connections first, registers unknown
+ * clients, records the topology, then syncs each client's running state.
+ * Called by core 0 while it waits for CLI input.
+ */
+void server_client_registry_service(void);
+
+/**
+ * @brief Returns a preset configuration of a client.
+ *
+ * A client without preset set reads as all devices OFF.
+ *
+ * @param state Persistent state.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @param preset_index Preset index [0..(NUMBER_OF_POSSIBLE_PRESETS - 1)].
+ */
+client_state_t server_client_get_preset(const server_persistent_state_t *state, uint32_t flash_client_index, uint32_t preset_index);
+
+/**
+ * @brief Returns a preset configuration of a client for editing.
+ *
+ * Takes a preset set from the pool if the client has none yet.
+ *
+ * @param state Persistent state being edited.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @param preset_index Preset index [0..(NUMBER_OF_POSSIBLE_PRESETS - 1)].
+ * @return The preset, or NULL if the pool is exhausted.
+ */
+client_state_t *server_client_edit_preset(server_persistent_state_t *state, uint32_t flash_client_index, uint32_t preset_index);
+
+/**
+ * @brief Gives a client's preset set back to the pool if all its presets are OFF.
+ *
+ * @param state Persistent state being edited.
+ * @param flash_client_index Index of the client in the persistent state.
+ */
+void server_client_trim_presets(server_persistent_state_t *state, uint32_t flash_client_index);
+
+/**
+ * @brief Sets the devices reserved for the UART link in the running state and presets of a client.
  *
- * @param server_persistent_state Pointer to state struct to fill and write.
+ * Reserved devices are switched OFF.
+ *
+ * @param state Persistent state being edited.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @param reserved_mask Bit n = device n is reserved.
+ */
+void server_client_set_reserved_mask(server_persistent_state_t *state, uint32_t flash_client_index, uint32_t reserved_mask);
+
+/**
+ * @brief Returns true if device `device_index` is ON.
+ */
+static inline bool client_state_is_on(const client_state_t *client_state, uint8_t device_index){
+    return (client_state->on_mask >> device_index) & 1u;
+}
+
+/**
+ * @brief Returns true if device `device_index` is used by the UART connection.
+ */
+static inline bool client_state_is_reserved(const client_state_t *client_state, uint8_t device_index){
+    return (client_state->reserved_mask >> device_index) & 1u;
+}
+
+/**
+ * @brief Switches device `device_index` ON or OFF; reserved devices stay OFF.
+ */
+static inline void client_state_set(client_state_t *client_state, uint8_t device_index, bool is_on){
+    uint32_t bit = (1u << device_index) & ~client_state->reserved_mask;
+    client_state->on_mask = is_on ? (client_state->on_mask | bit) : (client_state->on_mask & ~bit);
+}
+
+/**
+ * @brief Returns the number of devices that are ON.
+ */
+static inline uint8_t client_state_count_on(const client_state_t *client_state){
+    return (uint8_t)__builtin_popcount(client_state->on_mask);
+}
+
+/**
+ * @brief Returns true if any device is ON.
+ */
+static inline bool client_state_any_on(const client_state_t *client_state){
+    return client_state->on_mask != 0;
+}
+
+/**
+ * @brief Returns the devices whose ON/OFF state differs between two states.
+ */
+static inline uint32_t client_state_diff(const client_state_t *a, const client_state_t *b){
+    return a->on_mask ^ b->on_mask;
+}
+
+/**
+ * @brief Toggles the devices set in `diff` (as from `client_state_diff()`), except reserved ones.
  */
-void server_configure_persistent_state(server_persistent_state_t *server_persistent_state);
+static inline void client_state_apply(client_state_t *client_state, uint32_t diff){
+    client_state->on_mask ^= diff & ~client_state->reserved_mask;
+}
+
+/**
+ * @brief Checks if a client has any active (ON) device in its running state.
+ *
+ * @param client The client structure to inspect.
+ * @return true if any device is ON; false otherwise.
+ */
+static inline bool client_has_active_devices(const client_t *client){
+    return client_state_any_on(&client->running_client_state);
+}
 
 /**
  * @brief Resets the runtime GPIO configuration for a given client.
  *
- * This function iterates through all devices associated with the client
- * and sets their `is_on` flag to false, effectively turning them off.
- * Devices marked with the special UART connection flag are excluded from this reset.
+ * Turns every device off. Devices reserved for the UART connection keep
+ * their reservation.
  *
  * @param[in,out] client_state Pointer to the client's current runtime state to be modified.
  */
 void server_reset_configuration(client_state_t *client_state);
 
 /**
- * @brief Loads the server state from flash and validates it using CRC32.
+ * @brief Loads the server state from flash into RAM, once at boot.
  *
- * @param out_state Pointer to destination structure to store loaded state.
- * @return true if CRC is valid and data is intact, false otherwise.
+ * Rebuilds the state from the flash log (packed snapshot validated using
+ * CRC32, then change records), migrating other layouts. Must run on core 0
+ * before any other accessor.
+ */
+void server_state_init(void);
+
+/**
+ * @brief Returns true if the state loaded at boot was intact, or has been configured since.
  */
-bool load_server_state(server_persistent_state_t *out_state);
+bool server_state_is_valid(void);
 
 /**
- * @brief Saves the persistent server state structure to flash memory.
+ * @brief Returns the authoritative in-RAM server state, for reading on core 0.
+ */
+const server_persistent_state_t *server_state_get(void);
+
+/**
+ * @brief Starts an in-place edit of the server state (core 0 only).
  *
- * - Computes CRC
- * - Erases and programs the flash sector
+ * Keep the edit short and end it with `server_state_end_edit()` before
+ * sending anything to clients: core 1 waits for it to take consistent copies.
  *
- * @param state_in Pointer to the server_persistent_state_t structure to save.
+ * @return The state to edit.
  */
-void __not_in_flash_func(save_server_state)(const server_persistent_state_t *state_in);
+server_persistent_state_t *server_state_begin_edit(void);
 
 /**
- * @brief Retrieves the index of an active client connection matching a flash-stored client.
+ * @brief Ends an edit and marks the state for a deferred flash commit.
+ */
+void server_state_end_edit(void);
+
+/**
+ * @brief Copies one saved client consistently, from any core.
  *
- * Iterates through active UART server connections and compares their TX pins
- * with the TX pin of the client at the specified index in the persistent flash state.
+ * Meant for core 1, which must neither see a half-done edit nor hold a full
+ * state on its stack.
  *
- * @param flash_client_index Index of the client in the persistent flash state array.
- * @param state The loaded persistent server state.
- * @return Index of the matching active connection, or INVALID_CLIENT_INDEX if not found.
+ * @param flash_client_index Index of the client in the persistent state.
+ * @param out_client Receives the copy.
+ * @return Same as `server_state_is_valid()`.
  */
-uint32_t get_active_client_connection_index_from_flash_client_index(uint32_t flash_client_index, server_persistent_state_t state);
+bool server_state_read_client(uint32_t flash_client_index, client_t *out_client);
+
+/**
+ * @brief Registers the clients saved by the first releases in an empty registry.
+ *
+ * Those releases saved a plain structure of 5 clients, one per hardware UART
+ * pin pair, at the start of the last flash sector. Its clients with a device
+ * ON are keyed by their pin pair (`server_legacy_client_id()`), so each one
+ * takes its entry over on its first handshake.
+ *
+ * @param[in,out] state Persistent state being configured, registry cleared.
+ * @return true if such a structure was intact and imported.
+ */
+bool load_legacy_server_state(server_persistent_state_t *state);
+
+/**
+ * @brief Writes the state edits to flash now, if there are unwritten ones.
+ *
+ * - Appends one change record per device whose state changed (one page program)
+ * - Compacts the log into a new snapshot (erase and program) when it is full
+ *   or when anything else changed
+ *
+ * Core 0 only. Must be called before any intentional reboot.
+ */
+void server_state_flush(void);
+
+/**
+ * @brief Applies the commit policy to the state edits.
+ *
+ * Flushes once no edit happened for `SERVER_STATE_COMMIT_DEBOUNCE_MS`, or once
+ * the oldest unwritten edit is `SERVER_STATE_COMMIT_MAX_AGE_MS` old. Until then,
+ * if the pending edits need a compaction, erases one sector of the spare log
+ * bank per call. Called by core 0 while it waits for CLI input.
+ */
+void server_state_service(void);
+
+/**
+ * @brief Prints how long each CRC32 engine takes over a bank header and the largest snapshot.
+ *
+ * Compares the DMA sniffer (`compute_crc32()` in state_flash.c) with the
+ * slicing-by-8 and bitwise engines of crc32.c on the target. Only built with
+ * `SERVER_CRC32_BENCHMARK`; core 0 only, it overwrites the flash staging buffer.
+ */
+void server_state_crc32_benchmark(void);
+
+/**
+ * @brief Rebuilds the tables linking active connections and saved clients.
+ *
+ * Called whenever the connection list or the registry is replaced (boot
+ * discovery, state reconfiguration). Clients are matched on their client ID,
+ * once, so lookups are constant-time afterwards. Connections of unregistered
+ * clients stay unlinked.
+ */
+void server_client_index_map_rebuild(void);
+
+/**
+ * @brief Links a connection to a saved client, dropping its previous link.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @param flash_client_index Index in the persistent state, or `CLIENT_INDEX_NOT_CONNECTED` to unlink.
+ */
+void server_client_index_map_set(uint8_t active_client_index, uint8_t flash_client_index);
+
+/**
+ * @brief Returns the saved client of an active connection, in constant time.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @return Index in the persistent state, or `CLIENT_INDEX_NOT_CONNECTED`.
+ */
+uint8_t server_flash_index_of_active(uint32_t active_client_index);
+
+/**
+ * @brief Returns the active connection of a saved client, in constant time.
+ *
+ * @param flash_client_index Index of the client in the persistent state.
+ * @return Index in `active_uart_server_connections`, or `CLIENT_INDEX_NOT_CONNECTED`.
+ */
+uint8_t server_active_index_of_flash(uint32_t flash_client_index);
 
 /**
  * @brief Loads saved GPIO states from flash and sends them to active clients.
  *
- * - Verifies CRC of saved state in flash.
- * - Sends current (running) state to each active client over UART.
- * - If CRC is invalid, calls `server_configure_persistent_state()` to reset flash.
+ * - If the state loaded at boot is invalid, calls `server_configure_persistent_state()` first.
+ * - Links every active client to its registry entry, registering new clients.
+ * - Saves the topology if it changed (see `server_update_topology()`).
+ * - Syncs current (running) state to each active client over UART (only devices that are ON).
  */
 void server_load_running_states_to_active_clients(void);
 
+/**
+ * @brief Loads the saved GPIO state of a single, freshly handshaken client.
+ *
+ * Same as `server_load_running_states_to_active_clients()` for one client,
+ * without touching the others: syncs its running state, then sends it to
+ * dormant if no device is ON.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ */
+void server_load_running_state_to_client(uint8_t active_client_index);
+
 /**
  * @brief Prints the state of all devices from a given client state structure.
  *
@@ -312,10 +1073,10 @@ void server_print_running_client_state(const client_t * client);
 /**
  * @brief Prints a saved preset configuration for a given client.
  *
- * @param client Pointer to the client_t.
+ * @param flash_client_index Index of the client in the persistent state.
  * @param client_preset_index Preset index to print (0 to NUMBER_OF_POSSIBLE_PRESETS - 1).
  */
-void server_print_client_preset_configuration(const client_t * client, uint8_t client_preset_index);
+void server_print_client_preset_configuration(uint32_t flash_client_index, uint8_t client_preset_index);
 
 /**
  * @brief Prints all preset configurations for a client.
@@ -324,38 +1085,20 @@ void server_print_client_preset_configuration(const client_t * client, uint8_t c
  * - Prints each configuration using `server_print_client_preset_configuration()`.
  * - Adds spacing between configurations for clarity.
  *
- * @param client Pointer to the client_t structure containing the preset configurations.
+ * @param flash_client_index Index of the client in the persistent state.
  */
-void server_print_client_preset_configurations(const client_t * client);
+void server_print_client_preset_configurations(uint32_t flash_client_index);
 
-/**
- * @brief Checks if a client has any active (ON) devices.
- *
- * Iterates through the client's GPIO-controlled devices and returns true
- * if at least one is currently turned ON.
- *
- * @param client The client structure to inspect.
- * @return true if any device is ON; false otherwise.
- */
-bool client_has_active_devices(client_t client);
 
 /**
- * @brief Finds the corresponding flash client index for a given active client.
+ * @brief Packs the ON/OFF state of all devices into a GPIO bit mask.
  *
- * Compares the TX pin of the selected client with entries in the flash structure to
- * determine the matching flash client index.
+ * Bit n is set when the device driving GPIO n is ON. Devices reserved for the
+ * UART connection are never included.
  *
- * @param flash_client_index Output pointer to store the resolved flash index.
- * @param client_index Index of the selected client (1-based).
- * @param flash_state Pointer to the flash-stored server state.
+ * @param client_state Pointer to the client state to pack.
+ * @return GPIO bit mask of all devices that are ON.
  */
-inline void find_corect_client_index_from_flash(uint32_t *flash_client_index, uint32_t client_index, const server_persistent_state_t *flash_state){
-    for (uint8_t index = 0; index < MAX_SERVER_CONNECTIONS; index++){
-        if (active_uart_server_connections[client_index - 1].pin_pair.tx == flash_state->clients[index].uart_connection.pin_pair.tx){
-            *flash_client_index = index;
-            break;
-        }   
-    }
-}
+uint32_t client_state_get_gpio_mask(const client_state_t *client_state);
 
 #endif
\ No newline at end of file
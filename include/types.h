@@ -37,6 +37,28 @@ extern const uart_pin_pair_t pin_pairs_uart0[];
  */
 extern const uart_pin_pair_t pin_pairs_uart1[];
 
+/**
+ * @brief Server pin pairs scanned with PIO UART channels.
+ *
+ * Any GPIO can be driven by PIO, so these are the pairs left free by the
+ * hardware UART pairs above.
+ */
+extern const uart_pin_pair_t pin_pairs_pio[];
+
+/**
+ * @brief Baud rates tried during the handshake negotiation, fastest first.
+ *
+ * The last entry is `DEFAULT_BAUDRATE`, the rate used by the handshake itself.
+ */
+extern const uint32_t negotiable_baudrates[];
+
+/**
+ * @brief Stable identity of a client, independent of the pin pair it is plugged into.
+ *
+ * Clients report their unique board ID in the handshake acknowledgment.
+ */
+typedef uint64_t client_id_t;
+
 /**
  * @brief Represents an established UART connection.
  *
@@ -48,60 +70,102 @@ typedef struct{
     uart_inst_t* uart_instance;
 }uart_connection_t;
 
+/**
+ * @brief Peripheral carrying a server-to-client link.
+ */
+typedef enum{
+    UART_TRANSPORT_HARDWARE,    ///< uart0/uart1, shared between clients by pin muxing
+    UART_TRANSPORT_PIO,         ///< PIO state machine dedicated to the client
+}uart_transport_t;
+
 /**
  * @brief Represents an active UART connection detected by the server.
  *
  * Also stores the reverse TX/RX pair used by the client to send data to the server.
+ * A client handshakes only right after it boots, so `synced_gpio_mask` starts at 0
+ * (all devices OFF) and is kept up to date by `server_sync_client_state()`.
  */
 typedef struct{
     uart_pin_pair_t pin_pair;
-    uart_inst_t* uart_instance;
+    uart_inst_t* uart_instance;         ///< Hardware UART, NULL for PIO connections
+    uart_transport_t transport;
+    uint8_t pio_channel;                ///< PIO UART channel, for `UART_TRANSPORT_PIO` only
     uart_pin_pair_t uart_pin_pair_from_client_to_server; ///< Reverse pin mapping from client
+    client_id_t client_id;      ///< Reported by the client, or derived from `pin_pair` (`CLIENT_ID_LEGACY_PREFIX`)
     bool is_dormant;
+    uint32_t baudrate;          ///< Baud rate agreed with the client during the handshake
+    uint32_t synced_gpio_mask;  ///< GPIO state last queued for the client (bit n = GPIO n ON)
 }server_uart_connection_t;
 
 /**
- * @brief Represents a single controllable GPIO device on a client.
+ * @brief Represents the current or saved state of a client's GPIO devices.
  *
- * Each device corresponds to a GPIO number and an ON/OFF state.
+ * Covers all available GPIOs (usually 26 per client), one bit per device:
+ * bit n describes device n, which drives GPIO `board_device_to_gpio(n)`.
  */
 typedef struct{
-    uint8_t gpio_number;
-    bool is_on;
-}device_t;
+    uint32_t on_mask;           ///< Bit n = device n is ON
+    uint32_t reserved_mask;     ///< Bit n = device n is used by the UART connection, never switched
+}client_state_t;
 
 /**
- * @brief Represents the current or saved state of a client's GPIO devices.
- *
- * Includes the status of all available GPIOs (usually 26 per client).
+ * @brief Last-known link of a client, kept in flash for fast reconnection.
  */
 typedef struct{
-    device_t devices[MAX_NUMBER_OF_GPIOS];  ///< Array of GPIO devices
-}client_state_t;
+    bool is_known;                                  ///< A client completed the handshake on this pin pair
+    uart_pin_pair_t client_to_server_pin_pair;      ///< Reverse pin pair reported by that client
+}client_topology_t;
 
 /**
- * @brief Represents a complete client entry in the system.
+ * @brief Represents a complete client entry in the registry.
  *
- * Contains both live (running) GPIO state and a number of preset configurations.
- * Also stores the UART connection information and whether the client is active.
+ * Keyed by the client's ID, so the entry follows the client from one pin pair
+ * to another. Contains the live (running) GPIO state; preset configurations
+ * live in a shared pool, allocated the first time the client saves one.
  */
 typedef struct{
+    client_id_t client_id;
     client_state_t running_client_state;
-    client_state_t preset_configs[NUMBER_OF_POSSIBLE_PRESETS];
-    uart_connection_t uart_connection;
+    uint8_t preset_set;                 ///< Index in `server_persistent_state_t.preset_sets`, or `CLIENT_NO_PRESET_SET`
+    uart_connection_t uart_connection;  ///< Server pin pair the client was last connected on
+    client_topology_t topology;
+    uint8_t recency;                    ///< Rank by last connection among the registered clients, higher = more recent
 }client_t;
 
 /**
- * @brief Full persistent state saved in flash.
+ * @brief Preset configurations of one client.
+ */
+typedef struct{
+    client_state_t presets[NUMBER_OF_POSSIBLE_PRESETS];
+}client_preset_set_t;
+
+/**
+ * @brief Full persistent state saved in flash: the client registry.
  *
- * Holds all known clients and their saved configurations.
- * Includes a CRC32 checksum for integrity verification.
+ * Registered clients occupy `clients[0..clients_number)`; an entry keeps its
+ * index for the lifetime of the registry and is only reused once the registry
+ * is full (see client_registry.c). Only its RAM layout; the flash image is
+ * packed separately (see state_flash.c).
  */
 typedef struct {
-    client_t clients[MAX_SERVER_CONNECTIONS];
-    uint32_t crc;
+    uint8_t clients_number;
+    client_t clients[MAX_REGISTERED_CLIENTS];
+    uint32_t preset_sets_used;          ///< Bit n = `preset_sets[n]` belongs to a client
+    client_preset_set_t preset_sets[MAX_CLIENT_PRESET_SETS];
 } server_persistent_state_t;
 
+/**
+ * @brief Device changes staged across clients, applied at once by `server_device_transaction_commit()`.
+ *
+ * Indexed like `server_persistent_state_t.clients`. A device staged twice keeps
+ * the last state staged for it.
+ */
+typedef struct{
+    uint32_t staged_clients;                    ///< Bit n = `clients[n]` has staged changes
+    uint32_t on_masks[MAX_REGISTERED_CLIENTS];  ///< Bit n = switch device n ON
+    uint32_t off_masks[MAX_REGISTERED_CLIENTS]; ///< Bit n = switch device n OFF
+}server_device_transaction_t;
+
 /**
  * @struct input_client_data_t
  * @brief Stores all user-selected input values required for client-related operations.
@@ -3,9 +3,9 @@
  * @brief Handles incoming GPIO commands on the client side.
  *
  * This module:
- * - Listens for UART messages from the server
- * - Parses commands of the form "[gpio, value]"
- * - Applies the commands by controlling GPIO pins
+ * - Consumes bytes buffered by the UART RX interrupt (see uart_rx_buffer.c)
+ * - Extracts commands from the byte stream (see protocol.h for the wire format)
+ * - Applies device and full state commands by controlling GPIO pins
  */
 
 #include <stdio.h>
@@ -18,6 +18,10 @@
 #include "client.h"
 #include "types.h"
 #include "functions.h"
+#include "protocol.h"
+
+/// GPIOs currently driven HIGH by this client (bit n = GPIO n).
+static uint32_t gpio_on_mask = 0;
 
 /**
  * @brief Sets or clears a GPIO pin based on a number and logic level.
@@ -33,7 +37,7 @@
  *
  * This allows toggling pins **and** releasing unused ones to save power.
  *
- * @param gpio_number GPIO pin number (0–22 and 26-28).
+ * @param gpio_number GPIO pin number, a device of the board (see board.h).
  * @param gpio_state  Logic level: 0 = LOW, 1 = HIGH.
  */
 static void change_gpio(uint8_t gpio_number, uint8_t gpio_state){
@@ -41,27 +45,71 @@ static void change_gpio(uint8_t gpio_number, uint8_t gpio_state){
         gpio_init(gpio_number);
         gpio_set_dir(gpio_number, GPIO_OUT); 
         gpio_put(gpio_number, gpio_state);
+        gpio_on_mask |= (1u << gpio_number);
     }else{
         gpio_put(gpio_number, gpio_state);
         gpio_deinit(gpio_number);
+        gpio_on_mask &= ~(1u << gpio_number);
+    }
+}
+
+/**
+ * @brief Assigns a GPIO function to every pin set in a mask.
+ *
+ * @param gpio_mask Bit mask of GPIOs to update (bit n = GPIO n).
+ * @param gpio_function Function to select for those pins.
+ */
+static void set_gpio_function_for_mask(uint32_t gpio_mask, gpio_function_t gpio_function){
+    while (gpio_mask){
+        uint8_t gpio_number = __builtin_ctz(gpio_mask);
+        gpio_set_function(gpio_number, gpio_function);
+        gpio_mask &= gpio_mask - 1;
     }
 }
 
 /**
- * @brief Applies a command based on a received UART message.
+ * @brief Applies a full device state received as a GPIO bit mask.
+ *
+ * Only pins whose state changes are touched. Newly enabled pins are taken over
+ * by SIO as outputs, all output levels are written with a single masked GPIO
+ * write, and newly disabled pins are released (same end state as `change_gpio()`).
+ * The client's own UART pins are never modified.
+ *
+ * @param gpio_mask Requested state, bit n set = GPIO n ON.
+ */
+static void change_gpio_mask(uint32_t gpio_mask){
+    uint32_t uart_pins_mask = (1u << active_uart_client_connection.pin_pair.tx) |
+                              (1u << active_uart_client_connection.pin_pair.rx);
+    uint32_t new_on_mask = gpio_mask & BOARD_DEVICE_GPIO_MASK & ~uart_pins_mask;
+    uint32_t turned_on_mask = new_on_mask & ~gpio_on_mask;
+    uint32_t turned_off_mask = gpio_on_mask & ~new_on_mask;
+
+    gpio_put_masked(turned_on_mask | turned_off_mask, new_on_mask);
+    gpio_set_dir_out_masked(turned_on_mask);
+    set_gpio_function_for_mask(turned_on_mask, GPIO_FUNC_SIO);
+    set_gpio_function_for_mask(turned_off_mask, GPIO_FUNC_NULL);
+
+    gpio_on_mask = new_on_mask;
+}
+
+/// Frame extractor state, kept across calls so split frames are not lost.
+static protocol_receiver_t command_receiver;
+
+/**
+ * @brief Applies a command received from the server.
  *
- * Interprets the first byte of the received number pair as a command flag
- * and performs the corresponding action, such as resetting the device,
- * blinking the onboard LED, toggling the power state, or changing GPIO state.
+ * Interprets the command code as a command flag and performs the corresponding
+ * action, such as resetting the device, blinking the onboard LED, toggling the
+ * power state, or changing GPIO state.
  *
- * @param received_number_pair Pointer to a read-only array of two `uint8_t` values.
- *        The first element is interpreted as a command flag.
+ * @param command Pointer to the decoded command.
  *
  * Supported command flags:
  * - `TRIGGER_RESET_FLAG_NUMBER` → Soft reset using watchdog
  * - `BLINK_ONBOARD_LED_FLAG_NUMBER` → Blink onboard LED (blocking)
  * - `WAKE_UP_FLAG_NUMBER` → Set `go_dormant_flag = false`
  * - `DORMANT_FLAG_NUMBER` → Set `go_dormant_flag = true`
+ * - `FULL_STATE_FLAG_NUMBER` → Value is a GPIO mask, delegated to `change_gpio_mask()`
  * - Any other value → Delegated to `change_gpio()`
  *
  * @note This function includes debug output via `printf()` for logging purposes.
@@ -70,9 +118,9 @@ static void change_gpio(uint8_t gpio_number, uint8_t gpio_state){
  * @see watchdog_reboot()
  * @see fast_blink_onboard_led_blocking()
  */
-static void apply_command(const uint8_t *received_number_pair){
-    uint8_t number1 = received_number_pair[0];
-    uint8_t number2 = received_number_pair[1];
+static void apply_command(const protocol_command_t *command){
+    uint8_t number1 = command->code;
+    uint32_t number2 = command->value;
 
     switch(number1){
         case TRIGGER_RESET_FLAG_NUMBER: watchdog_reboot(0, 0, 0);
@@ -83,31 +131,63 @@ static void apply_command(const uint8_t *received_number_pair){
             break;
         case DORMANT_FLAG_NUMBER: go_dormant_flag = true;
             break;
+        case FULL_STATE_FLAG_NUMBER: change_gpio_mask(number2);
+            break;
 
         default: 
-            if ((0 <= number1 && 22 >= number1) || (26 <= number1 && 28 >= number1))
+            if (board_gpio_is_device(number1))
                 change_gpio(number1, number2);
             break;
     }
 }
 
 /**
- * @brief Receives and processes a UART command.
+ * @brief Processes all bytes received since the last call.
  *
- * This function attempts to read a UART message into a buffer and parse it
- * into a numeric command. If the buffer is not empty, it applies the
- * corresponding command using the parsed number pair.
+ * Pops bytes buffered by the UART RX interrupt and feeds them into the frame
+ * extractor, applying every complete command in arrival order. Back-to-back
+ * commands are therefore all applied, even when they arrive together.
+ * Valid and corrupted frames are reported to `client_link_record_frame()`.
  */
 static void receive_data(void){
-    char buf[8] = {0};
-    uint8_t received_number_pair[2] = {0};
+    uint8_t byte;
+    protocol_command_t command;
+
+    while (client_uart_rx_pop(&byte)){
+        uint32_t error_count = command_receiver.error_count;
+        if (protocol_receiver_push_byte(&command_receiver, byte, &command)){
+            client_link_record_frame(true);
+            apply_command(&command);
+        }else if (command_receiver.error_count != error_count && client_link_record_frame(false)){
+            // The link was negotiated again, the partial frame was sent at the old rate
+            protocol_receiver_reset(&command_receiver);
+        }
+    }
+}
 
-    get_uart_buffer(active_uart_client_connection.uart_instance, buf, sizeof(buf), CLIENT_TIMEOUT_MS);
-    get_number_pair(received_number_pair, buf);
+/**
+ * @brief Sleeps until the next interrupt if there is nothing left to do.
+ *
+ * Interrupts are masked while checking the RX buffer, so a byte arriving right
+ * after the check still wakes the core: WFI returns on any pending interrupt,
+ * and the handler runs once interrupts are restored.
+ *
+ * A pending dormant request skips the sleep, so the main loop enters dormant
+ * mode right away. Boards with Wi-Fi (CYW43) never go dormant, so they keep
+ * sleeping with WFI instead of spinning until the next wake-up command.
+ */
+static void wait_for_data(void){
+    #ifndef CYW43_WL_GPIO_LED_PIN
+        bool is_dormant_pending = go_dormant_flag;
+    #else
+        bool is_dormant_pending = false;
+    #endif
 
-    if (buf[0] != '\0'){
-        apply_command(received_number_pair);
+    uint32_t ints = save_and_disable_interrupts();
+    if (client_uart_rx_is_empty() && !is_dormant_pending){
+        __wfi();
     }
+    restore_interrupts(ints);
 }
 
 void client_listen_for_commands(void){
@@ -117,13 +197,9 @@ void client_listen_for_commands(void){
             if (go_dormant_flag){
                 enter_dormant_mode();
                 wake_up();
-                woke_up_from_dormant = true;
-            }else{
-                if (woke_up_from_dormant){
-                    woke_up_from_dormant = false;
-                    power_saving_config();
-                }
+                continue;
             }
         #endif
+        wait_for_data();
     }
 }
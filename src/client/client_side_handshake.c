@@ -7,8 +7,12 @@
  *
  * - Sends a request of the form "Requesting Connection-[tx,rx]"
  * - Waits for the server to echo "[tx,rx]"
- * - Responds with "[Connection Accepted]" if valid
+ * - Responds with "[Connection Accepted-<client ID>]" if valid, the ID being
+ *   the unique board ID, so the server keeps the client's state across pin pairs
+ * - Advertises its highest usable baud rate and follows the server's negotiation
  * - Stores working connection in global `active_uart_client_connection`
+ * - Lowers its baud rate ceiling and reconnects when the link degrades
+ * - After a watchdog reboot, retries its last pin pair before scanning all pairs
  */
 
 #include <stdio.h>
@@ -16,18 +20,154 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "hardware/clocks.h"
+#include "hardware/watchdog.h"
+#include "pico/unique_id.h"
+
 #include "functions.h"
 #include "config.h"
 #include "client.h"
 
 uart_connection_t active_uart_client_connection;
+uint32_t client_link_baudrate = DEFAULT_BAUDRATE;
+
+static uint32_t link_error_score = 0;
+static bool has_tried_last_connection = false;
+
+/**
+ * @brief Returns the client ID reported to the server: the flash unique board ID.
+ */
+static client_id_t client_get_id(void){
+    pico_unique_board_id_t board_id;
+    pico_get_unique_board_id(&board_id);
+
+    client_id_t client_id = 0;
+    for (uint8_t index = 0; index < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; index++){
+        client_id = (client_id << 8) | board_id.id[index];
+    }
+    return client_id;
+}
+
+/**
+ * @brief Returns the baud rate ceiling learned from previous link failures.
+ *
+ * @return The stored ceiling, or `MAX_NEGOTIATED_BAUDRATE` after a power-on reset.
+ */
+static uint32_t client_get_baudrate_ceiling(void){
+    uint32_t ceiling = watchdog_hw->scratch[CLIENT_BAUDRATE_CEILING_SCRATCH];
+    if (watchdog_hw->scratch[CLIENT_BAUDRATE_CEILING_SCRATCH + 1] != (ceiling ^ CLIENT_BAUDRATE_CEILING_MAGIC)){
+        return MAX_NEGOTIATED_BAUDRATE;
+    }
+    return ceiling;
+}
+
+/**
+ * @brief Stores a baud rate ceiling that survives watchdog reboots.
+ *
+ * @param ceiling Highest baud rate the client will advertise.
+ */
+static void client_set_baudrate_ceiling(uint32_t ceiling){
+    watchdog_hw->scratch[CLIENT_BAUDRATE_CEILING_SCRATCH] = ceiling;
+    watchdog_hw->scratch[CLIENT_BAUDRATE_CEILING_SCRATCH + 1] = ceiling ^ CLIENT_BAUDRATE_CEILING_MAGIC;
+}
+
+/**
+ * @brief Returns the highest negotiable baud rate this client can keep using.
+ *
+ * The rate must be reachable from the current clk_peri, which is already the
+ * one the client keeps using (`client_set_low_power_clocks()`), and must not
+ * exceed the learned ceiling.
+ */
+static uint32_t client_get_max_baudrate(void){
+    uint32_t peri_hz = clock_get_hz(clk_peri);
+    uint32_t ceiling = client_get_baudrate_ceiling();
+
+    for (uint8_t index = 0; index < NEGOTIABLE_BAUDRATES_LEN; index++){
+        uint32_t baudrate = negotiable_baudrates[index];
+        if (baudrate <= ceiling && baudrate <= MAX_NEGOTIATED_BAUDRATE && uart_baudrate_is_reachable(peri_hz, baudrate)){
+            return baudrate;
+        }
+    }
+
+    return DEFAULT_BAUDRATE;
+}
+
+/**
+ * @brief Checks a proposed baud rate: waits for the probe, echoes it, waits for confirmation.
+ *
+ * Must be called after switching the UART to `baudrate`.
+ *
+ * @param uart_instance UART interface used for communication.
+ * @param baudrate Proposed baud rate.
+ * @return true if the server confirmed the rate, false otherwise.
+ */
+static bool client_try_baudrate(uart_inst_t* uart_instance, uint32_t baudrate){
+    char buf[32] = {0};
+    uint32_t probe_baudrate = 0;
+
+    get_uart_buffer(uart_instance, buf, sizeof(buf), BAUDRATE_STEP_TIMEOUT_MS);
+    if (!get_message_number(buf, BAUDRATE_PROBE_MESSAGE, &probe_baudrate) || probe_baudrate != baudrate){
+        return false;
+    }
+
+    char echo[32];
+    snprintf(echo, sizeof(echo), "[%s-%lu]", BAUDRATE_PROBE_MESSAGE, (unsigned long)baudrate);
+    uart_puts(uart_instance, echo);
+    uart_tx_wait_blocking(uart_instance);
+
+    char confirmation[32] = {0};
+    get_uart_buffer(uart_instance, confirmation, sizeof(confirmation), BAUDRATE_STEP_TIMEOUT_MS);
+    return strstr(confirmation, BAUDRATE_CONFIRMED_MESSAGE) != NULL;
+}
+
+/**
+ * @brief Follows the server's baud rate negotiation.
+ *
+ * - Sends "[Max Baud-<rate>]" with the highest rate this client can use.
+ * - For every "[Set Baud-<rate>]" proposal, switches to the rate and runs
+ *   `client_try_baudrate()`; on failure switches back to `DEFAULT_BAUDRATE`
+ *   and waits for the next proposal.
+ * - Keeps `DEFAULT_BAUDRATE` when no further proposal arrives.
+ *
+ * @param uart_instance UART interface used for communication.
+ * @return The agreed baud rate, the UART is left running at this rate.
+ */
+static uint32_t client_negotiate_baudrate(uart_inst_t* uart_instance){
+    uint32_t max_baudrate = client_get_max_baudrate();
+
+    char capability[32];
+    snprintf(capability, sizeof(capability), "[%s-%lu]", BAUDRATE_CAPABILITY_MESSAGE, (unsigned long)max_baudrate);
+    uart_puts(uart_instance, capability);
+    uart_tx_wait_blocking(uart_instance);
+
+    while (true){
+        char buf[32] = {0};
+        uint32_t baudrate = 0;
+
+        get_uart_buffer(uart_instance, buf, sizeof(buf), BAUDRATE_PROPOSAL_TIMEOUT_MS);
+        if (!get_message_number(buf, BAUDRATE_PROPOSAL_MESSAGE, &baudrate)){
+            return DEFAULT_BAUDRATE;
+        }
+
+        if (baudrate > max_baudrate){
+            continue;
+        }
+
+        uart_set_baudrate(uart_instance, baudrate);
+        if (client_try_baudrate(uart_instance, baudrate)){
+            return baudrate;
+        }
+        uart_set_baudrate(uart_instance, DEFAULT_BAUDRATE);
+    }
+}
 
 /**
  * @brief Client-side handshake logic: validates server echo and sends ACK.
  *
  * - Waits for server to echo the pin pair.
  * - Compares it to the pin pair originally sent.
- * - Sends "[Connection Accepted]" if the echo is valid.
+ * - Sends "[Connection Accepted-<client ID>]" if the echo is valid.
+ * - Negotiates the link baud rate (see `client_negotiate_baudrate()`).
  *
  * @param uart_instance UART interface used for communication.
  * @param pin_pair The TX/RX pair originally tested.
@@ -45,10 +185,13 @@ static bool client_uart_read(uart_inst_t* uart_instance, uart_pin_pair_t pin_pai
     uint8_t expected_rx_number = received_number_pair[1];
 
     if (expected_tx_number == pin_pair.tx && expected_rx_number == pin_pair.rx){
-        char accepted[strlen(CONNECTION_ACCEPTED_MESSAGE) + 3];
-        snprintf(accepted, sizeof(accepted), "[%s]", CONNECTION_ACCEPTED_MESSAGE); 
+        client_id_t client_id = client_get_id();
+        char accepted[sizeof(CONNECTION_ACCEPTED_MESSAGE) + 19];
+        snprintf(accepted, sizeof(accepted), "[%s-%08lx%08lx]", CONNECTION_ACCEPTED_MESSAGE,
+            (unsigned long)(client_id >> 32), (unsigned long)client_id);
         uart_puts(uart_instance, accepted);
         uart_tx_wait_blocking(uart_instance);
+        client_link_baudrate = client_negotiate_baudrate(uart_instance);
         return true;
     }
 
@@ -79,6 +222,59 @@ static bool client_test_uart_pair(uart_pin_pair_t pin_pair, uart_inst_t * uart_i
     return client_uart_read(uart_instance, pin_pair, CLIENT_TIMEOUT_MS);
 }
 
+/**
+ * @brief Handshakes again on the current pin pair, without rebooting.
+ *
+ * The server hears the request on the wake-up line of the known connection,
+ * suspends its traffic and pushes the running state again once the new rate
+ * is agreed. Bytes still buffered at the old rate are dropped, then
+ * reception resumes through `power_saving_config()`.
+ *
+ * @return true if the server answered within `CLIENT_RECONNECT_ATTEMPTS` requests.
+ */
+static bool client_relink(void){
+    uart_pin_pair_t pin_pair = active_uart_client_connection.pin_pair;
+    uart_inst_t *uart_instance = active_uart_client_connection.uart_instance;
+
+    uart_set_irq_enables(uart_instance, false, false);
+    client_uart_rx_discard();
+
+    for (uint8_t attempt = 0; attempt < CLIENT_RECONNECT_ATTEMPTS; attempt++){
+        if (client_test_uart_pair(pin_pair, uart_instance)){
+            power_saving_config();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool client_link_record_frame(bool is_valid){
+    if (is_valid){
+        if (link_error_score){
+            link_error_score--;
+        }
+        return false;
+    }
+
+    link_error_score += CLIENT_LINK_ERROR_WEIGHT;
+    if (link_error_score < CLIENT_LINK_ERROR_THRESHOLD || client_link_baudrate <= DEFAULT_BAUDRATE){
+        return false;
+    }
+
+    for (uint8_t index = 0; index < NEGOTIABLE_BAUDRATES_LEN; index++){
+        if (negotiable_baudrates[index] < client_link_baudrate){
+            client_set_baudrate_ceiling(negotiable_baudrates[index]);
+            break;
+        }
+    }
+
+    if (!client_relink()){
+        watchdog_reboot(0, 0, 0);
+    }
+    link_error_score = 0;
+    return true;
+}
+
 /**
  * @brief Stores the working UART connection in the global state.
  *
@@ -128,14 +324,62 @@ static bool client_find_connection_for_uart1_instance(void){
     return false;
 }
 
+/**
+ * @brief Stores the working connection so it survives watchdog reboots.
+ */
+static void client_set_last_connection(void){
+    uint32_t packed = active_uart_client_connection.pin_pair.tx |
+        (active_uart_client_connection.pin_pair.rx << 8) |
+        (uart_get_index(active_uart_client_connection.uart_instance) << 16);
+
+    watchdog_hw->scratch[CLIENT_LAST_CONNECTION_SCRATCH] = packed;
+    watchdog_hw->scratch[CLIENT_LAST_CONNECTION_SCRATCH + 1] = packed ^ CLIENT_LAST_CONNECTION_MAGIC;
+}
+
+/**
+ * @brief Retries the connection used before the last watchdog reboot.
+ *
+ * The server is usually rebooting at the same time (`TRIGGER_RESET_FLAG_NUMBER`),
+ * and listens on its known pin pairs first, so the request is repeated
+ * `CLIENT_RECONNECT_ATTEMPTS` times on that pair only. Nothing is tried after
+ * a power-on reset, where the scratch registers do not hold a valid pair.
+ *
+ * @return true if the handshake succeeded on the last pin pair, false otherwise.
+ */
+static bool client_find_last_connection(void){
+    uint32_t packed = watchdog_hw->scratch[CLIENT_LAST_CONNECTION_SCRATCH];
+    if (watchdog_hw->scratch[CLIENT_LAST_CONNECTION_SCRATCH + 1] != (packed ^ CLIENT_LAST_CONNECTION_MAGIC)){
+        return false;
+    }
+
+    uart_pin_pair_t pin_pair = {.tx = packed & 0xFF, .rx = (packed >> 8) & 0xFF};
+    uart_inst_t *uart_instance = uart_get_instance((packed >> 16) & 0xFF);
+
+    for (uint8_t attempt = 0; attempt < CLIENT_RECONNECT_ATTEMPTS; attempt++){
+        if (client_test_uart_pair(pin_pair, uart_instance)){
+            client_add_connection(pin_pair, uart_instance);
+            return true;
+        }
+    }
+    reset_gpio_pins(pin_pair);
+    return false;
+}
+
 bool client_detect_uart_connection(void){
     bool connection_found = false;
-    connection_found = client_find_connection_for_uart0_instance();
+    if (!has_tried_last_connection){
+        has_tried_last_connection = true;
+        connection_found = client_find_last_connection();
+    }
+    if (!connection_found){
+        connection_found = client_find_connection_for_uart0_instance();
+    }
     if (!connection_found){
         connection_found = client_find_connection_for_uart1_instance();
     }
     if (connection_found){
-        blink_onboard_led_blocking();
+        client_set_last_connection();
+        blink_onboard_led();
     }
 
     return connection_found;
@@ -24,6 +24,10 @@
  */
 int main(void){
     init_onboard_led_and_usb();
+    #ifndef CYW43_WL_GPIO_LED_PIN
+        // The link baud rate is probed at the clk_peri the client keeps running at
+        client_set_low_power_clocks();
+    #endif
 
     while(!client_detect_uart_connection()) tight_loop_contents();
 
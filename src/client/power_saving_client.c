@@ -38,7 +38,6 @@
 #endif
 
 bool go_dormant_flag = false;
-bool woke_up_from_dormant = false;
 
 typedef enum {
     DORMANT_SOURCE_NONE,
@@ -49,17 +48,7 @@ typedef enum {
 
 static dormant_source_t _dormant_source;
 
-void client_turn_off_unused_power_consumers(void){
-    clocks_hw->clk[clk_usb].ctrl &= ~CLOCKS_CLK_USB_CTRL_ENABLE_BITS;
-    clocks_hw->clk[clk_adc].ctrl &= ~CLOCKS_CLK_ADC_CTRL_ENABLE_BITS;
-    #if PICO_RP2040
-        clocks_hw->clk[clk_rtc].ctrl &= ~CLOCKS_CLK_RTC_CTRL_ENABLE_BITS;
-    #endif
-    clocks_hw->clk[clk_gpout0].ctrl &= ~CLOCKS_CLK_GPOUT0_CTRL_ENABLE_BITS;
-    clocks_hw->clk[clk_gpout1].ctrl &= ~CLOCKS_CLK_GPOUT1_CTRL_ENABLE_BITS;
-    clocks_hw->clk[clk_gpout2].ctrl &= ~CLOCKS_CLK_GPOUT2_CTRL_ENABLE_BITS;
-    clocks_hw->clk[clk_gpout3].ctrl &= ~CLOCKS_CLK_GPOUT3_CTRL_ENABLE_BITS;
-
+void client_set_low_power_clocks(void){
     clock_configure(clk_ref,
         CLOCKS_CLK_REF_CTRL_SRC_VALUE_XOSC_CLKSRC,
         0, 12 * MHZ, 12 * MHZ);
@@ -73,6 +62,19 @@ void client_turn_off_unused_power_consumers(void){
         12 * MHZ, 12 * MHZ); 
 
     pll_deinit(pll_sys);
+}
+
+void client_turn_off_unused_power_consumers(void){
+    clocks_hw->clk[clk_usb].ctrl &= ~CLOCKS_CLK_USB_CTRL_ENABLE_BITS;
+    clocks_hw->clk[clk_adc].ctrl &= ~CLOCKS_CLK_ADC_CTRL_ENABLE_BITS;
+    #if PICO_RP2040
+        clocks_hw->clk[clk_rtc].ctrl &= ~CLOCKS_CLK_RTC_CTRL_ENABLE_BITS;
+    #endif
+    clocks_hw->clk[clk_gpout0].ctrl &= ~CLOCKS_CLK_GPOUT0_CTRL_ENABLE_BITS;
+    clocks_hw->clk[clk_gpout1].ctrl &= ~CLOCKS_CLK_GPOUT1_CTRL_ENABLE_BITS;
+    clocks_hw->clk[clk_gpout2].ctrl &= ~CLOCKS_CLK_GPOUT2_CTRL_ENABLE_BITS;
+    clocks_hw->clk[clk_gpout3].ctrl &= ~CLOCKS_CLK_GPOUT3_CTRL_ENABLE_BITS;
+
     pll_deinit(pll_usb);
 
     clocks_hw->sleep_en0 =
@@ -131,7 +133,8 @@ void power_saving_config(void){
 
     uart_init_with_single_pin(active_uart_client_connection.uart_instance,
         active_uart_client_connection.pin_pair.rx,
-        DEFAULT_BAUDRATE);
+        client_link_baudrate);
+    client_uart_rx_irq_enable();
 
     set_pin_as_input_for_dormant_wakeup();
 }
@@ -414,13 +417,15 @@ void wake_up(void){
     sleep_power_up();
 
     #ifndef CYW43_WL_GPIO_LED_PIN
+        client_set_low_power_clocks();
         client_turn_off_unused_power_consumers();
     #endif
 
     uart_init_with_single_pin(active_uart_client_connection.uart_instance,
             active_uart_client_connection.pin_pair.rx,
-            DEFAULT_BAUDRATE
+            client_link_baudrate
     );
+    client_uart_rx_irq_enable();
 
     set_pin_as_input_for_dormant_wakeup();
 }
@@ -0,0 +1,85 @@
+/**
+ * @file uart_rx_buffer.c
+ * @brief Interrupt-driven UART reception into a lock-free ring buffer.
+ *
+ * The UART RX interrupt drains the hardware FIFO into a single-producer,
+ * single-consumer ring buffer. The main loop pops bytes from it and feeds
+ * them to the frame extractor, so bytes arriving while a command is being
+ * applied (or while the core sleeps in WFI) are never lost.
+ *
+ * The interrupt handler is the only writer of `rx_head`, the main loop is the
+ * only writer of `rx_tail`, so no lock is required.
+ *
+ * @see client_listen_for_commands()
+ */
+
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "client.h"
+
+static uint8_t rx_buffer[CLIENT_RX_BUFFER_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static volatile uint32_t rx_overflow_count = 0;
+static bool rx_irq_handler_installed = false;
+
+static_assert((CLIENT_RX_BUFFER_SIZE & (CLIENT_RX_BUFFER_SIZE - 1)) == 0, "CLIENT_RX_BUFFER_SIZE must be a power of two");
+
+/**
+ * @brief UART RX interrupt handler.
+ *
+ * Moves every byte currently in the UART RX FIFO into the ring buffer.
+ * Bytes that do not fit are dropped and counted in `rx_overflow_count`.
+ */
+static void on_uart_rx(void){
+    uart_inst_t *uart = active_uart_client_connection.uart_instance;
+
+    while (uart_is_readable(uart)){
+        uint8_t byte = (uint8_t)uart_getc(uart);
+        uint32_t next_head = (rx_head + 1) & (CLIENT_RX_BUFFER_SIZE - 1);
+
+        if (next_head == rx_tail){
+            rx_overflow_count++;
+            continue;
+        }
+
+        rx_buffer[rx_head] = byte;
+        __compiler_memory_barrier();
+        rx_head = next_head;
+    }
+}
+
+void client_uart_rx_irq_enable(void){
+    uart_inst_t *uart = active_uart_client_connection.uart_instance;
+    uint irq_number = uart_get_index(uart) ? UART1_IRQ : UART0_IRQ;
+
+    if (!rx_irq_handler_installed){
+        irq_set_exclusive_handler(irq_number, on_uart_rx);
+        rx_irq_handler_installed = true;
+    }
+
+    irq_set_enabled(irq_number, true);
+    uart_set_irq_enables(uart, true, false);
+}
+
+bool client_uart_rx_pop(uint8_t *byte){
+    uint32_t tail = rx_tail;
+    if (tail == rx_head){
+        return false;
+    }
+
+    *byte = rx_buffer[tail];
+    __compiler_memory_barrier();
+    rx_tail = (tail + 1) & (CLIENT_RX_BUFFER_SIZE - 1);
+    return true;
+}
+
+bool client_uart_rx_is_empty(void){
+    return rx_tail == rx_head;
+}
+
+void client_uart_rx_discard(void){
+    rx_tail = rx_head;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file board.c
+ * @brief Device slot / GPIO translation tables generated from board.h.
+ *
+ * Both tables are constant initializers evaluated by the compiler, so the
+ * translation costs a single load on the server and the client alike.
+ */
+
+#include <assert.h>
+
+#include "board.h"
+
+/// Slot of `gpio`: number of device GPIOs below it.
+#define BOARD_GPIO_DEVICE_(gpio) \
+    (((BOARD_DEVICE_GPIO_MASK >> (gpio)) & 1u) ? (uint8_t)__builtin_popcount(BOARD_DEVICE_GPIO_MASK & ((1u << (gpio)) - 1)) : BOARD_NO_DEVICE)
+
+#define BOARD_DEVICE_GPIO_ENTRY_(gpio) (gpio),
+#define BOARD_GPIO_IN_MASK_(gpio) && (gpio) < BOARD_MASK_GPIOS
+
+static_assert(1 BOARD_DEVICE_GPIOS(BOARD_GPIO_IN_MASK_), "BOARD_DEVICE_GPIOS lists a GPIO above 31, states travel as 32-bit masks");
+static_assert(__builtin_popcount(BOARD_DEVICE_GPIO_MASK) == BOARD_DEVICE_COUNT, "BOARD_DEVICE_GPIOS lists a GPIO twice");
+static_assert(BOARD_DEVICE_COUNT < BOARD_NO_DEVICE, "Device slots must fit below BOARD_NO_DEVICE");
+
+const uint8_t board_device_gpio[BOARD_DEVICE_COUNT] = {
+    BOARD_DEVICE_GPIOS(BOARD_DEVICE_GPIO_ENTRY_)
+};
+
+const uint8_t board_gpio_device[BOARD_MASK_GPIOS] = {
+    BOARD_GPIO_DEVICE_(0),  BOARD_GPIO_DEVICE_(1),  BOARD_GPIO_DEVICE_(2),  BOARD_GPIO_DEVICE_(3),
+    BOARD_GPIO_DEVICE_(4),  BOARD_GPIO_DEVICE_(5),  BOARD_GPIO_DEVICE_(6),  BOARD_GPIO_DEVICE_(7),
+    BOARD_GPIO_DEVICE_(8),  BOARD_GPIO_DEVICE_(9),  BOARD_GPIO_DEVICE_(10), BOARD_GPIO_DEVICE_(11),
+    BOARD_GPIO_DEVICE_(12), BOARD_GPIO_DEVICE_(13), BOARD_GPIO_DEVICE_(14), BOARD_GPIO_DEVICE_(15),
+    BOARD_GPIO_DEVICE_(16), BOARD_GPIO_DEVICE_(17), BOARD_GPIO_DEVICE_(18), BOARD_GPIO_DEVICE_(19),
+    BOARD_GPIO_DEVICE_(20), BOARD_GPIO_DEVICE_(21), BOARD_GPIO_DEVICE_(22), BOARD_GPIO_DEVICE_(23),
+    BOARD_GPIO_DEVICE_(24), BOARD_GPIO_DEVICE_(25), BOARD_GPIO_DEVICE_(26), BOARD_GPIO_DEVICE_(27),
+    BOARD_GPIO_DEVICE_(28), BOARD_GPIO_DEVICE_(29), BOARD_GPIO_DEVICE_(30), BOARD_GPIO_DEVICE_(31),
+};
@@ -0,0 +1,89 @@
+/**
+ * @file crc32.c
+ * @brief Software CRC32 engines: slicing-by-8 tables and the bitwise reference loop.
+ *
+ * `crc32_tables[0]` is the usual byte table. `crc32_tables[k][n]` is the CRC
+ * of byte n followed by k zero bytes, so 8 input bytes are folded with 8
+ * independent lookups instead of 64 shift/XOR steps. The tables take 8 KB of
+ * RAM and are filled by `crc32_init()`; RAM keeps the lookups off the XIP
+ * cache on the Pico.
+ *
+ * Input words are assembled byte by byte, so the engines work on unaligned
+ * buffers and on hosts of any endianness.
+ */
+
+#include <stdint.h>
+
+#include "crc32.h"
+
+/// Reflected IEEE 802.3 polynomial.
+#define CRC32_POLYNOMIAL 0xEDB88320u
+/// Bytes folded per slicing iteration.
+#define CRC32_SLICES 8
+
+static uint32_t crc32_tables[CRC32_SLICES][256];
+
+void crc32_init(void){
+    for (uint32_t byte = 0; byte < 256; byte++){
+        uint32_t crc = byte;
+        for (uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32_POLYNOMIAL : crc >> 1;
+        }
+        crc32_tables[0][byte] = crc;
+    }
+
+    for (uint32_t byte = 0; byte < 256; byte++){
+        for (uint8_t slice = 1; slice < CRC32_SLICES; slice++){
+            uint32_t previous = crc32_tables[slice - 1][byte];
+            crc32_tables[slice][byte] = (previous >> 8) ^ crc32_tables[0][previous & 0xFF];
+        }
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t length){
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (length >= CRC32_SLICES){
+        uint32_t low = crc ^ ((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                              ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+        uint32_t high = (uint32_t)bytes[4] | ((uint32_t)bytes[5] << 8) |
+                        ((uint32_t)bytes[6] << 16) | ((uint32_t)bytes[7] << 24);
+
+        crc = crc32_tables[7][low & 0xFF] ^ crc32_tables[6][(low >> 8) & 0xFF] ^
+              crc32_tables[5][(low >> 16) & 0xFF] ^ crc32_tables[4][low >> 24] ^
+              crc32_tables[3][high & 0xFF] ^ crc32_tables[2][(high >> 8) & 0xFF] ^
+              crc32_tables[1][(high >> 16) & 0xFF] ^ crc32_tables[0][high >> 24];
+
+        bytes += CRC32_SLICES;
+        length -= CRC32_SLICES;
+    }
+
+    while (length--){
+        crc = (crc >> 8) ^ crc32_tables[0][(crc ^ *bytes++) & 0xFF];
+    }
+    return crc;
+}
+
+uint32_t crc32_compute(const void *data, uint32_t length){
+    return ~crc32_update(CRC32_INITIAL_VALUE, data, length);
+}
+
+uint32_t crc32_update_bitwise(uint32_t crc, const void *data, uint32_t length){
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    for (uint32_t i = 0; i < length; ++i){
+        crc ^= bytes[i];
+        for (int j = 0; j < 8; ++j){
+            if (crc & 1)
+                crc = (crc >> 1) ^ CRC32_POLYNOMIAL;
+            else
+                crc >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+uint32_t crc32_compute_bitwise(const void *data, uint32_t length){
+    return ~crc32_update_bitwise(CRC32_INITIAL_VALUE, data, length);
+}
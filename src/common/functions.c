@@ -36,9 +36,13 @@ void get_number_pair(uint8_t *received_number_pair, char *buf){
     char *p = buf;
     uint8_t number_pair_array_index = 0;
 
-    while (*p) {
-        if (*p - '0' >= 0 && *p - '0' <= 9) {
-            received_number_pair[number_pair_array_index] = received_number_pair[number_pair_array_index] * 10 + (*p - '0');
+    while (*p && number_pair_array_index < 2) {
+        if (*p >= '0' && *p <= '9') {
+            uint8_t digit = *p - '0';
+            if (received_number_pair[number_pair_array_index] > (UINT8_MAX - digit) / 10) {
+                return;
+            }
+            received_number_pair[number_pair_array_index] = received_number_pair[number_pair_array_index] * 10 + digit;
         } else if (*p == ',') {
             number_pair_array_index++;
         }
@@ -46,6 +50,92 @@ void get_number_pair(uint8_t *received_number_pair, char *buf){
     }
 }
 
+bool get_message_number(const char *buf, const char *message, uint32_t *number){
+    const char *p = strstr(buf, message);
+    if (!p){
+        return false;
+    }
+
+    p += strlen(message);
+    if (*p++ != '-'){
+        return false;
+    }
+
+    uint32_t value = 0;
+    bool has_digit = false;
+    while (*p >= '0' && *p <= '9'){
+        uint32_t digit = *p - '0';
+        if (value > (UINT32_MAX - digit) / 10){
+            return false;
+        }
+        value = value * 10 + digit;
+        has_digit = true;
+        p++;
+    }
+
+    if (!has_digit || *p != ']'){
+        return false;
+    }
+
+    *number = value;
+    return true;
+}
+
+bool get_message_hex_number(const char *buf, const char *message, uint64_t *number){
+    const char *p = strstr(buf, message);
+    if (!p){
+        return false;
+    }
+
+    p += strlen(message);
+    if (*p++ != '-'){
+        return false;
+    }
+
+    uint64_t value = 0;
+    uint8_t digits = 0;
+    while (true){
+        uint8_t digit;
+        if (*p >= '0' && *p <= '9'){
+            digit = *p - '0';
+        }else if (*p >= 'a' && *p <= 'f'){
+            digit = *p - 'a' + 10;
+        }else if (*p >= 'A' && *p <= 'F'){
+            digit = *p - 'A' + 10;
+        }else{
+            break;
+        }
+
+        if (++digits > 16){
+            return false;
+        }
+        value = (value << 4) | digit;
+        p++;
+    }
+
+    if (!digits || *p != ']'){
+        return false;
+    }
+
+    *number = value;
+    return true;
+}
+
+bool uart_baudrate_is_reachable(uint32_t peri_hz, uint32_t baudrate){
+    uint32_t baud_rate_div = (8 * peri_hz / baudrate) + 1;
+    uint32_t baud_ibrd = baud_rate_div >> 7;
+
+    if (baud_ibrd == 0 || baud_ibrd >= 65535){
+        return false;
+    }
+
+    uint32_t baud_fbrd = (baud_rate_div & 0x7f) >> 1;
+    uint32_t actual_baudrate = (4 * peri_hz) / (64 * baud_ibrd + baud_fbrd);
+    uint32_t error = (actual_baudrate > baudrate) ? actual_baudrate - baudrate : baudrate - actual_baudrate;
+
+    return error * 100 <= baudrate * UART_BAUDRATE_MAX_ERROR_PERCENT;
+}
+
 void get_uart_buffer(uart_inst_t* uart, char* buf, uint8_t buffer_size, uint32_t timeout_ms) {
     absolute_time_t start_time = get_absolute_time();
     uint8_t idx = 0;
@@ -94,15 +184,27 @@ void pico_set_onboard_led(bool led_on) {
     #endif
 }
 
-void blink_onboard_led_blocking(void){
-    int blink_iterations = 5;
-    while (blink_iterations--){
-        pico_set_onboard_led(false);
-        sleep_ms(LED_DELAY_MS);
-        pico_set_onboard_led(true);
-        sleep_ms(LED_DELAY_MS);
+/// LED switches left in the running `blink_onboard_led()` sequence, 0 when idle.
+static volatile uint8_t blink_switches_left;
+
+static int64_t blink_led_alarm(alarm_id_t id, void *user_data) {
+    blink_switches_left--;
+    // Odd counts are the ON phases, the sequence ends OFF
+    pico_set_onboard_led(blink_switches_left & 1);
+    return blink_switches_left ? LED_DELAY_MS * MS_TO_US_MULTIPLIER : 0;
+}
+
+void blink_onboard_led(void){
+    if (blink_switches_left){
+        return;
     }
+
+    blink_switches_left = 2 * LED_BLINK_COUNT;
     pico_set_onboard_led(false);
+    if (add_alarm_in_ms(LED_DELAY_MS, blink_led_alarm, NULL, true) < 0){
+        // No alarm slot left: skip the blink, it is only a visual cue
+        blink_switches_left = 0;
+    }
 }
 
 static int64_t turn_off_led_alarm(alarm_id_t id, void *user_data) {
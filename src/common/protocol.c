@@ -0,0 +1,266 @@
+/**
+ * @file protocol.c
+ * @brief Encoding and incremental decoding of server-to-client commands.
+ *
+ * Implements both wire formats described in protocol.h:
+ * - Binary: COBS-stuffed frames with length prefix and CRC-8, delimited by 0x00
+ * - ASCII: "[code,value]" messages delimited by brackets
+ *
+ * The receiver is a byte-at-a-time state machine, so it can be fed from a
+ * polling loop or from an interrupt-driven buffer alike.
+ */
+
+#include <stdio.h>
+
+#include "protocol.h"
+
+#define PROTOCOL_HEADER_LEN 2   ///< code + length
+#define PROTOCOL_CRC_LEN 1
+
+uint8_t protocol_crc8(const uint8_t *data, size_t length){
+    uint8_t crc = 0x00;
+
+    for (size_t i = 0; i < length; ++i){
+        crc ^= data[i];
+        for (int j = 0; j < 8; ++j){
+            if (crc & 0x80)
+                crc = (uint8_t)((crc << 1) ^ 0x07);
+            else
+                crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+#if PROTOCOL_BINARY_FRAMING
+
+/**
+ * @brief Returns the number of payload bytes needed to carry a command's value.
+ *
+ * @param code Command code (GPIO number or flag).
+ * @return 0 for flags, 4 for full state frames, 1 for device states.
+ */
+static uint8_t protocol_payload_length(uint8_t code){
+    switch (code){
+        case TRIGGER_RESET_FLAG_NUMBER:
+        case BLINK_ONBOARD_LED_FLAG_NUMBER:
+        case WAKE_UP_FLAG_NUMBER:
+        case DORMANT_FLAG_NUMBER:
+            return 0;
+        case FULL_STATE_FLAG_NUMBER:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief COBS-encodes a block so that it contains no zero bytes.
+ *
+ * @param data Input block.
+ * @param length Input length.
+ * @param out Output buffer, at least `length + 1` bytes.
+ * @return Number of bytes written to `out`.
+ */
+static size_t cobs_encode(const uint8_t *data, size_t length, uint8_t *out){
+    size_t code_index = 0;
+    size_t out_index = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < length; ++i){
+        if (data[i] == 0){
+            out[code_index] = code;
+            code_index = out_index++;
+            code = 1;
+        }else{
+            out[out_index++] = data[i];
+            code++;
+        }
+    }
+    out[code_index] = code;
+
+    return out_index;
+}
+
+/**
+ * @brief Decodes a COBS block in place.
+ *
+ * @param data Encoded block (without delimiter), overwritten with decoded bytes.
+ * @param length Encoded length.
+ * @return Decoded length, or 0 if the block is malformed.
+ */
+static size_t cobs_decode_in_place(uint8_t *data, size_t length){
+    size_t in_index = 0;
+    size_t out_index = 0;
+
+    while (in_index < length){
+        uint8_t code = data[in_index++];
+        if (code == 0 || in_index + code - 1 > length){
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; ++i){
+            data[out_index++] = data[in_index++];
+        }
+        if (code < 0xFF && in_index < length){
+            data[out_index++] = 0;
+        }
+    }
+
+    return out_index;
+}
+
+size_t protocol_encode_command(const protocol_command_t *command, uint8_t *frame){
+    uint8_t raw[PROTOCOL_HEADER_LEN + PROTOCOL_MAX_PAYLOAD_LEN + PROTOCOL_CRC_LEN];
+    uint8_t payload_length = protocol_payload_length(command->code);
+
+    raw[0] = command->code;
+    raw[1] = payload_length;
+    for (uint8_t i = 0; i < payload_length; ++i){
+        raw[PROTOCOL_HEADER_LEN + i] = (uint8_t)(command->value >> (8 * i));
+    }
+    raw[PROTOCOL_HEADER_LEN + payload_length] = protocol_crc8(raw, PROTOCOL_HEADER_LEN + payload_length);
+
+    size_t frame_length = cobs_encode(raw, PROTOCOL_HEADER_LEN + payload_length + PROTOCOL_CRC_LEN, frame);
+    frame[frame_length++] = PROTOCOL_FRAME_DELIMITER;
+
+    return frame_length;
+}
+
+/**
+ * @brief Validates a complete binary frame and extracts its command.
+ *
+ * @param receiver Receiver holding the encoded frame (without delimiter).
+ * @param command Output command.
+ * @return true if the frame is well formed and its CRC matches.
+ */
+static bool protocol_decode_frame(protocol_receiver_t *receiver, protocol_command_t *command){
+    size_t length = cobs_decode_in_place(receiver->buffer, receiver->length);
+    if (length < PROTOCOL_HEADER_LEN + PROTOCOL_CRC_LEN){
+        return false;
+    }
+
+    uint8_t payload_length = receiver->buffer[1];
+    if (payload_length > PROTOCOL_MAX_PAYLOAD_LEN || length != (size_t)(PROTOCOL_HEADER_LEN + payload_length + PROTOCOL_CRC_LEN)){
+        return false;
+    }
+
+    if (protocol_crc8(receiver->buffer, PROTOCOL_HEADER_LEN + payload_length) != receiver->buffer[PROTOCOL_HEADER_LEN + payload_length]){
+        return false;
+    }
+
+    command->code = receiver->buffer[0];
+    command->value = 0;
+    for (uint8_t i = 0; i < payload_length; ++i){
+        command->value |= (uint32_t)receiver->buffer[PROTOCOL_HEADER_LEN + i] << (8 * i);
+    }
+
+    return true;
+}
+
+bool protocol_receiver_push_byte(protocol_receiver_t *receiver, uint8_t byte, protocol_command_t *command){
+    if (byte != PROTOCOL_FRAME_DELIMITER){
+        if (receiver->length < sizeof(receiver->buffer)){
+            receiver->buffer[receiver->length++] = byte;
+        }else{
+            receiver->is_discarding = true;
+        }
+        return false;
+    }
+
+    bool is_valid = false;
+    if (receiver->length){
+        is_valid = !receiver->is_discarding && protocol_decode_frame(receiver, command);
+        if (!is_valid){
+            receiver->error_count++;
+        }
+    }
+
+    protocol_receiver_reset(receiver);
+    return is_valid;
+}
+
+#else
+
+size_t protocol_encode_command(const protocol_command_t *command, uint8_t *frame){
+    int frame_length = snprintf((char *)frame, PROTOCOL_MAX_FRAME_LEN, "[%u,%lu]", command->code, (unsigned long)command->value);
+    return (frame_length > 0) ? (size_t)frame_length : 0;
+}
+
+/**
+ * @brief Parses a complete "code,value" body (brackets already stripped).
+ *
+ * Rejects empty fields, missing or extra fields, non-digit characters,
+ * codes above 255 and values above 32 bits.
+ *
+ * @param receiver Receiver holding the message body.
+ * @param command Output command.
+ * @return true if the body is well formed.
+ */
+static bool protocol_decode_frame(protocol_receiver_t *receiver, protocol_command_t *command){
+    uint32_t fields[2] = {0};
+    uint8_t field_index = 0;
+    bool has_digit = false;
+
+    for (uint8_t i = 0; i < receiver->length; ++i){
+        uint8_t c = receiver->buffer[i];
+        if (c >= '0' && c <= '9'){
+            uint32_t digit = c - '0';
+            if (fields[field_index] > (UINT32_MAX - digit) / 10){
+                return false;
+            }
+            fields[field_index] = fields[field_index] * 10 + digit;
+            has_digit = true;
+        }else if (c == ',' && field_index == 0 && has_digit){
+            field_index++;
+            has_digit = false;
+        }else{
+            return false;
+        }
+    }
+
+    if (field_index != 1 || !has_digit || fields[0] > UINT8_MAX){
+        return false;
+    }
+
+    command->code = (uint8_t)fields[0];
+    command->value = fields[1];
+    return true;
+}
+
+bool protocol_receiver_push_byte(protocol_receiver_t *receiver, uint8_t byte, protocol_command_t *command){
+    if (byte == '['){
+        protocol_receiver_reset(receiver);
+        receiver->is_in_frame = true;
+        return false;
+    }
+
+    if (!receiver->is_in_frame){
+        return false;
+    }
+
+    if (byte != ']'){
+        if (receiver->length < sizeof(receiver->buffer)){
+            receiver->buffer[receiver->length++] = byte;
+        }else{
+            receiver->is_discarding = true;
+        }
+        return false;
+    }
+
+    bool is_valid = !receiver->is_discarding && protocol_decode_frame(receiver, command);
+    if (!is_valid){
+        receiver->error_count++;
+    }
+
+    protocol_receiver_reset(receiver);
+    return is_valid;
+}
+
+#endif
+
+void protocol_receiver_reset(protocol_receiver_t *receiver){
+    receiver->length = 0;
+    receiver->is_discarding = false;
+    receiver->is_in_frame = false;
+}
@@ -13,3 +13,25 @@ const uart_pin_pair_t pin_pairs_uart1[PIN_PAIRS_UART1_LEN] = {
     {4, 5},
     {8, 9}
 };
+
+// TX/RX pin pairs used for PIO channel scanning (server only)
+const uart_pin_pair_t pin_pairs_pio[PIN_PAIRS_PIO_LEN] = {
+    {2, 3},
+    {6, 7},
+    {10, 11},
+    {14, 15},
+    {18, 19},
+    {20, 21},
+    {22, 26},
+    {27, 28}
+};
+
+// Baud rates tried during the handshake negotiation, fastest first
+const uint32_t negotiable_baudrates[NEGOTIABLE_BAUDRATES_LEN] = {
+    3000000,
+    1500000,
+    921600,
+    460800,
+    230400,
+    DEFAULT_BAUDRATE
+};
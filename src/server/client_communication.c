@@ -3,13 +3,14 @@
  * @brief Handles UART communication between the server and multiple Pico clients.
  *
  * This module provides helper functions for:
- * - Sending messages over UART safely using spinlocks
+ * - Queuing messages for asynchronous, DMA-driven transmission (see uart_tx_queue.c)
  * - Waking up clients from dormant mode
  * - Sending predefined flag messages to specific or all clients
- * - Broadcasting client state information
+ * - Synchronizing client state, sending only the devices that changed
  * - Coordinating dormant transitions
  *
- * All transmissions ensure UART reinitialization and GPIO reset for consistent operation.
+ * UART instances stay configured between transmissions; only the client's TX pin
+ * is switched in when the target client changes (see uart_channel.c).
  *
  * @note Functions in this file depend on `active_uart_server_connections` and shared UART locks.
  *
@@ -22,49 +23,26 @@
 #include "server.h"
 #include "functions.h"
 
-void send_uart_message_safe(uart_inst_t* uart, uart_pin_pair_t pins, const char* msg) {
-    uint32_t irq = spin_lock_blocking(uart_lock);
-    uart_init_with_pins(uart, pins, DEFAULT_BAUDRATE);
-    uart_puts(uart, msg);
-    uart_tx_wait_blocking(uart);
-    reset_gpio_pins(pins);
-    spin_unlock(uart_lock, irq);
+bool queue_uart_message(uint8_t client_index, uint8_t code, uint32_t value){
+    return uart_tx_queue_send(client_index, code, value, false, NULL, 0);
 }
 
 /**
- * @brief Wakes up a client device by toggling RX pin and sending a wake-up message.
+ * @brief Queues the wake-up sequence for a dormant client.
  *
- * This function:
- * - Drives the client's RX pin high for 5 ms, then low for 5 ms (to exit dormant mode)
- * - Sends a predefined wake-up flag message over UART to ensure proper synchronization
+ * The transmit engine drives the client's RX pin high for `WAKE_UP_PULSE_MS`,
+ * then low for `WAKE_UP_PULSE_MS` (to exit dormant mode), and then sends a
+ * predefined wake-up flag message to ensure proper synchronization.
  *
- * @param pin_pair The TX/RX pin pair used for communication with the client.
- * @param uart     UART instance used to send the message.
+ * @param client_index Index of the client in the active server connections.
+ * @return true if the sequence was queued.
  */
-static void wake_up_client(uart_pin_pair_t pin_pair, uart_inst_t* uart){
-    gpio_put(pin_pair.rx, true);
-    sleep_ms(5);
-    gpio_put(pin_pair.rx, false);
-    sleep_ms(5);
-
-    char msg[8];
-    snprintf(msg, sizeof(msg), "[%d,%d]", WAKE_UP_FLAG_NUMBER, WAKE_UP_FLAG_NUMBER);
-    send_uart_message_safe(uart, pin_pair, msg);
-}
-
-void send_wakeup_if_dormant(uint32_t flash_client_index, server_persistent_state_t *const state, uart_pin_pair_t pin_pair, uart_inst_t *const uart){
-    uint8_t active_uart_connection_index = get_active_client_connection_index_from_flash_client_index(flash_client_index, *state);
-    if(active_uart_server_connections[active_uart_connection_index].is_dormant){
-        wake_up_client(pin_pair, uart);
-    }
+static bool wake_up_client(uint8_t client_index){
+    return uart_tx_queue_send(client_index, WAKE_UP_FLAG_NUMBER, WAKE_UP_FLAG_NUMBER, true, NULL, 0);
 }
 
 void send_dormant_flag_to_client(uint8_t client_index){
-    char msg[8];
-    snprintf(msg, sizeof(msg), "[%d,%d]", DORMANT_FLAG_NUMBER, DORMANT_FLAG_NUMBER);
-    send_uart_message_safe(active_uart_server_connections[client_index].uart_instance,
-        active_uart_server_connections[client_index].pin_pair,
-        msg);
+    queue_uart_message(client_index, DORMANT_FLAG_NUMBER, DORMANT_FLAG_NUMBER);
 }
 
 /**
@@ -84,18 +62,14 @@ static void send_dormant_if_is_dormant_is_true(uint8_t client_index){
 /**
  * @brief Sends a predefined flag message to a specific client via UART.
  *
- * Constructs a message of the form "[X,X]" using the given flag value
+ * Constructs a flag command using the given flag value
  * and sends it to the specified client over its associated UART instance.
  *
  * @param FLAG_MESSAGE The numeric flag to send (e.g., blink, reset, etc.).
  * @param client_index Index of the client in the active connection list.
  */
 static void send_flag_message_to_client(const uint8_t FLAG_MESSAGE, uint8_t client_index){
-    char msg[8];
-    snprintf(msg, sizeof(msg), "[%d,%d]", FLAG_MESSAGE, FLAG_MESSAGE);
-    send_uart_message_safe(active_uart_server_connections[client_index].uart_instance,
-        active_uart_server_connections[client_index].pin_pair,
-        msg);
+    queue_uart_message(client_index, FLAG_MESSAGE, FLAG_MESSAGE);
 
     send_dormant_if_is_dormant_is_true(client_index);
 }
@@ -104,16 +78,14 @@ static void send_flag_message_to_client(const uint8_t FLAG_MESSAGE, uint8_t clie
  * @brief Sends a predefined flag message to all connected clients via UART.
  *
  * Iterates through all active UART client connections. Each client is first
- * woken up, then receives a flag message of the form "[X,X]", where X is the
- * specified flag value.
+ * woken up, then receives a flag message carrying the specified flag value.
  *
  * @param FLAG_MESSAGE The numeric flag to send to each client.
  */
 static void send_flag_message_to_all_clients(const uint8_t FLAG_MESSAGE){
     for (uint8_t client_index = 0; client_index < active_server_connections_number; client_index++){
         if (active_uart_server_connections[client_index].is_dormant){
-            wake_up_client(active_uart_server_connections[client_index].pin_pair,
-                active_uart_server_connections[client_index].uart_instance);
+            wake_up_client(client_index);
         }
         send_flag_message_to_client(FLAG_MESSAGE, client_index);
     } 
@@ -133,19 +105,44 @@ void send_dormant_to_standby_clients(void){
     }
 }
 
-void server_send_client_state(uart_pin_pair_t pin_pair, uart_inst_t* uart, const client_state_t* state){
-    wake_up_client(pin_pair, uart);
-    uint32_t irq = spin_lock_blocking(uart_lock);
-    uart_init_with_pins(uart, pin_pair, DEFAULT_BAUDRATE);
-
-    for (uint8_t i = 0; i < MAX_NUMBER_OF_GPIOS; i++) {
-        char msg[8];
-        snprintf(msg, sizeof(msg), "[%d,%d]", state->devices[i].gpio_number, state->devices[i].is_on);
-        uart_puts(uart, msg);
-        uart_tx_wait_blocking(uart);
-        sleep_us(500);
+bool server_sync_client_state(uint8_t client_index, const client_state_t* state){
+    server_uart_connection_t *connection = &active_uart_server_connections[client_index];
+    uint32_t gpio_mask = client_state_get_gpio_mask(state);
+    uint32_t changed_gpio_mask = gpio_mask ^ connection->synced_gpio_mask;
+
+    if (!changed_gpio_mask){
+        return true;
+    }
+
+    // A dormant client would miss the state, keep it for the next sync
+    if (connection->is_dormant && !wake_up_client(client_index)){
+        return false;
+    }
+
+    bool is_queued;
+    if (!(changed_gpio_mask & (changed_gpio_mask - 1))){
+        uint8_t gpio_number = __builtin_ctz(changed_gpio_mask);
+        is_queued = uart_tx_queue_send(client_index, gpio_number, (gpio_mask >> gpio_number) & 1u, false, NULL, 0);
+    }else{
+        is_queued = uart_tx_queue_send(client_index, FULL_STATE_FLAG_NUMBER, gpio_mask, false, NULL, 0);
+    }
+
+    if (is_queued){
+        connection->synced_gpio_mask = gpio_mask;
+    }
+    return is_queued;
+}
+
+void server_sync_clients_service(void){
+    if (!server_state_is_valid()){
+        return;
     }
 
-    reset_gpio_pins(pin_pair);
-    spin_unlock(uart_lock, irq);
-}
\ No newline at end of file
+    const server_persistent_state_t *state = server_state_get();
+    for (uint8_t client_index = 0; client_index < active_server_connections_number; client_index++){
+        uint8_t flash_client_index = server_flash_index_of_active(client_index);
+        if (flash_client_index != CLIENT_INDEX_NOT_CONNECTED){
+            server_sync_client_state(client_index, &state->clients[flash_client_index].running_client_state);
+        }
+    }
+}
@@ -0,0 +1,355 @@
+/**
+ * @file client_registry.c
+ * @brief Registry of the clients known to the server, keyed by client ID.
+ *
+ * Every client reports its unique board ID in the handshake, so its saved
+ * state follows it from one pin pair to another and the number of remembered
+ * clients is no longer tied to the number of pin pairs:
+ * - A client is looked up by ID once, when it connects; the index tables of
+ *   state_handling.c then link it to its connection in constant time.
+ * - An unknown client gets the next free entry. Once `MAX_REGISTERED_CLIENTS`
+ *   are registered, the least recently connected entry without saved state is
+ *   reused, else the least recently connected one. Entries are ranked by
+ *   `client_t.recency`: every connected client ranks above every disconnected
+ *   one (`server_client_registry_touch_connected()`), so the ranking, saved
+ *   with the registry, only changes when a disconnected client comes back.
+ * - Clients that report no ID (older firmware) are keyed by their server pin
+ *   pair. When such a client is updated, it takes over that entry on its next
+ *   handshake. States saved by the first releases are keyed the same way.
+ *
+ * Entries never move, records in the flash log address them by index.
+ *
+ * Preset configurations come from a pool of `MAX_CLIENT_PRESET_SETS` sets: a
+ * client gets a set the first time it saves a preset, and gives it back when
+ * all its presets are reset or its entry is reused.
+ *
+ * Registry edits are done by core 0 only. Core 1 (background discovery)
+ * requests the link of a new connection with
+ * `server_client_registry_request_link()`, core 0 completes it in
+ * `server_client_registry_service()`. A known connection handshaken again is
+ * also handed over (`server_client_registry_request_handshake()`): core 0
+ * owns the fields of a live connection, so it applies the handshake itself.
+ *
+ * @see server_persistent_state_t
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hardware/sync.h"
+
+#include "server.h"
+
+/// Preset sets of the pool, one bit each.
+#define CLIENT_PRESET_SETS_MASK ((uint32_t)((1ull << MAX_CLIENT_PRESET_SETS) - 1))
+
+static_assert(MAX_REGISTERED_CLIENTS >= MAX_SERVER_CONNECTIONS, "Every connected client needs a registry entry");
+static_assert(MAX_REGISTERED_CLIENTS < CLIENT_INDEX_NOT_CONNECTED, "Registry indexes must fit below the sentinel");
+static_assert(MAX_CLIENT_PRESET_SETS <= 32 && MAX_CLIENT_PRESET_SETS < CLIENT_NO_PRESET_SET, "Preset sets are tracked in a 32-bit mask");
+static_assert(MAX_SERVER_CONNECTIONS <= 32, "Pending links are tracked in a 32-bit mask");
+
+/// Connections waiting for core 0 to link them to a registry entry (bit n = active connection n).
+static volatile uint32_t pending_links = 0;
+/// Known connections handshaken again by core 1, waiting for core 0 to apply the result (bit n = active connection n).
+static volatile uint32_t pending_handshakes = 0;
+/// Result of each pending handshake, valid while its bit is set in `pending_handshakes`.
+static server_uart_connection_t handshake_connections[MAX_SERVER_CONNECTIONS];
+static bool is_handshake_connected[MAX_SERVER_CONNECTIONS];
+
+uint8_t server_client_registry_find(const server_persistent_state_t *state, client_id_t client_id){
+    for (uint8_t index = 0; index < state->clients_number; index++){
+        if (state->clients[index].client_id == client_id){
+            return index;
+        }
+    }
+    return CLIENT_INDEX_NOT_CONNECTED;
+}
+
+/**
+ * @brief Gives the preset set of a client back to the pool.
+ */
+static void server_client_release_presets(server_persistent_state_t *state, client_t *client){
+    if (client->preset_set != CLIENT_NO_PRESET_SET){
+        state->preset_sets_used &= ~(1u << client->preset_set);
+        client->preset_set = CLIENT_NO_PRESET_SET;
+    }
+}
+
+/**
+ * @brief Returns true if a client has nothing worth keeping: no device ON, no preset.
+ */
+static bool server_client_is_blank(const client_t *client){
+    return !client_has_active_devices(client) && client->preset_set == CLIENT_NO_PRESET_SET;
+}
+
+/**
+ * @brief Returns the entry for a new client: a free one, or a disconnected one to reuse.
+ *
+ * Blank entries are reused first, then the least recently connected one.
+ */
+static uint8_t server_client_registry_allocate(server_persistent_state_t *state){
+    if (state->clients_number < MAX_REGISTERED_CLIENTS){
+        return state->clients_number++;
+    }
+
+    uint8_t reused_index = CLIENT_INDEX_NOT_CONNECTED;
+    bool is_reused_blank = false;
+    for (uint8_t index = 0; index < state->clients_number; index++){
+        if (server_active_index_of_flash(index) != CLIENT_INDEX_NOT_CONNECTED){
+            continue;
+        }
+
+        bool is_blank = server_client_is_blank(&state->clients[index]);
+        if (reused_index == CLIENT_INDEX_NOT_CONNECTED || (is_blank && !is_reused_blank) ||
+            (is_blank == is_reused_blank && state->clients[index].recency < state->clients[reused_index].recency)){
+            reused_index = index;
+            is_reused_blank = is_blank;
+        }
+    }
+
+    server_client_release_presets(state, &state->clients[reused_index]);
+    return reused_index;
+}
+
+uint8_t server_client_registry_register(server_persistent_state_t *state, const server_uart_connection_t *connection){
+    uint8_t index = server_client_registry_find(state, connection->client_id);
+    if (index != CLIENT_INDEX_NOT_CONNECTED){
+        return index;
+    }
+
+    // A client reporting its ID for the first time takes over the entry of its pin pair
+    index = server_client_registry_find(state, server_legacy_client_id(connection->pin_pair));
+    if (index == CLIENT_INDEX_NOT_CONNECTED || server_active_index_of_flash(index) != CLIENT_INDEX_NOT_CONNECTED){
+        index = server_client_registry_allocate(state);
+        state->clients[index] = (client_t){
+            .preset_set = CLIENT_NO_PRESET_SET,
+            .uart_connection = {.pin_pair = connection->pin_pair, .uart_instance = connection->uart_instance},
+        };
+    }
+
+    state->clients[index].client_id = connection->client_id;
+    return index;
+}
+
+/**
+ * @brief Ranks a client as the most recently connected one.
+ *
+ * Clients ranked above it move down by one, so ranks stay below `clients_number`.
+ */
+static void server_client_registry_touch(server_persistent_state_t *state, uint8_t flash_client_index){
+    uint8_t recency = state->clients[flash_client_index].recency;
+    for (uint8_t index = 0; index < state->clients_number; index++){
+        if (state->clients[index].recency > recency){
+            state->clients[index].recency--;
+        }
+    }
+    state->clients[flash_client_index].recency = state->clients_number - 1;
+}
+
+bool server_client_registry_touch_connected(server_persistent_state_t *state){
+    uint8_t highest_disconnected = 0;
+    bool has_disconnected = false;
+    for (uint8_t index = 0; index < state->clients_number; index++){
+        if (server_active_index_of_flash(index) == CLIENT_INDEX_NOT_CONNECTED &&
+            (!has_disconnected || state->clients[index].recency > highest_disconnected)){
+            highest_disconnected = state->clients[index].recency;
+            has_disconnected = true;
+        }
+    }
+
+    bool is_changed = false;
+    for (uint8_t index = 0; index < state->clients_number; index++){
+        if (server_active_index_of_flash(index) == CLIENT_INDEX_NOT_CONNECTED){
+            continue;
+        }
+        // Equal ranks count as older: images saved before the ranking read as all 0
+        if ((has_disconnected && state->clients[index].recency <= highest_disconnected) ||
+            state->clients[index].recency >= state->clients_number){
+            server_client_registry_touch(state, index);
+            is_changed = true;
+        }
+    }
+    return is_changed;
+}
+
+void server_client_registry_clear(server_persistent_state_t *state){
+    state->clients_number = 0;
+    state->preset_sets_used = 0;
+}
+
+client_state_t server_client_get_preset(const server_persistent_state_t *state, uint32_t flash_client_index, uint32_t preset_index){
+    const client_t *client = &state->clients[flash_client_index];
+    if (client->preset_set == CLIENT_NO_PRESET_SET){
+        return (client_state_t){.reserved_mask = client->running_client_state.reserved_mask};
+    }
+    return state->preset_sets[client->preset_set].presets[preset_index];
+}
+
+client_state_t *server_client_edit_preset(server_persistent_state_t *state, uint32_t flash_client_index, uint32_t preset_index){
+    client_t *client = &state->clients[flash_client_index];
+
+    if (client->preset_set == CLIENT_NO_PRESET_SET){
+        uint32_t free_sets = ~state->preset_sets_used & CLIENT_PRESET_SETS_MASK;
+        if (!free_sets){
+            return NULL;
+        }
+
+        uint8_t set = __builtin_ctz(free_sets);
+        state->preset_sets_used |= 1u << set;
+        for (uint8_t index = 0; index < NUMBER_OF_POSSIBLE_PRESETS; index++){
+            state->preset_sets[set].presets[index] = (client_state_t){.reserved_mask = client->running_client_state.reserved_mask};
+        }
+        client->preset_set = set;
+    }
+
+    return &state->preset_sets[client->preset_set].presets[preset_index];
+}
+
+void server_client_trim_presets(server_persistent_state_t *state, uint32_t flash_client_index){
+    client_t *client = &state->clients[flash_client_index];
+    if (client->preset_set == CLIENT_NO_PRESET_SET){
+        return;
+    }
+
+    const client_preset_set_t *set = &state->preset_sets[client->preset_set];
+    for (uint8_t index = 0; index < NUMBER_OF_POSSIBLE_PRESETS; index++){
+        if (client_state_any_on(&set->presets[index])){
+            return;
+        }
+    }
+    server_client_release_presets(state, client);
+}
+
+void server_client_set_reserved_mask(server_persistent_state_t *state, uint32_t flash_client_index, uint32_t reserved_mask){
+    client_t *client = &state->clients[flash_client_index];
+
+    client->running_client_state.reserved_mask = reserved_mask;
+    client->running_client_state.on_mask &= ~reserved_mask;
+
+    if (client->preset_set != CLIENT_NO_PRESET_SET){
+        client_preset_set_t *set = &state->preset_sets[client->preset_set];
+        for (uint8_t index = 0; index < NUMBER_OF_POSSIBLE_PRESETS; index++){
+            set->presets[index].reserved_mask = reserved_mask;
+            set->presets[index].on_mask &= ~reserved_mask;
+        }
+    }
+}
+
+uint8_t server_client_registry_link(uint8_t active_client_index){
+    const server_uart_connection_t *connection = &active_uart_server_connections[active_client_index];
+
+    // The connection may have carried another client before
+    server_client_index_map_set(active_client_index, CLIENT_INDEX_NOT_CONNECTED);
+
+    uint8_t flash_client_index = server_client_registry_find(server_state_get(), connection->client_id);
+    if (flash_client_index == CLIENT_INDEX_NOT_CONNECTED){
+        flash_client_index = server_client_registry_register(server_state_begin_edit(), connection);
+        server_state_end_edit();
+    }
+
+    server_client_index_map_set(active_client_index, flash_client_index);
+    return flash_client_index;
+}
+
+void server_client_registry_request_link(uint8_t active_client_index){
+    spin_lock_t *lock = client_index_map_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+    pending_links |= 1u << active_client_index;
+    spin_unlock(lock, irq_state);
+}
+
+void server_client_registry_request_handshake(uint8_t active_client_index, const server_uart_connection_t *connection){
+    spin_lock_t *lock = client_index_map_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+    is_handshake_connected[active_client_index] = connection != NULL;
+    if (connection){
+        handshake_connections[active_client_index] = *connection;
+    }
+    pending_handshakes |= 1u << active_client_index;
+    spin_unlock(lock, irq_state);
+}
+
+/**
+ * @brief Applies the new handshake of a known connection and resumes its traffic.
+ *
+ * - Connected with the same ID and reverse pins while linked: the client only
+ *   needs its saved running state.
+ * - Connected otherwise: the client needs a new link.
+ * - Failed: the client is in an unknown state, so it is unlinked and state
+ *   edits stop syncing to it until it handshakes again.
+ *
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @param connection Result of the handshake, NULL if it failed.
+ * @param links Connections to link, updated.
+ * @param loads Connections to load the saved running state to, updated.
+ */
+static void server_client_registry_apply_handshake(uint8_t active_client_index, const server_uart_connection_t *connection,
+                                                   uint32_t *links, uint32_t *loads){
+    server_uart_connection_t *existing = &active_uart_server_connections[active_client_index];
+
+    if (!connection){
+        server_client_index_map_set(active_client_index, CLIENT_INDEX_NOT_CONNECTED);
+        uart_tx_queue_resume_client(active_client_index);
+        return;
+    }
+
+    bool is_same_link = existing->client_id == connection->client_id &&
+        existing->uart_pin_pair_from_client_to_server.tx == connection->uart_pin_pair_from_client_to_server.tx &&
+        existing->uart_pin_pair_from_client_to_server.rx == connection->uart_pin_pair_from_client_to_server.rx;
+
+    existing->uart_pin_pair_from_client_to_server = connection->uart_pin_pair_from_client_to_server;
+    existing->client_id = connection->client_id;
+    existing->baudrate = connection->baudrate;
+    existing->is_dormant = false;
+    existing->synced_gpio_mask = 0;
+    __dmb();
+    uart_tx_queue_resume_client(active_client_index);
+
+    if (is_same_link && server_flash_index_of_active(active_client_index) != CLIENT_INDEX_NOT_CONNECTED){
+        *loads |= 1u << active_client_index;
+    }else{
+        *links |= 1u << active_client_index;
+    }
+}
+
+void server_client_registry_service(void){
+    server_uart_connection_t connections[MAX_SERVER_CONNECTIONS];
+    bool is_connected[MAX_SERVER_CONNECTIONS];
+
+    spin_lock_t *lock = client_index_map_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+    uint32_t links = pending_links;
+    uint32_t handshakes = pending_handshakes;
+    pending_links = 0;
+    pending_handshakes = 0;
+    for (uint32_t pending = handshakes; pending; pending &= pending - 1){
+        uint8_t index = __builtin_ctz(pending);
+        connections[index] = handshake_connections[index];
+        is_connected[index] = is_handshake_connected[index];
+    }
+    spin_unlock(lock, irq_state);
+
+    uint32_t loads = 0;
+    for (uint32_t pending = handshakes; pending; pending &= pending - 1){
+        uint8_t index = __builtin_ctz(pending);
+        server_client_registry_apply_handshake(index, is_connected[index] ? &connections[index] : NULL, &links, &loads);
+    }
+
+    if (!(links | loads) || !server_state_is_valid()){
+        return;
+    }
+
+    for (uint32_t pending = links; pending; pending &= pending - 1){
+        server_client_registry_link(__builtin_ctz(pending));
+    }
+
+    if (links){
+        // Link pin pair, reverse pins and UART pin reservations of the new clients
+        server_update_topology(server_state_begin_edit());
+        server_state_end_edit();
+    }
+
+    for (uint32_t pending = links | loads; pending; pending &= pending - 1){
+        server_load_running_state_to_client(__builtin_ctz(pending));
+    }
+}
@@ -0,0 +1,59 @@
+/**
+ * @file flash_guard.c
+ * @brief Coordination of both cores around flash erase and program operations.
+ *
+ * While flash is erased or programmed, XIP is unavailable: any instruction
+ * fetch or read from flash on either core would stall or fault. Every write
+ * therefore runs between `flash_guard_begin()` and `flash_guard_end()`:
+ * - Core 1 is parked in a RAM handler through `multicore_lockout`, once it
+ *   has registered itself with `flash_guard_register_core1()`. Core 0 waits
+ *   for that right after launching it (`flash_guard_wait_for_core1()`), so
+ *   core 1 never runs unguarded startup code while flash is written
+ * - Interrupts are disabled on core 0, which is the only core writing flash
+ *
+ * Callers keep each guarded section to a single sector erase or page program,
+ * so the time core 1 (heartbeat, background discovery) is held stays bounded.
+ * Only the lockout handler core 1 is parked in must run from RAM (the SDK
+ * provides it): the rest of the core 1 loop and the UART send path, with the
+ * interrupts and alarms they use, stay in flash and simply do not run while
+ * a write is in progress.
+ *
+ * @see state_flash.c
+ * @see periodic_wakeup()
+ */
+
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+#include "server.h"
+
+/// Core 1 is registered as a lockout victim and must be parked for every write.
+static volatile bool is_core1_guarded = false;
+
+void flash_guard_register_core1(void){
+    multicore_lockout_victim_init();
+    __dmb();
+    is_core1_guarded = true;
+}
+
+void flash_guard_wait_for_core1(void){
+    while (!is_core1_guarded){
+        tight_loop_contents();
+    }
+}
+
+uint32_t __not_in_flash_func(flash_guard_begin)(void){
+    hard_assert(get_core_num() == 0);
+
+    if (is_core1_guarded){
+        multicore_lockout_start_blocking();
+    }
+    return save_and_disable_interrupts();
+}
+
+void __not_in_flash_func(flash_guard_end)(uint32_t interrupts){
+    restore_interrupts(interrupts);
+    if (is_core1_guarded){
+        multicore_lockout_end_blocking();
+    }
+}
@@ -0,0 +1,299 @@
+/**
+ * @file hot_plug.c
+ * @brief Background discovery of clients plugged in or reset after boot.
+ *
+ * Runs on core 1, next to the heartbeat. Passive PIO listeners sample the RX
+ * pins of the pin pairs without taking them over, so both free pairs and the
+ * wake-up lines of connected clients are watched:
+ * - A client powered on later sends connection requests on a free pair.
+ * - A client that reset (watchdog, link fallback) sends them on its own pair.
+ *
+ * A PIO interrupt moves received bytes into per-listener buffers. When a
+ * complete `CONNECTION_REQUEST_MESSAGE` arrives, the listeners are released and
+ * the handshake is completed through a PIO channel on that pair, so the
+ * hardware UARTs keep serving the other clients undisturbed. A new client is
+ * added to `active_uart_server_connections`; core 0 updates a known one, links
+ * it to its registry entry and pushes only its own running state.
+ *
+ * If more pairs than free state machines exist, the listeners rotate over the
+ * pairs every `SERVER_TIMEOUT_MS`.
+ *
+ * @see server_find_connections()
+ * @see periodic_wakeup()
+ */
+
+#include <string.h>
+
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+#include "server.h"
+
+/**
+ * @brief Passive listener on the RX pin of one pin pair.
+ */
+typedef struct{
+    volatile bool is_active;
+    volatile bool has_request;  ///< `buf` holds a complete request, reception is paused
+    uint8_t pair_index;         ///< Index over uart0, uart1 and PIO pin pairs
+    uint8_t pio_listener;
+    char buf[32];
+    uint8_t length;
+}hot_plug_listener_t;
+
+static hot_plug_listener_t hot_plug_listeners[MAX_SERVER_CONNECTIONS];
+static uint8_t hot_plug_listeners_number = 0;
+static uint8_t hot_plug_next_pair_index = 0;
+static bool hot_plug_covers_all_pairs = false;
+static absolute_time_t hot_plug_window_end;
+
+/**
+ * @brief Returns a pin pair by its index over uart0, uart1 and PIO pin pairs.
+ *
+ * @param pair_index Index in [0, MAX_SERVER_CONNECTIONS).
+ * @param uart_instance Receives the hardware UART of the pair, NULL for PIO pairs.
+ */
+static uart_pin_pair_t server_hot_plug_get_pair(uint8_t pair_index, uart_inst_t **uart_instance){
+    if (pair_index < PIN_PAIRS_UART0_LEN){
+        *uart_instance = uart0;
+        return pin_pairs_uart0[pair_index];
+    }
+    pair_index -= PIN_PAIRS_UART0_LEN;
+
+    if (pair_index < PIN_PAIRS_UART1_LEN){
+        *uart_instance = uart1;
+        return pin_pairs_uart1[pair_index];
+    }
+    pair_index -= PIN_PAIRS_UART1_LEN;
+
+    *uart_instance = NULL;
+    return pin_pairs_pio[pair_index];
+}
+
+/**
+ * @brief Returns the active connection on `pin_pair`, or -1 if there is none.
+ */
+static int server_hot_plug_find_client(uart_pin_pair_t pin_pair){
+    for (uint8_t index = 0; index < active_server_connections_number; index++){
+        if (active_uart_server_connections[index].pin_pair.tx == pin_pair.tx){
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief PIO interrupt handler, moves received bytes into the listener buffers.
+ *
+ * A listener stops receiving once it holds a complete request, until
+ * `server_hot_plug_service()` has handled it.
+ */
+static void server_hot_plug_on_pio_irq(void){
+    for (uint8_t index = 0; index < hot_plug_listeners_number; index++){
+        hot_plug_listener_t *listener = &hot_plug_listeners[index];
+        if (!listener->is_active || listener->has_request){
+            continue;
+        }
+
+        while (pio_uart_listener_is_readable(listener->pio_listener)){
+            char c = pio_uart_listener_getc(listener->pio_listener);
+
+            if (listener->length >= sizeof(listener->buf) - 1){
+                listener->length = 0;
+            }
+            listener->buf[listener->length++] = c;
+
+            if (c == ']'){
+                listener->buf[listener->length] = '\0';
+                listener->length = 0;
+                if (strstr(listener->buf, CONNECTION_REQUEST_MESSAGE)){
+                    listener->has_request = true;
+                    pio_uart_listener_set_irq_enabled(listener->pio_listener, false);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Releases every listener and its state machine.
+ */
+static void server_hot_plug_detach_all(void){
+    for (uint8_t index = 0; index < hot_plug_listeners_number; index++){
+        hot_plug_listener_t *listener = &hot_plug_listeners[index];
+        if (listener->is_active){
+            pio_uart_listener_close(listener->pio_listener);
+            listener->is_active = false;
+        }
+    }
+    hot_plug_listeners_number = 0;
+}
+
+/**
+ * @brief Attaches passive listeners to the next pin pairs, as far as state machines allow.
+ */
+static void server_hot_plug_attach_batch(void){
+    uint8_t attached = 0;
+
+    while (attached < MAX_SERVER_CONNECTIONS){
+        uint8_t pair_index = (hot_plug_next_pair_index + attached) % MAX_SERVER_CONNECTIONS;
+        uart_inst_t *uart_instance;
+        uart_pin_pair_t pin_pair = server_hot_plug_get_pair(pair_index, &uart_instance);
+
+        int pio_listener = pio_uart_listener_open(pin_pair.rx, DEFAULT_BAUDRATE, true);
+        if (pio_listener < 0){
+            break;
+        }
+
+        hot_plug_listener_t *listener = &hot_plug_listeners[hot_plug_listeners_number];
+        listener->pair_index = pair_index;
+        listener->pio_listener = (uint8_t)pio_listener;
+        listener->length = 0;
+        listener->has_request = false;
+        listener->is_active = true;
+        hot_plug_listeners_number++;
+        attached++;
+
+        pio_uart_listener_set_irq_enabled(listener->pio_listener, true);
+    }
+
+    hot_plug_covers_all_pairs = (attached == MAX_SERVER_CONNECTIONS);
+    hot_plug_next_pair_index = (hot_plug_next_pair_index + attached) % MAX_SERVER_CONNECTIONS;
+    hot_plug_window_end = make_timeout_time_ms(SERVER_TIMEOUT_MS);
+}
+
+/**
+ * @brief Makes a freshly handshaken connection visible to the rest of the server.
+ *
+ * The entry is completely written before `active_server_connections_number`
+ * is increased, so core 0 never sees a partial connection.
+ *
+ * @return Index of the new connection, or -1 if the list is full.
+ */
+static int server_hot_plug_publish(const server_uart_connection_t *connection){
+    if (active_server_connections_number >= MAX_SERVER_CONNECTIONS){
+        return -1;
+    }
+
+    uint8_t client_index = active_server_connections_number;
+    active_uart_server_connections[client_index] = *connection;
+    if (connection->transport == UART_TRANSPORT_PIO){
+        uart_tx_queue_add_pio_channel(connection->pio_channel);
+    }
+
+    __dmb();
+    active_server_connections_number++;
+    return client_index;
+}
+
+/**
+ * @brief Completes the handshake for a request heard on a pin pair.
+ *
+ * - A known client is suspended first: its queued frames are sent, new ones
+ *   are dropped, and its TX pin is released from the hardware UART.
+ * - The handshake runs through a PIO channel: the client's own channel for
+ *   PIO pairs, a temporary one for hardware pairs.
+ * - A new client is added and linked to the registry by core 0
+ *   (`server_client_registry_service()`).
+ * - The result for a known client, failed or not, is handed to core 0 with
+ *   its traffic still suspended (`server_client_registry_request_handshake()`):
+ *   core 0 reads and writes the fields of live connections while syncing
+ *   states, so it is the one to update them and resume the traffic.
+ */
+static void server_hot_plug_handshake(uint8_t pair_index, const char *request){
+    uart_inst_t *uart_instance;
+    uart_pin_pair_t pin_pair = server_hot_plug_get_pair(pair_index, &uart_instance);
+    int client_index = server_hot_plug_find_client(pin_pair);
+
+    int channel;
+    if (client_index >= 0 && !uart_tx_queue_suspend_client(client_index)){
+        server_client_registry_request_handshake(client_index, NULL);
+        return;
+    }
+    if (client_index >= 0 && !uart_instance){
+        channel = active_uart_server_connections[client_index].pio_channel;
+        pio_uart_set_baudrate(channel, DEFAULT_BAUDRATE);
+    }else{
+        channel = pio_uart_channel_open(pin_pair, DEFAULT_BAUDRATE);
+        if (channel < 0){
+            if (client_index >= 0){
+                server_client_registry_request_handshake(client_index, NULL);
+            }
+            return;
+        }
+    }
+
+    server_uart_connection_t connection = {
+        .pin_pair = pin_pair,
+        .uart_instance = uart_instance,
+        .transport = uart_instance ? UART_TRANSPORT_HARDWARE : UART_TRANSPORT_PIO,
+        .pio_channel = uart_instance ? 0 : (uint8_t)channel,
+    };
+    bool is_connected = pio_uart_rx_open(channel) &&
+        server_complete_pio_handshake(channel, uart_instance, request, &connection);
+    pio_uart_rx_close(channel);
+    uart_tx_queue_init_wake_up_line(pin_pair.rx);
+
+    if (uart_instance){
+        // Hand the TX pin back at idle level, the UART routes it again on first use
+        gpio_put(pin_pair.tx, true);
+        gpio_set_dir(pin_pair.tx, GPIO_OUT);
+        pio_uart_channel_close(channel);
+    }else if (!is_connected && client_index < 0){
+        pio_uart_channel_close(channel);
+    }
+
+    if (!is_connected){
+        if (client_index >= 0){
+            if (!uart_instance){
+                // The channel carries the known link again
+                pio_uart_set_baudrate(channel, active_uart_server_connections[client_index].baudrate);
+            }
+            server_client_registry_request_handshake(client_index, NULL);
+        }
+        return;
+    }
+
+    if (client_index >= 0){
+        server_client_registry_request_handshake(client_index, &connection);
+        return;
+    }
+
+    client_index = server_hot_plug_publish(&connection);
+    if (client_index >= 0){
+        // Registry edits and pin reservations are done by core 0
+        server_client_registry_request_link(client_index);
+    }
+}
+
+void server_hot_plug_init(void){
+    pio_uart_listener_set_irq_handler(server_hot_plug_on_pio_irq);
+    server_hot_plug_attach_batch();
+}
+
+absolute_time_t server_hot_plug_service(void){
+    for (uint8_t index = 0; index < hot_plug_listeners_number; index++){
+        hot_plug_listener_t *listener = &hot_plug_listeners[index];
+        if (!listener->is_active || !listener->has_request){
+            continue;
+        }
+
+        char request[sizeof(listener->buf)];
+        uint8_t pair_index = listener->pair_index;
+        memcpy(request, listener->buf, sizeof(request));
+
+        server_hot_plug_detach_all();
+        server_hot_plug_handshake(pair_index, request);
+        server_hot_plug_attach_batch();
+        return hot_plug_covers_all_pairs ? at_the_end_of_time : hot_plug_window_end;
+    }
+
+    if (!hot_plug_covers_all_pairs && time_reached(hot_plug_window_end)){
+        server_hot_plug_detach_all();
+        server_hot_plug_attach_batch();
+    }
+
+    return hot_plug_covers_all_pairs ? at_the_end_of_time : hot_plug_window_end;
+}
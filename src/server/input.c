@@ -33,6 +33,27 @@ static void flush_stdin(void){
     }
 }
 
+/**
+ * @brief Waits for one character, servicing the state cache meanwhile.
+ *
+ * Waiting for the user is core 0's idle time: clients connected in the
+ * background are linked, states dropped by a full TX queue are sent again,
+ * and deferred flash commits run here.
+ *
+ * @return The character read.
+ */
+static int getchar_and_service_state(void){
+    while (true){
+        int ch = getchar_timeout_us(SERVER_STATE_SERVICE_PERIOD_MS * MS_TO_US_MULTIPLIER);
+        if (ch != PICO_ERROR_TIMEOUT){
+            return ch;
+        }
+        server_client_registry_service();
+        server_sync_clients_service();
+        server_state_service();
+    }
+}
+
 /**
  * @brief Converts a numeric string to an unsigned 32-bit integer.
  *
@@ -88,7 +109,7 @@ static bool read_uint32_line(uint32_t *out){
     int len = 0;
 
     while (true){
-        int ch = getchar();
+        int ch = getchar_and_service_state();
         if ((ch == '\r' || ch == '\n') && len > 0) 
             break;
         
@@ -215,9 +236,11 @@ bool choose_client(uint32_t *client_index){
 
     for (uint32_t index = 0; index < active_server_connections_number; index++){
         char string[BUFFER_MAX_STRING_SIZE];
-        snprintf(string, sizeof(string), "%u. Client No. %u, connected to the server's GPIO pins [%d,%d]\n",
-            index + 1,
+        client_id_t client_id = active_uart_server_connections[index].client_id;
+        snprintf(string, sizeof(string), "%u. Client %08lx%08lx on server pins [%d,%d]\n",
             index + 1,
+            (unsigned long)(client_id >> 32),
+            (unsigned long)client_id,
             active_uart_server_connections[index].pin_pair.tx,
             active_uart_server_connections[index].pin_pair.rx
         );
@@ -254,7 +277,7 @@ bool choose_device(uint32_t *device_index, const client_state_t *client_state){
     const char *MESSAGE = "\nWhat device number do you want to access?";
     print_cancel_message();
     if (read_user_choice_in_range(MESSAGE, device_index, MINIMUM_DEVICE_INDEX_INPUT, MAXIMUM_DEVICE_INDEX_INPUT)){
-        if (client_state->devices[*device_index - 1].gpio_number != UART_CONNECTION_FLAG_NUMBER){
+        if (!client_state_is_reserved(client_state, *device_index - 1)){
             return true;
         }else{
             printf_and_update_buffer("\nSelected device is used as UART connection.\n");
@@ -288,8 +311,14 @@ bool read_client_data(input_client_data_t *client_data, client_input_flags_t cli
 
     }
 
-    const server_persistent_state_t *flash_state = (const server_persistent_state_t *)SERVER_FLASH_ADDR;
-    find_corect_client_index_from_flash(&client_data->flash_client_index, client_data->client_index, flash_state);
+    const server_persistent_state_t *flash_state = server_state_get();
+    uint8_t flash_client_index = server_flash_index_of_active(client_data->client_index - 1);
+    if (flash_client_index == CLIENT_INDEX_NOT_CONNECTED){
+        // Connected in the background and not linked to its saved state yet
+        printf_and_update_buffer("\nClient not ready yet. Try again.\n");
+        return false;
+    }
+    client_data->flash_client_index = flash_client_index;
     const client_state_t *client_state = &flash_state->clients[client_data->flash_client_index].running_client_state;
     client_data->client_state = client_state;
     client_data->flash_state = flash_state;
@@ -311,9 +340,9 @@ bool read_client_data(input_client_data_t *client_data, client_input_flags_t cli
 
     if (client_input_flags.need_config_index && !client_input_flags.is_building_preset){
         printf_and_update_buffer("\n");
-        server_print_running_client_state((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_running_client_state(&flash_state->clients[client_data->flash_client_index]);
         printf_and_update_buffer("\n");
-        server_print_client_preset_configurations((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_client_preset_configurations(client_data->flash_client_index);
 
         read_flash_configuration_index(&client_data->flash_configuration_index);  
         if (!client_data->flash_configuration_index){
@@ -323,7 +352,7 @@ bool read_client_data(input_client_data_t *client_data, client_input_flags_t cli
 
     if (client_input_flags.is_building_preset){
         printf_and_update_buffer("\n");
-        server_print_client_preset_configurations((const client_t *)&flash_state->clients[client_data->flash_client_index]);   
+        server_print_client_preset_configurations(client_data->flash_client_index);   
 
         read_flash_configuration_index(&client_data->flash_configuration_index);  
         if (!client_data->flash_configuration_index){
@@ -334,9 +363,9 @@ bool read_client_data(input_client_data_t *client_data, client_input_flags_t cli
 
     if(client_input_flags.is_load){
         printf_and_update_buffer("\n");
-        server_print_running_client_state((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_running_client_state(&flash_state->clients[client_data->flash_client_index]);
         printf_and_update_buffer("\n");
-        server_print_client_preset_configurations((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_client_preset_configurations(client_data->flash_client_index);
 
         read_flash_configuration_index(&client_data->flash_configuration_index);    
         if (!client_data->flash_configuration_index){
@@ -346,9 +375,9 @@ bool read_client_data(input_client_data_t *client_data, client_input_flags_t cli
 
     if (client_input_flags.need_reset_choice){
         printf_and_update_buffer("\n");
-        server_print_running_client_state((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_running_client_state(&flash_state->clients[client_data->flash_client_index]);
         printf_and_update_buffer("\n");
-        server_print_client_preset_configurations((const client_t *)&flash_state->clients[client_data->flash_client_index]);
+        server_print_client_preset_configurations(client_data->flash_client_index);
 
         read_reset_variant(&client_data->reset_choice);
         if (!client_data->reset_choice){
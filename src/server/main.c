@@ -22,9 +22,50 @@
 #include "server.h"
 #include "functions.h"
 #include "menu.h"
+#include "crc32.h"
 
 static repeating_timer_t repeating_timer;
-spin_lock_t *uart_lock = NULL;
+spin_lock_t *uart_locks[NUM_UARTS] = {NULL};
+spin_lock_t *pio_uart_lock = NULL;
+spin_lock_t *state_crc_lock = NULL;
+spin_lock_t *client_index_map_lock = NULL;
+
+/// Messages from core 0 to core 1. The SIO FIFO is left to `multicore_lockout`.
+static volatile uint32_t core1_messages[CORE1_MESSAGE_QUEUE_SIZE];
+static volatile uint32_t core1_messages_head = 0;
+static volatile uint32_t core1_messages_tail = 0;
+
+static_assert((CORE1_MESSAGE_QUEUE_SIZE & (CORE1_MESSAGE_QUEUE_SIZE - 1)) == 0, "CORE1_MESSAGE_QUEUE_SIZE must be a power of two");
+
+void server_post_core1_message(uint32_t message){
+    uint32_t next_head = (core1_messages_head + 1) & (CORE1_MESSAGE_QUEUE_SIZE - 1);
+    if (next_head == core1_messages_tail){
+        return;
+    }
+
+    core1_messages[core1_messages_head] = message;
+    __dmb();
+    core1_messages_head = next_head;
+    __sev();
+}
+
+/**
+ * @brief Pops the oldest message posted to core 1.
+ *
+ * @return false if there is none.
+ */
+static bool core1_pop_message(uint32_t *message){
+    uint32_t tail = core1_messages_tail;
+    if (tail == core1_messages_head){
+        return false;
+    }
+
+    __dmb();
+    *message = core1_messages[tail];
+    __dmb();
+    core1_messages_tail = (tail + 1) & (CORE1_MESSAGE_QUEUE_SIZE - 1);
+    return true;
+}
 
 /**
  * @brief Repeating timer callback to trigger onboard LED blink on core1.
@@ -35,7 +76,7 @@ spin_lock_t *uart_lock = NULL;
  * @return Always true to keep the timer running.
  */
 static bool short_onboard_led_blink(repeating_timer_t *repeating_timer){
-    multicore_fifo_push_blocking(BLINK_LED_WAKEUP_MESSAGE);
+    server_post_core1_message(BLINK_LED_WAKEUP_MESSAGE);
     return true;
 }
 
@@ -50,12 +91,13 @@ static void setup_repeating_timer_for_periodic_onboard_led_blink(){
 }
 
 void periodic_wakeup(void){
-    multicore_fifo_drain();
+    flash_guard_register_core1();
+    server_hot_plug_init();
+    absolute_time_t hot_plug_deadline = at_the_end_of_time;
     while (true) {
-        __wfe();
-        if (multicore_fifo_rvalid()) {
-            uint32_t cmd = multicore_fifo_pop_blocking();
-
+        best_effort_wfe_or_timeout(hot_plug_deadline);
+        uint32_t cmd;
+        while (core1_pop_message(&cmd)) {
             if (cmd == DUMP_BUFFER_WAKEUP_MESSAGE) {
                 for (uint8_t index = 0; index < reconnection_buffer_index; index++) {
                     printf("%s", reconnection_buffer[index]);
@@ -72,6 +114,7 @@ void periodic_wakeup(void){
                 #endif
             }
         }
+        hot_plug_deadline = server_hot_plug_service();
     }
 }
 
@@ -79,35 +122,39 @@ void periodic_wakeup(void){
  * @brief Detects UART clients and loads their saved GPIO states.
  *
  * Loops until at least one UART connection is detected. After that:
- * - Performs a confirmation blink.
+ * - Starts a confirmation blink, which runs in the background.
+ * - Starts the asynchronous transmit engine.
+ * - Waits `CLIENT_LINK_SETTLE_MS`, so every client receives commands.
  * - Loads the last saved GPIO states for each client.
  */
 static void find_clients(void){
-    while(!server_find_connections()) tight_loop_contents();
+    bool is_topology_restored = watchdog_caused_reboot() && server_reconnect_known_clients();
+    if (!is_topology_restored){
+        while(!server_find_connections()) tight_loop_contents();
+    }
 
-    blink_onboard_led_blocking();
+    blink_onboard_led();
+
+    uart_tx_queue_init();
+
+    // Let the last client finish its handshake before its state is pushed
+    sleep_ms(CLIENT_LINK_SETTLE_MS);
     
     server_load_running_states_to_active_clients();
 }
 
 /**
- * @brief Configures all RX pins of active server UART connections as outputs set to LOW.
- *
- * This is used before entering low-power modes where these pins
- * are repurposed (to trigger wakeup signals).
+ * @brief Configures all RX pins of active server UART connections as wake-up lines.
  *
- * The function:
- * - Deinitializes each RX pin (removing previous uart)
- * - Re-initializes it as a standard GPIO
- * - Sets it as output and drives it LOW
+ * These pins are repurposed to trigger wakeup signals for dormant clients.
+ * Each one idles as an input with pull-down and is driven only during a
+ * wake-up pulse (see `uart_tx_queue_init_wake_up_line()`).
  */
-static void set_pins_as_output_for_dormant_wakeup(){
+static void set_pins_as_wake_up_lines(){
     for (uint8_t connection_index = 0; connection_index < active_server_connections_number; connection_index++){
         uint8_t pin = active_uart_server_connections[connection_index].pin_pair.rx;
         gpio_deinit(pin);
-        gpio_init(pin);
-        gpio_set_dir(pin, GPIO_OUT);
-        gpio_put(pin, 0);
+        uart_tx_queue_init_wake_up_line(pin);
     }
 }
 
@@ -115,36 +162,72 @@ static void set_pins_as_output_for_dormant_wakeup(){
  * @brief Final initialization stage and entry into USB CLI display loop.
  *
  * Performs the last setup steps before the main server loop:
- * - Sets RX pins as GPIO outputs for wakeup handling
+ * - Sets RX pins as wake-up lines (inputs with pull-down, driven only to wake a client)
  * - Starts a periodic onboard LED blink timer (if enabled)
- * - Launches core 1 to handle periodic wakeup tasks
+ * - Launches core 1 to handle periodic wakeup tasks and background client discovery
  * - Waits for a USB CLI connection and launches the server menu UI
+ * - Links clients found by the background discovery, resends dropped states and
+ *   commits deferred state edits to flash meanwhile (`server_client_registry_service()`,
+ *   `server_sync_clients_service()`, `server_state_service()`)
  */
 static void last_inits_and_display_launch(){        
     #if PERIODIC_ONBOARD_LED_BLINK_SERVER || PERIODIC_ONBOARD_LED_BLINK_ALL_CLIENTS
         setup_repeating_timer_for_periodic_onboard_led_blink();
     #endif
 
+    set_pins_as_wake_up_lines();
+
     multicore_launch_core1(periodic_wakeup);
+    // No flash write may start while core 1 still runs its startup code from flash
+    flash_guard_wait_for_core1();
 
-    set_pins_as_output_for_dormant_wakeup();
+    #if SERVER_CRC32_BENCHMARK
+        bool is_crc32_benchmark_done = false;
+    #endif
 
     while(true){
         if (stdio_usb_connected()){
+            #if SERVER_CRC32_BENCHMARK
+                if (!is_crc32_benchmark_done){
+                    server_state_crc32_benchmark();
+                    is_crc32_benchmark_done = true;
+                }
+            #endif
             server_display_menu();
         }
+        server_client_registry_service();
+        server_sync_clients_service();
+        server_state_service();
     }
 }
 
 /**
- * @brief Initializes LED and USB, detects clients, and enters UI loop.
+ * @brief Initializes LED and USB, the CRC32 tables, loads the saved state, detects clients, and enters UI loop.
  */
 static void entry_point(){
     init_onboard_led_and_usb();
+    crc32_init();
+    server_state_init();
     find_clients();
     last_inits_and_display_launch();
 }
 
+/**
+ * @brief Claims and initializes every spinlock used by the server.
+ *
+ * Locks are taken from the ones the SDK leaves free, instead of fixed IDs
+ * that may collide with SDK users. Runs before anything else, so every lock
+ * is ready before core 1 starts.
+ */
+static void claim_spin_locks(void){
+    for (uint8_t uart_index = 0; uart_index < NUM_UARTS; uart_index++){
+        uart_locks[uart_index] = spin_lock_init(spin_lock_claim_unused(true));
+    }
+    pio_uart_lock = spin_lock_init(spin_lock_claim_unused(true));
+    state_crc_lock = spin_lock_init(spin_lock_claim_unused(true));
+    client_index_map_lock = spin_lock_init(spin_lock_claim_unused(true));
+}
+
 /**
  * @brief Main entry point of the UART server application.
  *
@@ -154,7 +237,7 @@ static void entry_point(){
  * @return Exit code (not used).
  */
 int main(void){
-    uart_lock = spin_lock_instance(UART_SPINLOCK_ID);
+    claim_spin_locks();
 
     if (watchdog_caused_reboot()){
         multicore_fifo_drain();
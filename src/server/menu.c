@@ -6,6 +6,7 @@
  * - Display current client connections.
  * - Select and control GPIO states of client devices.
  * - Toggle GPIO states.
+ * - Set several GPIO states, across clients, in one step.
  * - Save/build/load/reset configurations.
  * 
  * Input is read from USB serial, with range validation and error handling.
@@ -50,6 +51,7 @@ static void display_menu_options(){
     printf_and_update_buffer("7. Reset Configuration\n");
     printf_and_update_buffer("8. Clear Screen\n");
     printf_and_update_buffer("9. Restart System\n");
+    printf_and_update_buffer("10. Set Several Devices At Once\n");
 }
 
 /**
@@ -86,9 +88,14 @@ void printf_and_update_buffer(const char *string){
 
 /**
  * @brief Reboots the server and all clients.
+ *
+ * Writes pending state edits to flash and waits for the queued reset flags
+ * to be transmitted before rebooting.
  */
 static void restart_application(){
+    server_state_flush();
     signal_reset_for_all_clients();
+    uart_tx_queue_flush();
     watchdog_reboot(0,0,0);
 }
 
@@ -197,26 +204,14 @@ static void toggle_device(void){
     client_input_flags.need_device_index = true;
 
     if (read_client_data(&input_client_data, client_input_flags)){
-        uint32_t gpio_index = input_client_data.client_state->devices[input_client_data.device_index - 1].gpio_number;
-        bool device_state = input_client_data.client_state->
-                            devices[gpio_index > 22 ? (gpio_index - 3) : (gpio_index)].
-                            is_on ? false : true;
+        uint8_t device_index = input_client_data.device_index - 1;
+        bool device_state = !client_state_is_on(input_client_data.client_state, device_index);
     
-        server_set_device_state_and_update_flash(active_uart_server_connections[input_client_data.client_index - 1].pin_pair,
-        active_uart_server_connections[input_client_data.client_index - 1].uart_instance,
-        gpio_index,
+        server_set_device_state_and_update_flash(device_index,
         device_state,
         input_client_data.flash_client_index);
-
-        if (!device_state){
-            const server_persistent_state_t *flash_state = (const server_persistent_state_t *)SERVER_FLASH_ADDR;
-            if (!client_has_active_devices(flash_state->clients[input_client_data.flash_client_index])){
-                    send_dormant_flag_to_client(input_client_data.client_index - 1);
-                    active_uart_server_connections[input_client_data.client_index - 1].is_dormant = true;
-            }
-        }else{
-            active_uart_server_connections[input_client_data.client_index - 1].is_dormant = false;
-        }
+        server_update_dormant_state(input_client_data.client_index - 1,
+            &server_state_get()->clients[input_client_data.flash_client_index]);
     
         char string[BUFFER_MAX_STRING_SIZE];
         snprintf(string, sizeof(string), "\nDevice[%u] Toggled.\n", input_client_data.device_index);
@@ -246,25 +241,11 @@ static void set_client_device(void){
     client_input_flags.need_device_state = true;
 
     if (read_client_data(&input_client_data, client_input_flags)){
-        uint32_t gpio_index = input_client_data.client_state->
-                              devices[input_client_data.device_index - 1].
-                              gpio_number;
-    
-        server_set_device_state_and_update_flash(active_uart_server_connections[input_client_data.client_index - 1].pin_pair,
-            active_uart_server_connections[input_client_data.client_index - 1].uart_instance,
-            gpio_index,
+        server_set_device_state_and_update_flash(input_client_data.device_index - 1,
             input_client_data.device_state,
             input_client_data.flash_client_index);
-
-        if (input_client_data.device_state == 0){
-            const server_persistent_state_t *flash_state = (const server_persistent_state_t *)SERVER_FLASH_ADDR;
-            if (!client_has_active_devices(flash_state->clients[input_client_data.flash_client_index])){
-                send_dormant_flag_to_client(input_client_data.client_index - 1);
-                active_uart_server_connections[input_client_data.client_index - 1].is_dormant = true;
-            }
-        }else{
-            active_uart_server_connections[input_client_data.client_index - 1].is_dormant = false;
-        }
+        server_update_dormant_state(input_client_data.client_index - 1,
+            &server_state_get()->clients[input_client_data.flash_client_index]);
     
         char string[BUFFER_MAX_STRING_SIZE];
         snprintf(string, sizeof(string), "\nDevice[%u] %s.\n",
@@ -274,21 +255,112 @@ static void set_client_device(void){
     }
 }
 
+/**
+ * @brief Sets the ON/OFF state of several devices, on one or more clients, in one step.
+ *
+ * Prompts the user, until cancelled, to:
+ * - Select a client
+ * - Select its devices and their states, until cancelled; the devices are
+ *   listed with the changes staged so far
+ *
+ * Then commits all the staged changes as one transaction: each affected client
+ * gets a single frame, and the state is written to flash once
+ * (`server_device_transaction_commit()`).
+ */
+static void set_client_devices(void){
+    server_device_transaction_t transaction;
+    server_device_transaction_begin(&transaction);
+    uint32_t staged_devices = 0;
+
+    printf_and_update_buffer("\nChanges are applied together: cancel a device to pick another client, cancel the client to apply.\n");
+    while (true){
+        input_client_data_t input_client_data = {0};
+        client_input_flags_t client_input_flags = {0};
+        client_input_flags.need_client_index = true;
+        if (!read_client_data(&input_client_data, client_input_flags)){
+            break;
+        }
+
+        while (true){
+            // Show the devices as they will be once applied
+            client_state_t staged_client_state = server_device_transaction_preview(&transaction, input_client_data.flash_client_index);
+            read_device_index(&input_client_data.device_index,
+                input_client_data.flash_client_index,
+                input_client_data.flash_state,
+                &staged_client_state);
+            if (!input_client_data.device_index){
+                break;
+            }
+
+            read_device_state(&input_client_data.device_state);
+            if (!input_client_data.device_state){
+                break;
+            }
+
+            if (server_device_transaction_stage(&transaction,
+                    input_client_data.flash_client_index,
+                    input_client_data.device_index - 1,
+                    input_client_data.device_state % 2)){
+                staged_devices++;
+            }
+        }
+
+        if (active_server_connections_number == 1){
+            // The only client is picked without asking, there is no other to choose
+            break;
+        }
+    }
+
+    if (!staged_devices){
+        printf_and_update_buffer("\nNo Device Changed.\n");
+        return;
+    }
+
+    uint8_t changed_clients = server_device_transaction_commit(&transaction);
+    char string[BUFFER_MAX_STRING_SIZE];
+    snprintf(string, sizeof(string), "\n%lu Device Changes Applied, %u Clients Updated.\n",
+        (unsigned long)staged_devices, changed_clients);
+    printf_and_update_buffer(string);
+}
+
 /**
  * @brief Prints all currently active UART connections to the console.
  *
- * Displays each valid UART connection with its associated TX/RX pins and UART instance number.
+ * Displays each valid UART connection with its associated TX/RX pins and UART instance number
+ * (or PIO channel) and its client ID, then how full the client registry is.
  */
 static inline void display_active_clients(void){    
     printf_and_update_buffer("\nThese are the active client connections:\n");
     for (uint8_t index = 1; index <= active_server_connections_number; index++){
         char string[BUFFER_MAX_STRING_SIZE];
-        snprintf(string, sizeof(string), "%u. GPIO Pin Pair=[%u,%u]. UART Instance=uart%d.\n", index, 
-            active_uart_server_connections[index - 1].pin_pair.tx,
-            active_uart_server_connections[index - 1].pin_pair.rx,
-            UART_NUM(active_uart_server_connections[index - 1].uart_instance));
+        if (active_uart_server_connections[index - 1].transport == UART_TRANSPORT_PIO){
+            snprintf(string, sizeof(string), "%u. GPIO Pin Pair=[%u,%u]. PIO Channel=%u.\n", index,
+                active_uart_server_connections[index - 1].pin_pair.tx,
+                active_uart_server_connections[index - 1].pin_pair.rx,
+                active_uart_server_connections[index - 1].pio_channel);
+        }else{
+            snprintf(string, sizeof(string), "%u. GPIO Pin Pair=[%u,%u]. UART Instance=uart%d.\n", index, 
+                active_uart_server_connections[index - 1].pin_pair.tx,
+                active_uart_server_connections[index - 1].pin_pair.rx,
+                UART_NUM(active_uart_server_connections[index - 1].uart_instance));
+        }
+        printf_and_update_buffer(string);
+        client_id_t client_id = active_uart_server_connections[index - 1].client_id;
+        snprintf(string, sizeof(string), "   Client ID=%08lx%08lx.\n", (unsigned long)(client_id >> 32), (unsigned long)client_id);
+        printf_and_update_buffer(string);
+        snprintf(string, sizeof(string), "   Baud=%lu. TX queue: %u pending, high-water mark %u.\n",
+            (unsigned long)active_uart_server_connections[index - 1].baudrate,
+            uart_tx_queue_get_depth(index - 1),
+            uart_tx_queue_get_high_water_mark(index - 1));
         printf_and_update_buffer(string);
     }
+
+    const server_persistent_state_t *state = server_state_get();
+    char string[BUFFER_MAX_STRING_SIZE];
+    snprintf(string, sizeof(string), "Registered clients: %u/%u. Preset sets in use: %u/%u.\n",
+        state->clients_number, MAX_REGISTERED_CLIENTS,
+        (unsigned)__builtin_popcount(state->preset_sets_used), MAX_CLIENT_PRESET_SETS);
+    printf_and_update_buffer(string);
 }
 
 /**
@@ -316,6 +388,8 @@ static void select_action(uint32_t choice){
             break;
         case 9: restart_application();  
             break;
+        case 10: set_client_devices();
+            break;
 
         default: printf_and_update_buffer("Out of range. Try again.\n");
             break;
@@ -364,7 +438,7 @@ static bool check_console_state(repeating_timer_t *repeating_timer){
     }else if (console_disconnected && stdio_usb_connected()){
         console_connected = true;
         console_disconnected = false;
-        multicore_fifo_push_blocking(DUMP_BUFFER_WAKEUP_MESSAGE);
+        server_post_core1_message(DUMP_BUFFER_WAKEUP_MESSAGE);
     }
     return true;
 }
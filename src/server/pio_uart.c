@@ -0,0 +1,328 @@
+/**
+ * @file pio_uart.c
+ * @brief PIO-implemented UART channels for clients beyond the hardware UARTs.
+ *
+ * Each PIO channel owns one TX state machine on its client's pin pair, so
+ * PIO clients never share a transmitter and need no pin muxing. An RX state
+ * machine is attached only while the handshake runs, then released, since the
+ * server never reads from clients after the handshake.
+ *
+ * RX-only listeners let the discovery listen on many candidate RX pins at
+ * once, before any channel exists for them. Passive listeners leave the pin
+ * under SIO control, so the background discovery can also watch the wake-up
+ * lines of connected clients.
+ *
+ * The TX and RX programs are loaded once into every PIO block; channels and
+ * listeners take free state machines from any block.
+ *
+ * @see pio_uart_tx.pio
+ * @see pio_uart_rx.pio
+ * @see server_find_connections()
+ */
+
+#include "hardware/pio.h"
+#include "hardware/gpio.h"
+#include "hardware/clocks.h"
+#include "hardware/irq.h"
+
+#include "server.h"
+#include "pio_uart_tx.pio.h"
+#include "pio_uart_rx.pio.h"
+
+/**
+ * @brief Runtime state of a single PIO UART channel.
+ */
+typedef struct{
+    bool is_open;
+    PIO tx_pio;
+    uint8_t tx_sm;
+    bool has_rx;                ///< An RX state machine is attached (handshake only)
+    PIO rx_pio;
+    uint8_t rx_sm;
+    uart_pin_pair_t pin_pair;
+    uint32_t baudrate;
+}pio_uart_channel_t;
+
+/**
+ * @brief Runtime state of a single RX-only listener.
+ */
+typedef struct{
+    bool is_open;
+    bool is_passive;            ///< Pin function and pulls are left untouched
+    PIO pio;
+    uint8_t sm;
+    uint8_t pin;
+}pio_uart_listener_t;
+
+static pio_uart_channel_t pio_uart_channels[PIO_UART_MAX_CHANNELS];
+static pio_uart_listener_t pio_uart_listeners[PIO_UART_MAX_LISTENERS];
+static uint tx_program_offsets[NUM_PIOS];
+static uint rx_program_offsets[NUM_PIOS];
+static bool programs_loaded = false;
+
+/**
+ * @brief Loads the TX and RX programs into every PIO block, once.
+ */
+static void pio_uart_load_programs(void){
+    if (programs_loaded){
+        return;
+    }
+
+    for (uint pio_index = 0; pio_index < NUM_PIOS; pio_index++){
+        PIO pio = pio_get_instance(pio_index);
+        tx_program_offsets[pio_index] = pio_add_program(pio, &pio_uart_tx_program);
+        rx_program_offsets[pio_index] = pio_add_program(pio, &pio_uart_rx_program);
+    }
+    programs_loaded = true;
+}
+
+/**
+ * @brief Claims a free state machine from any PIO block.
+ *
+ * @param pio Output for the PIO block of the claimed state machine.
+ * @return State machine index, or -1 if every state machine is in use.
+ */
+static int pio_uart_claim_sm(PIO *pio){
+    for (uint pio_index = 0; pio_index < NUM_PIOS; pio_index++){
+        int sm = pio_claim_unused_sm(pio_get_instance(pio_index), false);
+        if (sm >= 0){
+            *pio = pio_get_instance(pio_index);
+            return sm;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Returns the clock divider producing `baudrate` with 8 cycles per bit.
+ */
+static inline float pio_uart_clkdiv(uint32_t baudrate){
+    return (float)clock_get_hz(clk_sys) / (8 * baudrate);
+}
+
+/**
+ * @brief Claims a state machine and starts the RX program on `pin`.
+ *
+ * @param is_passive true to leave the pin's function and pulls untouched.
+ * @return true on success, false if every state machine is in use.
+ */
+static bool pio_uart_rx_start(uint8_t pin, uint32_t baudrate, bool is_passive, PIO *pio, uint8_t *sm){
+    pio_uart_load_programs();
+
+    int claimed_sm = pio_uart_claim_sm(pio);
+    if (claimed_sm < 0){
+        return false;
+    }
+
+    uint offset = rx_program_offsets[pio_get_index(*pio)];
+    if (is_passive){
+        pio_uart_rx_program_start(*pio, claimed_sm, offset, pin, baudrate);
+    }else{
+        pio_uart_rx_program_init(*pio, claimed_sm, offset, pin, baudrate);
+    }
+    *sm = (uint8_t)claimed_sm;
+    return true;
+}
+
+/**
+ * @brief Stops an RX state machine and releases it.
+ *
+ * Unless `is_passive`, also returns `pin` to SIO.
+ */
+static void pio_uart_rx_stop(PIO pio, uint8_t sm, uint8_t pin, bool is_passive){
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_unclaim(pio, sm);
+    if (!is_passive){
+        gpio_disable_pulls(pin);
+        gpio_set_function(pin, GPIO_FUNC_SIO);
+    }
+}
+
+/**
+ * @brief Pops one received byte from an RX state machine.
+ */
+static inline char pio_uart_rx_pop(PIO pio, uint8_t sm){
+    // 8 bits were shifted in from the left, the byte sits in the top of the word
+    return (char)(pio_sm_get(pio, sm) >> 24);
+}
+
+int pio_uart_channel_open(uart_pin_pair_t pin_pair, uint32_t baudrate){
+    pio_uart_load_programs();
+
+    for (uint8_t channel_index = 0; channel_index < PIO_UART_MAX_CHANNELS; channel_index++){
+        pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+        if (channel->is_open){
+            continue;
+        }
+
+        PIO pio;
+        int sm = pio_uart_claim_sm(&pio);
+        if (sm < 0){
+            return -1;
+        }
+
+        pio_uart_tx_program_init(pio, sm, tx_program_offsets[pio_get_index(pio)], pin_pair.tx, baudrate);
+
+        channel->is_open = true;
+        channel->tx_pio = pio;
+        channel->tx_sm = (uint8_t)sm;
+        channel->has_rx = false;
+        channel->pin_pair = pin_pair;
+        channel->baudrate = baudrate;
+        return channel_index;
+    }
+
+    return -1;
+}
+
+void pio_uart_channel_close(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    if (!channel->is_open){
+        return;
+    }
+
+    pio_uart_rx_close(channel_index);
+    pio_sm_set_enabled(channel->tx_pio, channel->tx_sm, false);
+    pio_sm_unclaim(channel->tx_pio, channel->tx_sm);
+    gpio_set_function(channel->pin_pair.tx, GPIO_FUNC_SIO);
+    channel->is_open = false;
+}
+
+bool pio_uart_rx_open(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    if (channel->has_rx){
+        return true;
+    }
+
+    if (!pio_uart_rx_start(channel->pin_pair.rx, channel->baudrate, false, &channel->rx_pio, &channel->rx_sm)){
+        return false;
+    }
+
+    channel->has_rx = true;
+    return true;
+}
+
+void pio_uart_rx_close(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    if (!channel->has_rx){
+        return;
+    }
+
+    pio_uart_rx_stop(channel->rx_pio, channel->rx_sm, channel->pin_pair.rx, false);
+    channel->has_rx = false;
+}
+
+void pio_uart_set_baudrate(uint8_t channel_index, uint32_t baudrate){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+
+    pio_sm_set_clkdiv(channel->tx_pio, channel->tx_sm, pio_uart_clkdiv(baudrate));
+    if (channel->has_rx){
+        pio_sm_set_clkdiv(channel->rx_pio, channel->rx_sm, pio_uart_clkdiv(baudrate));
+    }
+    channel->baudrate = baudrate;
+}
+
+void pio_uart_write_blocking(uint8_t channel_index, const uint8_t *data, size_t length){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    for (size_t i = 0; i < length; i++){
+        pio_sm_put_blocking(channel->tx_pio, channel->tx_sm, data[i]);
+    }
+}
+
+void pio_uart_tx_wait_blocking(uint8_t channel_index){
+    pio_uart_clear_tx_stall(channel_index);
+    while (pio_uart_is_tx_busy(channel_index)){
+        tight_loop_contents();
+    }
+}
+
+bool pio_uart_is_readable(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    return channel->has_rx && !pio_sm_is_rx_fifo_empty(channel->rx_pio, channel->rx_sm);
+}
+
+char pio_uart_getc(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    while (!pio_uart_is_readable(channel_index)){
+        tight_loop_contents();
+    }
+    return pio_uart_rx_pop(channel->rx_pio, channel->rx_sm);
+}
+
+volatile void *pio_uart_get_tx_fifo(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    return &channel->tx_pio->txf[channel->tx_sm];
+}
+
+uint pio_uart_get_tx_dreq(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    return pio_get_dreq(channel->tx_pio, channel->tx_sm, true);
+}
+
+void pio_uart_clear_tx_stall(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    channel->tx_pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + channel->tx_sm);
+}
+
+bool pio_uart_is_tx_busy(uint8_t channel_index){
+    pio_uart_channel_t *channel = &pio_uart_channels[channel_index];
+    bool is_stalled = channel->tx_pio->fdebug & (1u << (PIO_FDEBUG_TXSTALL_LSB + channel->tx_sm));
+    return !pio_sm_is_tx_fifo_empty(channel->tx_pio, channel->tx_sm) || !is_stalled;
+}
+
+int pio_uart_listener_open(uint8_t pin, uint32_t baudrate, bool is_passive){
+    for (uint8_t listener_index = 0; listener_index < PIO_UART_MAX_LISTENERS; listener_index++){
+        pio_uart_listener_t *listener = &pio_uart_listeners[listener_index];
+        if (listener->is_open){
+            continue;
+        }
+
+        if (!pio_uart_rx_start(pin, baudrate, is_passive, &listener->pio, &listener->sm)){
+            return -1;
+        }
+
+        listener->is_open = true;
+        listener->is_passive = is_passive;
+        listener->pin = pin;
+        return listener_index;
+    }
+
+    return -1;
+}
+
+void pio_uart_listener_close(uint8_t listener_index){
+    pio_uart_listener_t *listener = &pio_uart_listeners[listener_index];
+    if (!listener->is_open){
+        return;
+    }
+
+    pio_uart_listener_set_irq_enabled(listener_index, false);
+    pio_uart_rx_stop(listener->pio, listener->sm, listener->pin, listener->is_passive);
+    listener->is_open = false;
+}
+
+bool pio_uart_listener_is_readable(uint8_t listener_index){
+    pio_uart_listener_t *listener = &pio_uart_listeners[listener_index];
+    return listener->is_open && !pio_sm_is_rx_fifo_empty(listener->pio, listener->sm);
+}
+
+char pio_uart_listener_getc(uint8_t listener_index){
+    pio_uart_listener_t *listener = &pio_uart_listeners[listener_index];
+    while (!pio_uart_listener_is_readable(listener_index)){
+        tight_loop_contents();
+    }
+    return pio_uart_rx_pop(listener->pio, listener->sm);
+}
+
+void pio_uart_listener_set_irq_enabled(uint8_t listener_index, bool enabled){
+    pio_uart_listener_t *listener = &pio_uart_listeners[listener_index];
+    pio_set_irqn_source_enabled(listener->pio, 0, pio_get_rx_fifo_not_empty_interrupt_source(listener->sm), enabled);
+}
+
+void pio_uart_listener_set_irq_handler(irq_handler_t handler){
+    for (uint pio_index = 0; pio_index < NUM_PIOS; pio_index++){
+        uint irq_number = pio_get_irq_num(pio_get_instance(pio_index), 0);
+        irq_set_exclusive_handler(irq_number, handler);
+        irq_set_enabled(irq_number, true);
+    }
+}
@@ -2,12 +2,17 @@
  * @file server_side_handshake.c
  * @brief Implements UART server-side handshake logic for detecting and validating client connections.
  *
- * This module handles scanning all configured TX/RX pin pairs across UART0 and UART1
- * to detect connection requests from clients. The server:
- * - Waits for a connection request message from the client.
+ * This module handles scanning all configured TX/RX pin pairs across UART0, UART1
+ * and the PIO UART channels to detect connection requests from clients. All pairs
+ * are listened on in parallel (each hardware UART on one of its pairs, RX-only
+ * PIO listeners on the others), and for each request received the server:
  * - Sends an echo of the client's TX/RX pin pair.
  * - Validates the acknowledgment from the client.
+ * - Negotiates the fastest baud rate both ends can use reliably.
  * - Stores successful connections in a global array.
+ *
+ * The handshake itself is transport-agnostic: it talks to the client through a
+ * `handshake_port_t`, backed either by a hardware UART or by a PIO channel.
  */
 
 #include <stdio.h>
@@ -15,6 +20,8 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "hardware/clocks.h"
+
 #include "server.h"
 #include "functions.h"
 #include "config.h"
@@ -22,46 +29,220 @@
 server_uart_connection_t active_uart_server_connections[MAX_SERVER_CONNECTIONS];
 uint8_t active_server_connections_number = 0;
 uart_pin_pair_t actual_client_to_server_pin_pair;
+static uint32_t actual_client_baudrate;
+/// ID reported in the last acknowledgment, `CLIENT_ID_NONE` for clients that report none.
+static client_id_t actual_client_id;
 
 /**
- * @brief Server-side handshake logic: responds to connection requests and validates client ACK.
+ * @brief Transport used for one handshake attempt.
+ */
+typedef struct{
+    uart_transport_t transport;
+    uart_inst_t *uart_instance;     ///< For `UART_TRANSPORT_HARDWARE`
+    uint8_t pio_channel;            ///< For `UART_TRANSPORT_PIO`
+    uart_inst_t *link_uart;         ///< Hardware UART carrying the link afterwards, NULL for PIO links
+}handshake_port_t;
+
+/**
+ * @brief Sends a text message and waits until it has been transmitted.
+ */
+static void handshake_port_puts(const handshake_port_t *port, const char *message){
+    if (port->transport == UART_TRANSPORT_PIO){
+        pio_uart_write_blocking(port->pio_channel, (const uint8_t *)message, strlen(message));
+        pio_uart_tx_wait_blocking(port->pio_channel);
+    }else{
+        uart_puts(port->uart_instance, message);
+        uart_tx_wait_blocking(port->uart_instance);
+    }
+}
+
+static bool handshake_port_is_readable(const handshake_port_t *port){
+    if (port->transport == UART_TRANSPORT_PIO){
+        return pio_uart_is_readable(port->pio_channel);
+    }
+    return uart_is_readable(port->uart_instance);
+}
+
+static char handshake_port_getc(const handshake_port_t *port){
+    if (port->transport == UART_TRANSPORT_PIO){
+        return pio_uart_getc(port->pio_channel);
+    }
+    return uart_getc(port->uart_instance);
+}
+
+static void handshake_port_set_baudrate(const handshake_port_t *port, uint32_t baudrate){
+    if (port->transport == UART_TRANSPORT_PIO){
+        pio_uart_set_baudrate(port->pio_channel, baudrate);
+    }else{
+        uart_set_baudrate(port->uart_instance, baudrate);
+    }
+}
+
+/**
+ * @brief Reads a message into a buffer until ']', buffer size reached or timeout.
  *
- * - Reads a request of the form "Requesting Connection-[tx,rx]".
- * - Sends back an echo of the pin pair in the format "[tx,rx]".
- * - Waits for and validates the client's ACK: "[Connection Accepted]".
+ * Same behavior as `get_uart_buffer()`, for either transport.
  *
- * @param uart_instance UART interface used for communication.
- * @param timeout_ms Timeout in milliseconds for each stage.
- * @return true if a complete and valid handshake occurs, false otherwise.
+ * @param port Handshake port to read from.
+ * @param buf Output buffer, always null-terminated.
+ * @param buffer_size Size of `buf`.
+ * @param timeout_ms Timeout in milliseconds.
+ */
+static void handshake_port_read(const handshake_port_t *port, char *buf, uint8_t buffer_size, uint32_t timeout_ms){
+    absolute_time_t start_time = get_absolute_time();
+    uint8_t idx = 0;
+    uint32_t timeout_us = timeout_ms * MS_TO_US_MULTIPLIER;
+
+    if (handshake_port_is_readable(port)){
+        handshake_port_getc(port);
+    }
+
+    while (absolute_time_diff_us(start_time, get_absolute_time()) < timeout_us){
+        if (handshake_port_is_readable(port)){
+            char c = handshake_port_getc(port);
+            if (idx < buffer_size - 1){
+                buf[idx++] = c;
+            }
+            else{
+                break;
+            }
+
+            if (c == ']'){
+                break;
+            }
+        }
+    }
+
+    buf[idx] = '\0';
+}
+
+/**
+ * @brief Tries one baud rate with the client: propose, switch, probe, confirm.
+ *
+ * - Sends "[Set Baud-<rate>]" at the handshake baud rate and switches to `baudrate`.
+ * - Sends "[Probe-<rate>]" and expects the client to echo it back.
+ * - On a valid echo, sends "[Baud Confirmed]" and keeps the new rate.
+ * - Otherwise switches back to `DEFAULT_BAUDRATE` and waits until the client
+ *   has timed out and switched back too.
+ *
+ * @param port Handshake port used for communication.
+ * @param baudrate Candidate baud rate.
+ * @return true if the client confirmed the rate, false otherwise.
+ */
+static bool server_try_baudrate(const handshake_port_t *port, uint32_t baudrate){
+    char message[32];
+    char buf[32] = {0};
+    uint32_t echoed_baudrate = 0;
+
+    snprintf(message, sizeof(message), "[%s-%lu]", BAUDRATE_PROPOSAL_MESSAGE, (unsigned long)baudrate);
+    handshake_port_puts(port, message);
+
+    handshake_port_set_baudrate(port, baudrate);
+    sleep_ms(BAUDRATE_SWITCH_DELAY_MS);
+    while (handshake_port_is_readable(port)){
+        handshake_port_getc(port);
+    }
+
+    snprintf(message, sizeof(message), "[%s-%lu]", BAUDRATE_PROBE_MESSAGE, (unsigned long)baudrate);
+    handshake_port_puts(port, message);
+
+    handshake_port_read(port, buf, sizeof(buf), BAUDRATE_STEP_TIMEOUT_MS);
+    if (get_message_number(buf, BAUDRATE_PROBE_MESSAGE, &echoed_baudrate) && echoed_baudrate == baudrate){
+        handshake_port_puts(port, "[" BAUDRATE_CONFIRMED_MESSAGE "]");
+        return true;
+    }
+
+    handshake_port_set_baudrate(port, DEFAULT_BAUDRATE);
+    sleep_ms(2 * BAUDRATE_STEP_TIMEOUT_MS + BAUDRATE_SWITCH_DELAY_MS);
+    return false;
+}
+
+/**
+ * @brief Agrees on the fastest baud rate the link supports.
+ *
+ * Reads the client's capability "[Max Baud-<rate>]" and tries every entry of
+ * `negotiable_baudrates`, fastest first, that both ends can generate and that
+ * does not exceed `MAX_NEGOTIATED_BAUDRATE`. Clients that do not advertise a
+ * capability keep `DEFAULT_BAUDRATE`.
+ *
+ * PIO channels run at 8 cycles per bit from clk_sys, so they are checked
+ * against clk_sys / 8; links that end up on a hardware UART are also checked
+ * against the UART's clk_peri / 16, even when negotiated through PIO.
+ *
+ * @param port Handshake port used for communication.
+ * @return The agreed baud rate, the port is left running at this rate.
  */
-static bool server_uart_read(uart_inst_t* uart_instance, uint32_t timeout_ms){
+static uint32_t server_negotiate_baudrate(const handshake_port_t *port){
     char buf[32] = {0};
+    uint32_t client_max_baudrate = 0;
+    uint32_t peri_hz = clock_get_hz(clk_peri);
+
+    handshake_port_read(port, buf, sizeof(buf), BAUDRATE_STEP_TIMEOUT_MS);
+    if (!get_message_number(buf, BAUDRATE_CAPABILITY_MESSAGE, &client_max_baudrate)){
+        return DEFAULT_BAUDRATE;
+    }
+
+    for (uint8_t index = 0; index < NEGOTIABLE_BAUDRATES_LEN; index++){
+        uint32_t baudrate = negotiable_baudrates[index];
+        if (baudrate > client_max_baudrate || baudrate > MAX_NEGOTIATED_BAUDRATE){
+            continue;
+        }
+        if (port->link_uart && !uart_baudrate_is_reachable(peri_hz, baudrate)){
+            continue;
+        }
+        if (port->transport == UART_TRANSPORT_PIO && clock_get_hz(clk_sys) / 8 < baudrate){
+            continue;
+        }
+
+        if (server_try_baudrate(port, baudrate)){
+            return baudrate;
+        }
+    }
+
+    return DEFAULT_BAUDRATE;
+}
+
+/**
+ * @brief Server-side handshake logic once a connection request has been received.
+ *
+ * - Sends back an echo of the requested pin pair in the format "[tx,rx]".
+ * - Waits for and validates the client's ACK: "[Connection Accepted-<client ID>]",
+ *   or "[Connection Accepted]" from clients that report no ID.
+ * - Negotiates the link baud rate (see `server_negotiate_baudrate()`).
+ *
+ * @param port Handshake port used for communication.
+ * @param request Received request of the form "Requesting Connection-[tx,rx]".
+ * @param timeout_ms Timeout in milliseconds for the ACK.
+ * @return true if a complete and valid handshake occurs, false otherwise.
+ */
+static bool server_complete_handshake(const handshake_port_t *port, const char *request, uint32_t timeout_ms){
     uint8_t received_number_pair[2] = {0};
-    
-    get_uart_buffer(uart_instance, buf, sizeof(buf), timeout_ms);
 
     uint8_t received_tx_number;
     uint8_t received_rx_number;
-    if (strlen(buf) > 1){
-        get_number_pair(received_number_pair, buf);
+    if (strlen(request) > 1){
+        get_number_pair(received_number_pair, (char *)request);
         received_tx_number = received_number_pair[0];
         received_rx_number = received_number_pair[1];
 
         char received_pair[8];
         snprintf(received_pair, sizeof(received_pair), "[%d,%d]", received_tx_number, received_rx_number);
-        uart_puts(uart_instance, received_pair);
-        uart_tx_wait_blocking(uart_instance);
+        handshake_port_puts(port, received_pair);
     }
     else{
         return false;
     }
 
-    char ack_buf[32] = {0};
-    get_uart_buffer(uart_instance, ack_buf, sizeof(ack_buf), timeout_ms);
+    char ack_buf[48] = {0};
+    handshake_port_read(port, ack_buf, sizeof(ack_buf), timeout_ms);
 
-    if (strcmp(ack_buf, "[" CONNECTION_ACCEPTED_MESSAGE "]") == 0){
+    client_id_t client_id = CLIENT_ID_NONE;
+    if (strcmp(ack_buf, "[" CONNECTION_ACCEPTED_MESSAGE "]") == 0 ||
+        get_message_hex_number(ack_buf, CONNECTION_ACCEPTED_MESSAGE, &client_id)){
+        actual_client_id = client_id;
         actual_client_to_server_pin_pair.tx = received_tx_number;
         actual_client_to_server_pin_pair.rx = received_rx_number;
+        actual_client_baudrate = server_negotiate_baudrate(port);
         return true;
     }
 
@@ -69,77 +250,431 @@ static bool server_uart_read(uart_inst_t* uart_instance, uint32_t timeout_ms){
 }
 
 /**
- * @brief Initializes UART on the specified pin pair and attempts to detect a connection request.
- *
- * This function is used to check whether a client is attempting to connect on the given TX/RX pin pair.
+ * @brief Returns the ID of the client just handshaken on `pin_pair`.
  *
- * @param pin_pair The TX/RX pin pair to test.
- * @param uart_instance Pointer to the UART peripheral (e.g., uart0 or uart1).
- * @return true if a connection request is successfully detected, false otherwise.
+ * Clients that reported none are identified by the pin pair.
  */
-static bool server_check_pin_pair(uart_pin_pair_t pin_pair, uart_inst_t * uart_instance){
-    uart_init_with_pins(uart_instance, pin_pair, DEFAULT_BAUDRATE);
-    return server_uart_read(uart_instance, SERVER_TIMEOUT_MS);
+static client_id_t server_get_actual_client_id(uart_pin_pair_t pin_pair){
+    return actual_client_id != CLIENT_ID_NONE ? actual_client_id : server_legacy_client_id(pin_pair);
 }
 
 /**
- * @brief Adds a valid UART connection (pin pair + UART instance) to the active connections list.
+ * @brief Adds a valid connection to the active connections list.
  *
  * Only adds the connection if there is room in the `active_uart_server_connections` array.
  *
  * @param pin_pair The TX/RX pin pair that was successfully connected.
- * @param uart_instance Pointer to the UART peripheral associated with the connection.
+ * @param uart_instance Pointer to the UART peripheral, NULL for PIO connections.
+ * @param transport Peripheral carrying the link.
+ * @param pio_channel PIO UART channel, ignored for hardware connections.
  */
-static inline void server_add_active_pair(uart_pin_pair_t pin_pair, uart_inst_t * uart_instance){
+static inline void server_add_active_pair(uart_pin_pair_t pin_pair, uart_inst_t * uart_instance, uart_transport_t transport, uint8_t pio_channel){
     if (active_server_connections_number < MAX_SERVER_CONNECTIONS) {
         active_uart_server_connections[active_server_connections_number].pin_pair = pin_pair;
         active_uart_server_connections[active_server_connections_number].uart_instance = uart_instance;
+        active_uart_server_connections[active_server_connections_number].transport = transport;
+        active_uart_server_connections[active_server_connections_number].pio_channel = pio_channel;
         active_uart_server_connections[active_server_connections_number].uart_pin_pair_from_client_to_server.tx = actual_client_to_server_pin_pair.tx;
         active_uart_server_connections[active_server_connections_number].uart_pin_pair_from_client_to_server.rx = actual_client_to_server_pin_pair.rx;
+        active_uart_server_connections[active_server_connections_number].baudrate = actual_client_baudrate;
+        active_uart_server_connections[active_server_connections_number].client_id = server_get_actual_client_id(pin_pair);
         active_server_connections_number++;
     }
 }
 
 /**
- * @brief Scans all UART0 pin pairs for active connection requests.
+ * @brief A pin pair the discovery listens on for connection requests.
+ */
+typedef struct{
+    uart_pin_pair_t pin_pair;
+    uart_inst_t *uart_instance;     ///< Hardware UART of the pair, NULL for PIO pairs
+    bool is_connected;              ///< A client completed the handshake on this pair
+    bool is_covered;                ///< Listened on for a whole window during this scan
+    bool has_listener;              ///< A listener is attached in the current window
+}discovery_candidate_t;
+
+/**
+ * @brief Receiver attached to the RX pin of one candidate during a discovery window.
+ */
+typedef struct{
+    bool is_active;
+    uint8_t candidate_index;
+    uart_transport_t transport;     ///< Hardware: the pair's own UART, PIO: an RX-only PIO listener
+    uint8_t pio_listener;
+    char buf[32];                   ///< Request received so far
+    uint8_t length;
+}discovery_listener_t;
+
+static discovery_candidate_t discovery_candidates[MAX_SERVER_CONNECTIONS];
+static uint8_t discovery_candidates_number = 0;
+static discovery_listener_t discovery_listeners[MAX_SERVER_CONNECTIONS];
+static uint8_t discovery_listeners_number = 0;
+
+/**
+ * @brief Returns true if a client is already connected on `pin_pair`.
+ */
+static bool server_pair_is_connected(uart_pin_pair_t pin_pair){
+    for (uint8_t index = 0; index < active_server_connections_number; index++){
+        if (active_uart_server_connections[index].pin_pair.tx == pin_pair.tx){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Appends pin pairs to the discovery candidates.
+ *
+ * @param pin_pairs Pin pairs to add.
+ * @param pin_pairs_len Number of pin pairs.
+ * @param uart_instance Hardware UART of the pairs, NULL for PIO pairs.
+ */
+static void server_discovery_add_candidates(const uart_pin_pair_t *pin_pairs, uint8_t pin_pairs_len, uart_inst_t *uart_instance){
+    for (uint8_t index = 0; index < pin_pairs_len; index++){
+        discovery_candidate_t *candidate = &discovery_candidates[discovery_candidates_number++];
+        candidate->pin_pair = pin_pairs[index];
+        candidate->uart_instance = uart_instance;
+        candidate->is_connected = server_pair_is_connected(pin_pairs[index]);
+        candidate->is_covered = false;
+        candidate->has_listener = false;
+    }
+}
+
+static inline bool server_discovery_is_pending(const discovery_candidate_t *candidate){
+    return !candidate->is_connected && !candidate->is_covered && !candidate->has_listener;
+}
+
+static void server_discovery_add_listener(uint8_t candidate_index, uart_transport_t transport, uint8_t pio_listener){
+    discovery_listener_t *listener = &discovery_listeners[discovery_listeners_number++];
+    listener->is_active = true;
+    listener->candidate_index = candidate_index;
+    listener->transport = transport;
+    listener->pio_listener = pio_listener;
+    listener->length = 0;
+    discovery_candidates[candidate_index].has_listener = true;
+}
+
+/**
+ * @brief Detaches a listener and releases its receiver.
+ *
+ * The candidate stays uncovered, so it is listened on again in a later window.
+ */
+static void server_discovery_detach(discovery_listener_t *listener){
+    discovery_candidate_t *candidate = &discovery_candidates[listener->candidate_index];
+
+    if (listener->transport == UART_TRANSPORT_PIO){
+        pio_uart_listener_close(listener->pio_listener);
+    }else{
+        reset_gpio_pins(candidate->pin_pair);
+    }
+    listener->is_active = false;
+    candidate->has_listener = false;
+}
+
+/**
+ * @brief Attaches a listener to as many pending candidates as receivers allow.
  *
- * For each TX/RX pair configured for UART0, this function attempts to perform a handshake.
- * If the handshake is successful, the connection is stored.
+ * Each hardware UART listens on one of its own pairs, since a request heard
+ * there can be answered without re-routing. Every other pending pair gets an
+ * RX-only PIO listener while free state machines last.
  */
-static void server_check_connections_for_uart0_instance(void){
-    for (uint8_t index = 0; index < PIN_PAIRS_UART0_LEN; index++){
-        if(server_check_pin_pair(pin_pairs_uart0[index], uart0)){
-            server_add_active_pair(pin_pairs_uart0[index], uart0);
+static void server_discovery_attach_listeners(void){
+    discovery_listeners_number = 0;
+
+    for (uint8_t uart_index = 0; uart_index < NUM_UARTS; uart_index++){
+        uart_inst_t *uart_instance = uart_get_instance(uart_index);
+        for (uint8_t index = 0; index < discovery_candidates_number; index++){
+            if (discovery_candidates[index].uart_instance == uart_instance && server_discovery_is_pending(&discovery_candidates[index])){
+                uart_init_with_pins(uart_instance, discovery_candidates[index].pin_pair, DEFAULT_BAUDRATE);
+                server_discovery_add_listener(index, UART_TRANSPORT_HARDWARE, 0);
+                break;
+            }
+        }
+    }
+
+    for (uint8_t index = 0; index < discovery_candidates_number; index++){
+        if (!server_discovery_is_pending(&discovery_candidates[index])){
+            continue;
+        }
+
+        int pio_listener = pio_uart_listener_open(discovery_candidates[index].pin_pair.rx, DEFAULT_BAUDRATE, false);
+        if (pio_listener < 0){
+            break;
+        }
+        server_discovery_add_listener(index, UART_TRANSPORT_PIO, (uint8_t)pio_listener);
+    }
+}
+
+/**
+ * @brief Releases the hardware UART listener of `uart_instance`, if any.
+ */
+static void server_discovery_release_uart_listener(uart_inst_t *uart_instance){
+    for (uint8_t index = 0; index < discovery_listeners_number; index++){
+        discovery_listener_t *listener = &discovery_listeners[index];
+        if (listener->is_active && listener->transport == UART_TRANSPORT_HARDWARE &&
+            discovery_candidates[listener->candidate_index].uart_instance == uart_instance){
+            server_discovery_detach(listener);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Releases one PIO listener, freeing a state machine for a handshake.
+ *
+ * @return true if a listener was released, false if none is left.
+ */
+static bool server_discovery_release_pio_listener(void){
+    for (uint8_t index = discovery_listeners_number; index > 0; index--){
+        discovery_listener_t *listener = &discovery_listeners[index - 1];
+        if (listener->is_active && listener->transport == UART_TRANSPORT_PIO){
+            server_discovery_detach(listener);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Moves received bytes into the listener buffer.
+ *
+ * Bytes are kept up to a closing ']'. A message that does not contain
+ * `CONNECTION_REQUEST_MESSAGE` is dropped.
+ *
+ * @return true once a complete connection request is in `listener->buf`.
+ */
+static bool server_discovery_poll(discovery_listener_t *listener){
+    discovery_candidate_t *candidate = &discovery_candidates[listener->candidate_index];
+
+    while (true){
+        char c;
+        if (listener->transport == UART_TRANSPORT_PIO){
+            if (!pio_uart_listener_is_readable(listener->pio_listener)) return false;
+            c = pio_uart_listener_getc(listener->pio_listener);
+        }else{
+            if (!uart_is_readable(candidate->uart_instance)) return false;
+            c = uart_getc(candidate->uart_instance);
+        }
+
+        if (listener->length >= sizeof(listener->buf) - 1){
+            listener->length = 0;
+        }
+        listener->buf[listener->length++] = c;
+
+        if (c == ']'){
+            listener->buf[listener->length] = '\0';
+            listener->length = 0;
+            if (strstr(listener->buf, CONNECTION_REQUEST_MESSAGE)){
+                return true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Drops everything the active listeners received so far.
+ *
+ * Used after a handshake: requests that arrived meanwhile may have overflowed
+ * a receive FIFO, and their clients send them again anyway.
+ */
+static void server_discovery_flush_listeners(void){
+    for (uint8_t index = 0; index < discovery_listeners_number; index++){
+        discovery_listener_t *listener = &discovery_listeners[index];
+        if (!listener->is_active){
+            continue;
+        }
+
+        if (listener->transport == UART_TRANSPORT_PIO){
+            while (pio_uart_listener_is_readable(listener->pio_listener)){
+                pio_uart_listener_getc(listener->pio_listener);
+            }
+        }else{
+            uart_inst_t *uart_instance = discovery_candidates[listener->candidate_index].uart_instance;
+            while (uart_is_readable(uart_instance)){
+                uart_getc(uart_instance);
+            }
+        }
+        listener->length = 0;
+    }
+}
+
+/**
+ * @brief Completes the handshake for a request heard by a listener.
+ *
+ * - Hardware pairs are answered through their own UART. If the request was
+ *   heard by a PIO listener, the UART is taken from the pair it listened on.
+ * - PIO pairs get a PIO channel, plus an RX state machine for the
+ *   handshake, released from another listener if none is free.
+ *
+ * The candidate is covered afterwards, whatever the outcome.
+ */
+static void server_discovery_handshake(discovery_listener_t *listener){
+    discovery_candidate_t *candidate = &discovery_candidates[listener->candidate_index];
+    char request[sizeof(listener->buf)];
+    bool is_connected = false;
+
+    memcpy(request, listener->buf, sizeof(request));
+    candidate->is_covered = true;
+
+    if (candidate->uart_instance){
+        handshake_port_t port = {.transport = UART_TRANSPORT_HARDWARE, .uart_instance = candidate->uart_instance, .link_uart = candidate->uart_instance};
+
+        if (listener->transport == UART_TRANSPORT_PIO){
+            server_discovery_detach(listener);
+            server_discovery_release_uart_listener(candidate->uart_instance);
+            uart_init_with_pins(candidate->uart_instance, candidate->pin_pair, DEFAULT_BAUDRATE);
+        }else{
+            listener->is_active = false;
+            candidate->has_listener = false;
+        }
+
+        is_connected = server_complete_handshake(&port, request, SERVER_TIMEOUT_MS);
+        if (is_connected){
+            server_add_active_pair(candidate->pin_pair, candidate->uart_instance, UART_TRANSPORT_HARDWARE, 0);
+        }
+        reset_gpio_pins(candidate->pin_pair);
+    }else{
+        server_discovery_detach(listener);
+
+        int channel = pio_uart_channel_open(candidate->pin_pair, DEFAULT_BAUDRATE);
+        while (channel >= 0 && !pio_uart_rx_open(channel)){
+            if (!server_discovery_release_pio_listener()){
+                pio_uart_channel_close(channel);
+                channel = -1;
+            }
+        }
+        if (channel < 0){
+            return;
+        }
+
+        handshake_port_t port = {.transport = UART_TRANSPORT_PIO, .pio_channel = (uint8_t)channel};
+        is_connected = server_complete_handshake(&port, request, SERVER_TIMEOUT_MS);
+        pio_uart_rx_close(channel);
+
+        if (is_connected){
+            server_add_active_pair(candidate->pin_pair, NULL, UART_TRANSPORT_PIO, (uint8_t)channel);
+        }else{
+            pio_uart_channel_close(channel);
         }
-        reset_gpio_pins(pin_pairs_uart0[index]);
     }
+
+    candidate->is_connected = is_connected;
 }
 
 /**
- * @brief Scans all UART1 pin pairs for active connection requests.
+ * @brief Listens on a batch of candidates at once for one window.
  *
- * Similar to UART0 scanning, this function iterates over all UART1 TX/RX pairs
- * and performs handshake attempts.
+ * Handshakes are completed as soon as a request arrives; the time they take
+ * extends the window, so the other listeners still get a whole window.
+ * Candidates whose listener lasted the whole window are covered.
+ *
+ * @param window_ms Length of the window in milliseconds.
  */
-static void server_check_connections_for_uart1_instance(void){
-    for (uint8_t index = 0; index < PIN_PAIRS_UART1_LEN; index++){
-        if(server_check_pin_pair(pin_pairs_uart1[index], uart1)){
-            server_add_active_pair(pin_pairs_uart1[index], uart1);
+static void server_discovery_run_window(uint32_t window_ms){
+    server_discovery_attach_listeners();
+
+    if (!discovery_listeners_number){
+        // No receiver left for the remaining pairs during this scan
+        for (uint8_t index = 0; index < discovery_candidates_number; index++){
+            discovery_candidates[index].is_covered = true;
+        }
+        return;
+    }
+
+    absolute_time_t deadline = make_timeout_time_ms(window_ms);
+    while (!time_reached(deadline)){
+        for (uint8_t index = 0; index < discovery_listeners_number; index++){
+            discovery_listener_t *listener = &discovery_listeners[index];
+            if (!listener->is_active || !server_discovery_poll(listener)){
+                continue;
+            }
+
+            absolute_time_t handshake_start = get_absolute_time();
+            server_discovery_handshake(listener);
+            server_discovery_flush_listeners();
+            deadline = delayed_by_us(deadline, absolute_time_diff_us(handshake_start, get_absolute_time()));
+        }
+    }
+
+    for (uint8_t index = 0; index < discovery_listeners_number; index++){
+        discovery_listener_t *listener = &discovery_listeners[index];
+        if (listener->is_active){
+            discovery_candidates[listener->candidate_index].is_covered = true;
+            server_discovery_detach(listener);
         }
-        reset_gpio_pins(pin_pairs_uart1[index]);
     }
 }
 
+static bool server_discovery_has_pending_candidates(void){
+    for (uint8_t index = 0; index < discovery_candidates_number; index++){
+        if (server_discovery_is_pending(&discovery_candidates[index])){
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
- * @brief Initiates the scanning process for both UART0 and UART1.
+ * @brief Listens on all UART0, UART1 and PIO pin pairs for connection requests.
  *
- * Calls the UART0 and UART1 connection checkers to identify all valid connections.
+ * Instead of probing one pair per `SERVER_TIMEOUT_MS` window, every pair that
+ * has a free receiver is listened on during the same window, and windows are
+ * repeated until every pair has been covered once. With enough receivers a
+ * scan takes a single window plus the handshakes themselves.
  */
 bool server_find_connections(void){
-    server_check_connections_for_uart0_instance();
-    server_check_connections_for_uart1_instance();
+    discovery_candidates_number = 0;
+    server_discovery_add_candidates(pin_pairs_uart0, PIN_PAIRS_UART0_LEN, uart0);
+    server_discovery_add_candidates(pin_pairs_uart1, PIN_PAIRS_UART1_LEN, uart1);
+    server_discovery_add_candidates(pin_pairs_pio, PIN_PAIRS_PIO_LEN, NULL);
+
+    while (server_discovery_has_pending_candidates()){
+        server_discovery_run_window(SERVER_TIMEOUT_MS);
+    }
 
     if (active_server_connections_number) return true;
 
     return false;
 }
+
+bool server_reconnect_known_clients(void){
+    if (!server_state_is_valid()){
+        return false;
+    }
+
+    const server_persistent_state_t *server_persistent_state = server_state_get();
+    discovery_candidates_number = 0;
+    for (uint8_t index = 0; index < server_persistent_state->clients_number; index++){
+        const client_t *client = &server_persistent_state->clients[index];
+        if (client->topology.is_known && discovery_candidates_number < MAX_SERVER_CONNECTIONS){
+            server_discovery_add_candidates(&client->uart_connection.pin_pair, 1, client->uart_connection.uart_instance);
+        }
+    }
+    if (!discovery_candidates_number){
+        return false;
+    }
+
+    while (server_discovery_has_pending_candidates()){
+        server_discovery_run_window(SERVER_RECONNECT_TIMEOUT_MS);
+    }
+
+    for (uint8_t index = 0; index < discovery_candidates_number; index++){
+        if (!discovery_candidates[index].is_connected){
+            return false;
+        }
+    }
+    return true;
+}
+
+bool server_complete_pio_handshake(uint8_t pio_channel, uart_inst_t *link_uart, const char *request, server_uart_connection_t *connection){
+    handshake_port_t port = {.transport = UART_TRANSPORT_PIO, .pio_channel = pio_channel, .link_uart = link_uart};
+
+    if (!server_complete_handshake(&port, request, SERVER_TIMEOUT_MS)){
+        return false;
+    }
+
+    connection->uart_pin_pair_from_client_to_server = actual_client_to_server_pin_pair;
+    connection->baudrate = actual_client_baudrate;
+    connection->client_id = server_get_actual_client_id(connection->pin_pair);
+    return true;
+}
@@ -3,8 +3,11 @@
  * @brief Handles configuration management and device state updates for connected UART clients.
  *
  * This module provides functionality to:
- * - Send GPIO state updates to individual clients
- * - Save and load preset configurations for each client
+ * - Sync GPIO state changes to individual clients
+ * - Apply device changes staged across several clients as one transaction:
+ *   one frame per client and one flash commit
+ * - Save and load preset configurations for each client, taking a preset set
+ *   from the registry's pool on first use and giving it back once all are reset
  * - Reset running or preset client configurations
  * - Apply user input to modify preset configurations
  *
@@ -21,53 +24,125 @@
 #include "server.h"
 #include "input.h"
 
+static_assert(MAX_REGISTERED_CLIENTS <= 32, "Staged clients are tracked in a 32-bit mask");
+static_assert(MAX_NUMBER_OF_GPIOS <= 32, "Staged devices are tracked in a 32-bit mask");
+
+void server_set_device_state_and_update_flash(uint8_t device_index, bool device_state, uint32_t flash_client_index){
+    server_persistent_state_t *state = server_state_begin_edit();
+    client_state_t *running_client_state = &state->clients[flash_client_index].running_client_state;
+    client_state_set(running_client_state, device_index, device_state);
+    server_state_end_edit();
+
+    uint8_t active_client_index = server_active_index_of_flash(flash_client_index);
+    if (active_client_index != CLIENT_INDEX_NOT_CONNECTED){
+        server_sync_client_state(active_client_index, running_client_state);
+    }
+}
+
+void server_update_dormant_state(uint8_t active_client_index, const client_t *client){
+    if (!client_has_active_devices(client)){
+        send_dormant_flag_to_client(active_client_index);
+        active_uart_server_connections[active_client_index].is_dormant = true;
+    }else{
+        active_uart_server_connections[active_client_index].is_dormant = false;
+    }
+}
+
+void server_device_transaction_begin(server_device_transaction_t *transaction){
+    memset(transaction, 0, sizeof(*transaction));
+}
+
+bool server_device_transaction_stage(server_device_transaction_t *transaction, uint32_t flash_client_index, uint8_t device_index, bool device_state){
+    if (flash_client_index >= MAX_REGISTERED_CLIENTS || device_index >= MAX_NUMBER_OF_GPIOS){
+        return false;
+    }
+
+    uint32_t bit = 1u << device_index;
+
+    if (device_state){
+        transaction->on_masks[flash_client_index] |= bit;
+        transaction->off_masks[flash_client_index] &= ~bit;
+    }else{
+        transaction->off_masks[flash_client_index] |= bit;
+        transaction->on_masks[flash_client_index] &= ~bit;
+    }
+    transaction->staged_clients |= 1u << flash_client_index;
+    return true;
+}
+
 /**
- * @brief Sends the current state of a GPIO to a client device via UART.
- *
- * Wakes up the specified client using a TX pulse and then sends a message
- * representing the GPIO number and its current state (ON or OFF) in the format "[N,S]",
- * where `N` is the GPIO number and `S` is 1 (ON) or 0 (OFF).
+ * @brief Returns the ON mask of `client_state` once the staged changes of a client are applied.
  *
- * @param pin_pair            UART TX/RX pin pair used for the target client.
- * @param uart                Pointer to the UART instance used for transmission.
- * @param gpio_number         The GPIO number whose state is being sent.
- * @param is_on               The current state of the GPIO (`true` for ON, `false` for OFF).
- * @param state               Pointer to the global server persistent state (used to access client status).
- * @param flash_client_index  Index of the client in the persistent state table.
- *
- * @note This function uses `send_wakeup_if_dormant()` before sending the state,
- *       ensuring the client is awake before communication.
- *
- * @see send_wakeup_if_dormant()
- * @see send_uart_message_safe()
+ * Devices reserved for the UART link stay OFF.
  */
-static void server_send_device_state(uart_pin_pair_t pin_pair, uart_inst_t* uart, uint8_t gpio_number, bool is_on, server_persistent_state_t *const state, uint32_t flash_client_index){
-    send_wakeup_if_dormant(flash_client_index, state, pin_pair, uart);
+static uint32_t server_device_transaction_on_mask(const server_device_transaction_t *transaction, uint32_t flash_client_index, const client_state_t *client_state){
+    return ((client_state->on_mask & ~transaction->off_masks[flash_client_index]) |
+        transaction->on_masks[flash_client_index]) & ~client_state->reserved_mask;
+}
 
-    char msg[8];
-    snprintf(msg, sizeof(msg), "[%d,%d]", gpio_number, is_on);
-    send_uart_message_safe(uart, pin_pair, msg);
+client_state_t server_device_transaction_preview(const server_device_transaction_t *transaction, uint32_t flash_client_index){
+    client_state_t client_state = server_state_get()->clients[flash_client_index].running_client_state;
+    client_state.on_mask = server_device_transaction_on_mask(transaction, flash_client_index, &client_state);
+    return client_state;
 }
 
-void server_set_device_state_and_update_flash(uart_pin_pair_t pin_pair, uart_inst_t* uart_instance, uint8_t gpio_index, bool device_state, uint32_t flash_client_index){
-    server_persistent_state_t state_copy;
-    memcpy(&state_copy, (const server_persistent_state_t *)SERVER_FLASH_ADDR, sizeof(state_copy));
+uint8_t server_device_transaction_commit(const server_device_transaction_t *transaction){
+    uint32_t changed_clients = 0;
+
+    server_persistent_state_t *state = server_state_begin_edit();
+    for (uint32_t staged = transaction->staged_clients; staged; staged &= staged - 1){
+        uint8_t flash_client_index = __builtin_ctz(staged);
+        if (flash_client_index >= state->clients_number){
+            continue;
+        }
+
+        client_state_t *running_client_state = &state->clients[flash_client_index].running_client_state;
+        uint32_t on_mask = server_device_transaction_on_mask(transaction, flash_client_index, running_client_state);
+        if (on_mask != running_client_state->on_mask){
+            running_client_state->on_mask = on_mask;
+            changed_clients |= 1u << flash_client_index;
+        }
+    }
+    server_state_end_edit();
+
+    if (!changed_clients){
+        return 0;
+    }
+
+    for (uint32_t changed = changed_clients; changed; changed &= changed - 1){
+        uint8_t flash_client_index = __builtin_ctz(changed);
+        uint8_t active_client_index = server_active_index_of_flash(flash_client_index);
+        if (active_client_index == CLIENT_INDEX_NOT_CONNECTED){
+            // Pushed with the rest of its state when it connects
+            continue;
+        }
+        server_sync_client_state(active_client_index, &state->clients[flash_client_index].running_client_state);
+        server_update_dormant_state(active_client_index, &state->clients[flash_client_index]);
+    }
+
+    server_state_flush();
+    return (uint8_t)__builtin_popcount(changed_clients);
+}
 
-    server_send_device_state(pin_pair, uart_instance, gpio_index, device_state, &state_copy, flash_client_index);
-    state_copy.clients[flash_client_index].running_client_state.devices[gpio_index > 22 ? (gpio_index - 3) : (gpio_index)].is_on = device_state;
-    save_server_state(&state_copy);
+/**
+ * @brief Tells the user that no preset set is left in the pool.
+ */
+static void server_print_preset_pool_exhausted(void){
+    printf_and_update_buffer("\nNo preset storage left: reset the presets of another client first.\n");
 }
 
 void save_running_configuration_into_preset_configuration(uint32_t flash_configuration_index, uint32_t flash_client_index){
-    server_persistent_state_t state;
-    load_server_state(&state);
+    server_persistent_state_t *state = server_state_begin_edit();
+    client_state_t *preset = server_client_edit_preset(state, flash_client_index, flash_configuration_index);
+    if (preset){
+        *preset = state->clients[flash_client_index].running_client_state;
+    }
+    server_state_end_edit();
 
-    memcpy(
-        &state.clients[flash_client_index].preset_configs[flash_configuration_index],
-        &state.clients[flash_client_index].running_client_state,
-        sizeof(client_state_t));
-    
-    save_server_state(&state);
+    if (!preset){
+        server_print_preset_pool_exhausted();
+        return;
+    }
 
     char string[BUFFER_MAX_STRING_SIZE];
     snprintf(string, sizeof(string), "\nConfiguration saved in Preset[%u].\n", flash_configuration_index + 1);
@@ -75,26 +150,14 @@ void save_running_configuration_into_preset_configuration(uint32_t flash_configu
 }
 
 void load_configuration_into_running_state(uint32_t flash_configuration_index, uint32_t flash_client_index){
-    server_persistent_state_t state;
-    load_server_state(&state);
-
-    memcpy(
-        &state.clients[flash_client_index].running_client_state,
-        &state.clients[flash_client_index].preset_configs[flash_configuration_index],
-        sizeof(client_state_t));
-
-    server_send_client_state(state.clients[flash_client_index].uart_connection.pin_pair,
-                            state.clients[flash_client_index].uart_connection.uart_instance,
-                            &state.clients[flash_client_index].running_client_state);
-    save_server_state(&state);
-
-    
-    uint8_t active_client_index = get_active_client_connection_index_from_flash_client_index(flash_client_index, state);
-    if (!client_has_active_devices(state.clients[flash_client_index])){
-        send_dormant_flag_to_client(active_client_index);
-        active_uart_server_connections[active_client_index].is_dormant = true;
-    }else{
-        active_uart_server_connections[active_client_index].is_dormant = false;
+    server_persistent_state_t *state = server_state_begin_edit();
+    state->clients[flash_client_index].running_client_state = server_client_get_preset(state, flash_client_index, flash_configuration_index);
+    server_state_end_edit();
+
+    uint8_t active_client_index = server_active_index_of_flash(flash_client_index);
+    if (active_client_index != CLIENT_INDEX_NOT_CONNECTED){
+        server_sync_client_state(active_client_index, &state->clients[flash_client_index].running_client_state);
+        server_update_dormant_state(active_client_index, &state->clients[flash_client_index]);
     }
 
     char string[BUFFER_MAX_STRING_SIZE];
@@ -103,15 +166,15 @@ void load_configuration_into_running_state(uint32_t flash_configuration_index, u
 }
 
 void set_configuration_devices(uint32_t flash_client_index, uint32_t flash_configuration_index, input_client_data_t *input_client_data){
-    server_persistent_state_t state;
-    load_server_state(&state);
+    const server_persistent_state_t *state = server_state_get();
 
     while(true){
         uint32_t device_index;
+        client_state_t preset = server_client_get_preset(state, flash_client_index, flash_configuration_index);
         read_device_index(&device_index,
             flash_client_index,
-            &state,
-            &state.clients[flash_client_index].preset_configs[flash_configuration_index]
+            state,
+            &preset
         );
         if (!device_index){
             return;
@@ -124,60 +187,65 @@ void set_configuration_devices(uint32_t flash_client_index, uint32_t flash_confi
         }
         device_state %= 2;
 
-        state.clients[flash_client_index].preset_configs[flash_configuration_index].devices[device_index - 1].is_on = device_state;
+        server_persistent_state_t *edited_state = server_state_begin_edit();
+        client_state_t *edited_preset = server_client_edit_preset(edited_state, flash_client_index, flash_configuration_index);
+        if (edited_preset){
+            client_state_set(edited_preset, device_index - 1, device_state);
+        }
+        server_state_end_edit();
 
-        save_server_state(&state);
+        if (!edited_preset){
+            server_print_preset_pool_exhausted();
+            return;
+        }
     }
 }
 
 void reset_all_client_data(uint32_t flash_client_index){
-    server_persistent_state_t state;
-    load_server_state(&state);
-    server_reset_configuration(&state.clients[flash_client_index].running_client_state);
-
-    server_send_client_state(state.clients[flash_client_index].uart_connection.pin_pair,
-                            state.clients[flash_client_index].uart_connection.uart_instance,
-                            &state.clients[flash_client_index].running_client_state);
-
-    uint8_t active_client_index = get_active_client_connection_index_from_flash_client_index(flash_client_index, state);
-    send_dormant_flag_to_client(active_client_index);
-    active_uart_server_connections[active_client_index].is_dormant = true;
+    server_persistent_state_t *state = server_state_begin_edit();
+    server_reset_configuration(&state->clients[flash_client_index].running_client_state);
+    if (state->clients[flash_client_index].preset_set != CLIENT_NO_PRESET_SET){
+        for (uint8_t configuration_index = 0; configuration_index < NUMBER_OF_POSSIBLE_PRESETS; configuration_index++){
+            server_reset_configuration(server_client_edit_preset(state, flash_client_index, configuration_index));
+        }
+        server_client_trim_presets(state, flash_client_index);
+    }
+    server_state_end_edit();
 
-    for (uint8_t configuration_index = 0; configuration_index < NUMBER_OF_POSSIBLE_PRESETS; configuration_index++){
-        server_reset_configuration(&state.clients[flash_client_index].preset_configs[configuration_index]);
+    uint8_t active_client_index = server_active_index_of_flash(flash_client_index);
+    if (active_client_index != CLIENT_INDEX_NOT_CONNECTED){
+        server_sync_client_state(active_client_index, &state->clients[flash_client_index].running_client_state);
+        send_dormant_flag_to_client(active_client_index);
+        active_uart_server_connections[active_client_index].is_dormant = true;
     }
 
-    save_server_state(&state);
     printf_and_update_buffer("\nAll Client Data Reset.\n");
 }
 
 void reset_running_configuration(uint32_t flash_client_index){
-    server_persistent_state_t state;
-    load_server_state(&state);
-
-    server_reset_configuration(&state.clients[flash_client_index].running_client_state);
+    server_persistent_state_t *state = server_state_begin_edit();
+    server_reset_configuration(&state->clients[flash_client_index].running_client_state);
+    server_state_end_edit();
 
-    server_send_client_state(state.clients[flash_client_index].uart_connection.pin_pair,
-                            state.clients[flash_client_index].uart_connection.uart_instance,
-                            &state.clients[flash_client_index].running_client_state);
-
-    uint8_t active_client_index = get_active_client_connection_index_from_flash_client_index(flash_client_index, state);
-    send_dormant_flag_to_client(active_client_index);
-    active_uart_server_connections[active_client_index].is_dormant = true;
-    
-    save_server_state(&state);
+    uint8_t active_client_index = server_active_index_of_flash(flash_client_index);
+    if (active_client_index != CLIENT_INDEX_NOT_CONNECTED){
+        server_sync_client_state(active_client_index, &state->clients[flash_client_index].running_client_state);
+        send_dormant_flag_to_client(active_client_index);
+        active_uart_server_connections[active_client_index].is_dormant = true;
+    }
 
     printf_and_update_buffer("\nRunning Configuration Reset.\n");
 }
 
 void reset_preset_configuration(uint32_t flash_client_index, uint32_t flash_configuration_index){
-    server_persistent_state_t state;
-    load_server_state(&state);
-    server_reset_configuration(&state.clients[flash_client_index].preset_configs[flash_configuration_index - 1]);
-
-    save_server_state(&state);
+    server_persistent_state_t *state = server_state_begin_edit();
+    if (state->clients[flash_client_index].preset_set != CLIENT_NO_PRESET_SET){
+        server_reset_configuration(server_client_edit_preset(state, flash_client_index, flash_configuration_index - 1));
+        server_client_trim_presets(state, flash_client_index);
+    }
+    server_state_end_edit();
 
     char string[BUFFER_MAX_STRING_SIZE];
     snprintf(string, sizeof(string), "\nPreset Configuration [%u] Reset.\n", flash_configuration_index);
     printf_and_update_buffer(string);
-}
\ No newline at end of file
+}
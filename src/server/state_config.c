@@ -3,130 +3,87 @@
  * @brief Configuration logic for initializing client states and presets on the UART server.
  *
  * This file handles:
- * - Setting up initial GPIO states (both running and presets) for each client
+ * - Starting an empty client registry when the saved state is invalid
  * - Reserving UART communication pins to avoid GPIO conflicts
- * - Initializing client UART connection parameters
- * - Providing reset and configuration routines for persistent state management
+ * - Recording the pin pair and topology of each connected client, used for
+ *   fast reconnection
+ * - Providing reset routines for persistent state management
  *
- * Functions in this file are mainly called during boot or full system reset,
- * and ensure all clients start with a known clean state.
+ * Functions in this file are mainly called during boot, when a client
+ * connects, or on a full system reset.
  * 
  */
 
 #include "server.h"
 
 /**
- * @brief Marks UART pins as reserved in the preset configurations.
+ * @brief Returns the device slots of a client's own UART pins.
  *
- * @param client_list_index Index of the client.
- * @param server_persistent_state Persistent state pointer.
- * @param config_index Preset configuration index to modify.
+ * @param client_pins TX/RX pins on the client side.
  */
-static void configure_preset_configs_uart_connection_pins(uint8_t client_list_index, server_persistent_state_t *server_persistent_state, uint8_t config_index){
-    for (uint8_t index = 0; index < active_server_connections_number; index++) {
-        client_t *client = &server_persistent_state->clients[client_list_index];
-        if (active_uart_server_connections[index].pin_pair.tx == client->uart_connection.pin_pair.tx){
-            client->preset_configs[config_index].devices[active_uart_server_connections[index].uart_pin_pair_from_client_to_server.tx].gpio_number = UART_CONNECTION_FLAG_NUMBER;
-            client->preset_configs[config_index].devices[active_uart_server_connections[index].uart_pin_pair_from_client_to_server.rx].gpio_number = UART_CONNECTION_FLAG_NUMBER;
-            return;
-        }
+static uint32_t server_client_pins_device_mask(uart_pin_pair_t client_pins){
+    uint32_t device_mask = 0;
+    uint8_t tx_device = board_gpio_to_device(client_pins.tx);
+    uint8_t rx_device = board_gpio_to_device(client_pins.rx);
+    if (tx_device != BOARD_NO_DEVICE){
+        device_mask |= 1u << tx_device;
     }
-}
-
-/**
- * @brief Initializes all preset configurations for a client.
- *
- * - Fills in GPIO numbers and disables all.
- * - Marks UART pins as reserved.
- *
- * @param client_list_index Client index.
- * @param server_persistent_state Persistent state struct.
- */
-static void configure_preset_configs(uint8_t client_list_index, server_persistent_state_t *server_persistent_state){
-    for (uint8_t config_index = 0; config_index < NUMBER_OF_POSSIBLE_PRESETS; config_index++){
-        for (uint8_t gpio_index = 0; gpio_index < MAX_NUMBER_OF_GPIOS; gpio_index++){
-            server_persistent_state->clients[client_list_index].preset_configs[config_index].devices[gpio_index].gpio_number = gpio_index + ((gpio_index / 23) * 3);
-            server_persistent_state->clients[client_list_index].preset_configs[config_index].devices[gpio_index].is_on = false;
-        }
-
-        configure_preset_configs_uart_connection_pins(client_list_index, server_persistent_state, config_index);
+    if (rx_device != BOARD_NO_DEVICE){
+        device_mask |= 1u << rx_device;
     }
+    return device_mask;
 }
 
-/**
- * @brief Marks UART pins as reserved in the running config of a client.
- *
- * - Used to prevent GPIO conflicts for UART communication pins.
- *
- * @param client_list_index Index of the client in flash.
- * @param server_persistent_state Pointer to full persistent state.
- */
-static void configure_running_state_uart_connection_pins(uint8_t client_list_index, server_persistent_state_t *server_persistent_state){
-    for (uint8_t index = 0; index < active_server_connections_number; index++) {
-        client_t *client = &server_persistent_state->clients[client_list_index];
-        if (active_uart_server_connections[index].pin_pair.tx == client->uart_connection.pin_pair.tx){
-            client->running_client_state.devices[active_uart_server_connections[index].uart_pin_pair_from_client_to_server.tx].gpio_number = UART_CONNECTION_FLAG_NUMBER;
-            client->running_client_state.devices[active_uart_server_connections[index].uart_pin_pair_from_client_to_server.rx].gpio_number = UART_CONNECTION_FLAG_NUMBER;
-            return;
-        }
-    }
+void server_configure_persistent_state(void) {
+    server_persistent_state_t *server_persistent_state = server_state_begin_edit();
+    server_client_registry_clear(server_persistent_state);
+    load_legacy_server_state(server_persistent_state);
+    server_state_end_edit();
+    server_client_index_map_rebuild();
 }
 
-/**
- * @brief Initializes the current (live) GPIO states for a client.
- *
- * - Assigns GPIO numbers and sets all to off.
- * - Flags UART pins to avoid conflict.
- *
- * @param client_list_index Index of the client.
- * @param server_persistent_state Persistent state structure.
- */
-static void configure_running_state(uint8_t client_list_index, server_persistent_state_t *server_persistent_state){
-    for (uint8_t index = 0; index < MAX_NUMBER_OF_GPIOS; index++){
-        server_persistent_state->clients[client_list_index].running_client_state.devices[index].gpio_number = index + ((index / 23) * 3);
-        server_persistent_state->clients[client_list_index].running_client_state.devices[index].is_on = false;
-    }
+bool server_update_topology(server_persistent_state_t *server_persistent_state){
+    bool is_changed = false;
 
-    configure_running_state_uart_connection_pins(client_list_index, server_persistent_state);
-}
+    for (uint8_t client_list_index = 0; client_list_index < server_persistent_state->clients_number; client_list_index++){
+        client_t *client = &server_persistent_state->clients[client_list_index];
+        client_topology_t topology = {0};
 
-/**
- * @brief Initializes a client entry in the persistent state.
- *
- * - Saves UART pin pair and instance.
- * - Sets is_dormant to true.
- * - Calls config functions.
- *
- * @param uart_pin_pair TX/RX pin pair for the client.
- * @param client_list_index Index in client array.
- * @param server_persistent_state State structure to populate.
- * @param uart_inst UART instance.
- */
-static void configure_client(uart_pin_pair_t uart_pin_pair, uint8_t client_list_index, server_persistent_state_t *server_persistent_state, uart_inst_t* uart_inst){
-    server_persistent_state->clients[client_list_index].uart_connection.pin_pair = uart_pin_pair;
-    server_persistent_state->clients[client_list_index].uart_connection.uart_instance = uart_inst;
+        uint8_t active_client_index = server_active_index_of_flash(client_list_index);
+        if (active_client_index != CLIENT_INDEX_NOT_CONNECTED){
+            const server_uart_connection_t *connection = &active_uart_server_connections[active_client_index];
+            topology.is_known = true;
+            topology.client_to_server_pin_pair = connection->uart_pin_pair_from_client_to_server;
 
-    configure_running_state(client_list_index, server_persistent_state);
-    configure_preset_configs(client_list_index, server_persistent_state);
-}
+            if (client->uart_connection.pin_pair.tx != connection->pin_pair.tx ||
+                client->uart_connection.pin_pair.rx != connection->pin_pair.rx ||
+                client->uart_connection.uart_instance != connection->uart_instance){
+                client->uart_connection.pin_pair = connection->pin_pair;
+                client->uart_connection.uart_instance = connection->uart_instance;
+                is_changed = true;
+            }
+
+            uint32_t reserved_mask = server_client_pins_device_mask(topology.client_to_server_pin_pair);
+            if (client->running_client_state.reserved_mask != reserved_mask){
+                server_client_set_reserved_mask(server_persistent_state, client_list_index, reserved_mask);
+                is_changed = true;
+            }
+        }
 
-void server_configure_persistent_state(server_persistent_state_t *server_persistent_state) {
-    uint8_t client_list_index = 0;
-    for (uint8_t i = 0; i < PIN_PAIRS_UART0_LEN; i++) {
-        configure_client(pin_pairs_uart0[i], client_list_index, server_persistent_state, uart0);
-        client_list_index++;
+        if (topology.is_known != client->topology.is_known ||
+            topology.client_to_server_pin_pair.tx != client->topology.client_to_server_pin_pair.tx ||
+            topology.client_to_server_pin_pair.rx != client->topology.client_to_server_pin_pair.rx){
+            client->topology = topology;
+            is_changed = true;
+        }
     }
-    for (uint8_t i = 0; i < PIN_PAIRS_UART1_LEN; i++) {
-        configure_client(pin_pairs_uart1[i], client_list_index, server_persistent_state, uart1);
-        client_list_index++;
+
+    if (server_client_registry_touch_connected(server_persistent_state)){
+        is_changed = true;
     }
-    save_server_state(server_persistent_state);
+    return is_changed;
 }
 
 void server_reset_configuration(client_state_t *client_state){
-    for (uint8_t index = 0; index < MAX_NUMBER_OF_GPIOS; index++){
-        if (client_state->devices[index].gpio_number != UART_CONNECTION_FLAG_NUMBER){
-            client_state->devices[index].is_on = false;
-        }
-    }
+    client_state->on_mask = 0;
 }
\ No newline at end of file
@@ -3,73 +3,952 @@
  * @brief Flash storage management for server persistent state on Raspberry Pi Pico.
  *
  * This file provides:
- * - CRC32 checksum computation for data integrity
+ * - CRC32 checksum computation for data integrity, offloaded to the DMA sniffer
+ *   (slicing-by-8 tables of crc32.c without a free DMA channel)
+ * - The in-RAM server state and its accessors
  * - Functions to load and save the server's persistent state to internal flash
  * - Interrupt-safe flash programming using temporary buffers
  *
- * All operations ensure the data structure integrity is verified before being accepted
- * (via CRC32) and written atomically to avoid corruption.
+ * The state is kept as a log in two banks (A/B) splitting `SERVER_FLASH_SECTORS`:
+ * - Page 0: header with a generation counter and CRCs, programmed last
+ * - Next pages: snapshot of the client registry, verified with CRC32
+ * - Remaining pages: 8-byte device change records (client, slot, device, value)
+ *
+ * The snapshot is packed rather than a copy of `server_persistent_state_t`.
+ * It holds only the registered clients, 24 bytes each: client ID, running ON
+ * bitmask, mask of the devices reserved for the UART link, and a UART index
+ * instead of a `uart_inst_t` pointer. The ON bitmasks of the presets follow
+ * the clients, only for the presets with a device ON, so clients without
+ * presets cost nothing more. GPIO numbers are derived from the device index on
+ * load. The header records the format version and the number of clients,
+ * presets and devices, so snapshots of builds with another layout are migrated
+ * on load and rewritten on the next commit.
+ *
+ * Saving appends one record per changed device to the current bank, so a
+ * toggle programs a single page instead of erasing sectors. The log is
+ * compacted into a new snapshot when it is full, or when something other than
+ * a device ON/OFF state changed. Compaction erases and writes the other bank
+ * and bumps the generation, so a power loss at any point keeps one intact bank.
+ *
+ * Without a valid log, the state is configured from scratch and takes over the
+ * plain structure saved by the first releases (`load_legacy_server_state()`).
+ * That structure sits in the last sector, in bank 1: the first compaction
+ * writes bank 0, so it is only erased once the imported state is durable.
+ *
+ * Erasing is kept off the commit path: once pending edits are known to need
+ * a compaction, the spare bank is erased one sector at a time while they
+ * settle (`server_state_service()`), so the commit only programs pages. The
+ * spare bank holds the previous generation, which is kept until then. Every
+ * sector erase and page program runs on its own under `flash_guard_begin()`,
+ * which parks core 1 and disables interrupts.
+ *
+ * The authoritative state lives in RAM: it is rebuilt from the snapshot and the
+ * records once at boot (`server_state_init()`), then read and edited in place
+ * through pointers. Flash is only its durable copy: `server_state_service()`
+ * commits edits once they pause for `SERVER_STATE_COMMIT_DEBOUNCE_MS`, or at the
+ * latest `SERVER_STATE_COMMIT_MAX_AGE_MS` after the first unwritten edit, so a
+ * burst of edits costs a single commit. `server_state_flush()` forces the commit.
  *
  * Functions in this file are used during boot, configuration changes, or when saving state.
  *
  */
 
-#include <string.h> 
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "hardware/dma.h"
 
 #include "server.h"
+#include "protocol.h"
+#include "crc32.h"
+
+/// Magic of a valid log header ("SLOG").
+#define STATE_LOG_MAGIC 0x474F4C53u
+/// On-flash format of the log; the plain structure of the first releases is format 0.
+#define STATE_LOG_FORMAT_VERSION 2u
+
+/// The log alternates between two banks, each a header, a snapshot and records.
+#define STATE_LOG_BANKS 2
+#define STATE_LOG_BANK_SECTORS (SERVER_FLASH_SECTORS / STATE_LOG_BANKS)
+#define STATE_LOG_BANK_SIZE (STATE_LOG_BANK_SECTORS * SERVER_SECTOR_SIZE)
+#define STATE_LOG_BANK_PAGES (STATE_LOG_BANK_SIZE / SERVER_PAGE_SIZE)
+#define STATE_LOG_PAGES_FOR(size) (((size) + SERVER_PAGE_SIZE - 1) / SERVER_PAGE_SIZE)
+/// Largest packed snapshot: a full registry, every preset set in use.
+#define STATE_LOG_SNAPSHOT_MAX_SIZE (MAX_REGISTERED_CLIENTS * sizeof(state_flash_client_t) + \
+    MAX_CLIENT_PRESET_SETS * NUMBER_OF_POSSIBLE_PRESETS * sizeof(uint32_t))
+/// Pages reserved for the snapshot, right after the header page.
+#define STATE_LOG_SNAPSHOT_PAGES STATE_LOG_PAGES_FOR(STATE_LOG_SNAPSHOT_MAX_SIZE)
+/// First page of change records.
+#define STATE_LOG_RECORDS_PAGE (1 + STATE_LOG_SNAPSHOT_PAGES)
+#define STATE_LOG_RECORDS_PER_PAGE (SERVER_PAGE_SIZE / sizeof(state_log_record_t))
+#define STATE_LOG_MAX_RECORDS ((STATE_LOG_BANK_PAGES - STATE_LOG_RECORDS_PAGE) * STATE_LOG_RECORDS_PER_PAGE)
+
+/// Record slot of the running state, preset `n` uses slot `n + 1`.
+#define STATE_LOG_RUNNING_SLOT 0
+
+/// `state_flash_client_t.uart_index` of clients on a PIO pin pair.
+#define STATE_FLASH_NO_UART 0xFF
+/// Device bits a snapshot may hold for this build.
+#define STATE_FLASH_DEVICES_MASK ((uint32_t)((1ull << MAX_NUMBER_OF_GPIOS) - 1))
+
+/**
+ * @brief Header of a bank, programmed last when compacting into it.
+ *
+ * An erased or torn header marks the bank as invalid, the other bank then
+ * still holds the previous state.
+ */
+typedef struct{
+    uint32_t magic;
+    uint32_t version;           ///< `STATE_LOG_FORMAT_VERSION`
+    uint32_t generation;        ///< Incremented on every compaction, the highest valid one is current
+    uint32_t snapshot_crc;      ///< CRC32 of the snapshot
+    uint16_t snapshot_size;     ///< Bytes of snapshot
+    uint8_t clients_number;     ///< Snapshot layout, so other builds can migrate it
+    uint8_t presets_number;
+    uint8_t devices_number;
+    uint8_t records_page;       ///< First page of change records
+    uint8_t reserved[2];
+    uint32_t header_crc;        ///< CRC32 of the fields above
+}state_log_header_t;
+
+/**
+ * @brief Packed, pointer-free image of a registered `client_t` in the snapshot.
+ *
+ * GPIO numbers are not stored, they derive from the device index
+ * (`board_device_to_gpio()`), except for the devices reserved for the
+ * UART link.
+ */
+typedef struct{
+    client_id_t client_id;
+    uint32_t on_mask;                                   ///< Running state, bit n = device n ON
+    uint32_t reserved_mask;                             ///< Bit n = device n is a UART link pin
+    uart_pin_pair_t pin_pair;
+    uint8_t uart_index;                                 ///< UART number, or `STATE_FLASH_NO_UART`
+    uint8_t is_topology_known;
+    uart_pin_pair_t client_to_server_pin_pair;
+    uint8_t preset_mask;                                ///< Bit n = the ON mask of preset n follows the clients
+    uint8_t recency;                                    ///< `client_t.recency`, 0 in images written before it existed
+}state_flash_client_t;
+
+static_assert(sizeof(state_flash_client_t) == 24, "state_flash_client_t must have no padding");
+static_assert(NUMBER_OF_POSSIBLE_PRESETS <= 8, "Stored presets are flagged in a byte");
+static_assert(STATE_LOG_SNAPSHOT_MAX_SIZE <= UINT16_MAX, "Snapshot size is stored in 16 bits");
+static_assert(MAX_NUMBER_OF_GPIOS <= 32, "Device states are packed into 32-bit masks");
+
+/**
+ * @brief One device change appended to the log.
+ *
+ * Several records share a page: a page is programmed again with 0xFF
+ * everywhere but the new records, which leaves the older ones untouched.
+ */
+typedef struct{
+    uint8_t client;             ///< Registry index in `server_persistent_state_t.clients`
+    uint8_t slot;               ///< `STATE_LOG_RUNNING_SLOT` or preset index + 1
+    uint8_t device;             ///< Index in `client_state_t.devices`
+    uint8_t value;              ///< New `is_on`
+    uint8_t reserved[3];        ///< Kept at 0xFF
+    uint8_t crc8;               ///< `protocol_crc8()` of the bytes above, detects torn records
+}state_log_record_t;
+
+static_assert(SERVER_FLASH_SECTORS % STATE_LOG_BANKS == 0, "SERVER_FLASH_SECTORS must split evenly into the log banks");
+static_assert(STATE_LOG_RECORDS_PAGE < STATE_LOG_BANK_PAGES,
+    "SERVER_FLASH_SECTORS leaves no room for change records after the snapshot");
+static_assert(SERVER_PAGE_SIZE % sizeof(state_log_record_t) == 0, "Log records must not straddle pages");
+static_assert(STATE_LOG_RECORDS_PAGE <= UINT8_MAX, "First record page is stored in a byte");
+static_assert(MAX_REGISTERED_CLIENTS < 0xFF && NUMBER_OF_POSSIBLE_PRESETS < 0xFF && MAX_NUMBER_OF_GPIOS < 0xFF,
+    "Log record fields are single bytes");
+
+/// Where the first releases saved the state: a plain structure at the start of the last sector.
+#define STATE_FLASH_V0_ADDR (XIP_BASE + PICO_FLASH_SIZE_BYTES - SERVER_SECTOR_SIZE)
+/// Layout of that structure: one client per hardware UART pin pair.
+#define STATE_FLASH_V0_CLIENTS 5
+#define STATE_FLASH_V0_PRESETS 5
+#define STATE_FLASH_V0_DEVICES 26
+
+/**
+ * @brief Device as saved by the first releases: GPIO number (`UART_CONNECTION_FLAG_NUMBER`
+ *        if reserved) and state.
+ */
+typedef struct{
+    uint8_t gpio_number;
+    uint8_t is_on;
+}state_flash_v0_device_t;
+
+/**
+ * @brief Client as saved by the first releases, with a `uart_inst_t` pointer.
+ */
+typedef struct{
+    state_flash_v0_device_t states[1 + STATE_FLASH_V0_PRESETS][STATE_FLASH_V0_DEVICES];  ///< Running state, then presets
+    uart_pin_pair_t pin_pair;
+    uint32_t uart_instance;
+}state_flash_v0_client_t;
+
+/**
+ * @brief Whole state as saved by the first releases.
+ */
+typedef struct{
+    state_flash_v0_client_t clients[STATE_FLASH_V0_CLIENTS];
+    uint32_t crc;               ///< Computed with this field at 0
+}state_flash_v0_state_t;
+
+static_assert(sizeof(state_flash_v0_state_t) == 1604, "The layout of the first releases must not change");
+
+/// Staging buffer for flash programming, kept off the stack since it spans several pages.
+static _Alignas(client_id_t) uint8_t flash_program_buffer[STATE_LOG_SNAPSHOT_PAGES * SERVER_PAGE_SIZE];
+/// The current bank is packed for another layout: compact before appending to it.
+static bool is_log_outdated = false;
+
+/// State rebuilt from the log, always equal to what is durable in flash (core 0 only).
+static server_persistent_state_t stored_state;
+static bool is_stored_state_valid = false;
+/// Bank holding the current snapshot and records.
+static uint8_t log_bank = 0;
+static uint32_t log_generation = 0;
+/// Index of the next free record slot in `log_bank`.
+static uint32_t log_next_record = 0;
+/// Leading sectors of the spare bank (`log_bank ^ 1`) known to be erased.
+static uint32_t spare_erased_sectors = 0;
+
+/// Authoritative state, loaded once at boot and edited in place (core 0 only).
+static server_persistent_state_t server_state;
+static bool is_server_state_valid = false;
+/// Odd while an edit is in progress, lets core 1 take consistent copies without a lock.
+static volatile uint32_t server_state_sequence = 0;
+static volatile bool is_server_state_dirty = false;
+static absolute_time_t server_state_first_edit_time;
+static absolute_time_t server_state_last_edit_time;
+
+/// DMA channel feeding the sniffer, -1 until claimed (or if none was free).
+static int crc_dma_channel = -1;
+static bool crc_dma_channel_claimed = false;
+/// Sink for the CRC transfers, the sniffer only needs the data to be read.
+static volatile uint8_t crc_dma_sink;
 
 /**
  * @brief Computes CRC32 checksum over a block of memory.
  *
+ * Streams the block through a DMA channel with the sniffer in bit-reversed
+ * CRC32 mode. Seed, output reversal and inversion match the standard CRC32
+ * of crc32.c, which takes over when no DMA channel is left for the sniffer,
+ * so existing flash contents stay valid.
+ *
+ * The sniffer is a single resource shared by both cores (core 1 loads the
+ * state for hot-plugged clients), so it is used under `state_crc_lock`.
+ *
  * @param data Pointer to the data block.
  * @param length Number of bytes to process.
  * @return uint32_t CRC32 checksum.
  */
 static uint32_t compute_crc32(const void *data, uint32_t length) {
-    const uint8_t *bytes = (const uint8_t *)data;
-    uint32_t crc = 0xFFFFFFFF;
-
-    for (uint32_t i = 0; i < length; ++i) {
-        crc ^= bytes[i];
-        for (int j = 0; j < 8; ++j) {
-            if (crc & 1)
-                crc = (crc >> 1) ^ 0xEDB88320;
-            else
-                crc >>= 1;
+    spin_lock_t *lock = state_crc_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+
+    if (!crc_dma_channel_claimed) {
+        crc_dma_channel = dma_claim_unused_channel(false);
+        crc_dma_channel_claimed = true;
+    }
+
+    if (crc_dma_channel < 0) {
+        spin_unlock(lock, irq_state);
+        return crc32_compute(data, length);
+    }
+
+    dma_channel_config config = dma_channel_get_default_config(crc_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_sniff_enable(&config, true);
+
+    dma_sniffer_enable(crc_dma_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+    dma_sniffer_set_output_reverse_enabled(true);
+    dma_sniffer_set_output_invert_enabled(true);
+    dma_sniffer_set_data_accumulator(0xFFFFFFFF);
+
+    dma_channel_configure(crc_dma_channel, &config, &crc_dma_sink, data, length, true);
+    dma_channel_wait_for_finish_blocking(crc_dma_channel);
+
+    uint32_t crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+
+    spin_unlock(lock, irq_state);
+    return crc;
+}
+
+#if SERVER_CRC32_BENCHMARK
+/**
+ * @brief Times `rounds` passes of one CRC32 engine over a block.
+ *
+ * @return Microseconds per pass.
+ */
+static float state_crc32_time_us(uint32_t (*engine)(const void *, uint32_t), const void *data, uint32_t length) {
+    volatile uint32_t sink = 0;
+    uint64_t start = time_us_64();
+    for (uint32_t round = 0; round < SERVER_CRC32_BENCHMARK_ROUNDS; round++) {
+        sink ^= engine(data, length);
+    }
+    (void)sink;
+    return (float)(time_us_64() - start) / SERVER_CRC32_BENCHMARK_ROUNDS;
+}
+
+void server_state_crc32_benchmark(void) {
+    // A bank header and the largest snapshot, the two blocks checked on every mount and commit
+    const uint32_t lengths[] = {offsetof(state_log_header_t, header_crc), sizeof(flash_program_buffer)};
+
+    for (uint32_t i = 0; i < sizeof(flash_program_buffer); i++) {
+        flash_program_buffer[i] = (uint8_t)(i * 31u + 7u);
+    }
+
+    for (uint8_t index = 0; index < sizeof(lengths) / sizeof(lengths[0]); index++) {
+        uint32_t length = lengths[index];
+        printf("CRC32 over %lu bytes: DMA sniffer %.1f us, slicing-by-8 %.1f us, bitwise %.1f us\n",
+               (unsigned long)length,
+               state_crc32_time_us(compute_crc32, flash_program_buffer, length),
+               state_crc32_time_us(crc32_compute, flash_program_buffer, length),
+               state_crc32_time_us(crc32_compute_bitwise, flash_program_buffer, length));
+    }
+}
+#endif
+
+/**
+ * @brief Returns the slot `slot` of client `client`: running state or a preset.
+ *
+ * @return NULL for a preset of a client without a preset set.
+ */
+static inline const client_state_t *state_log_get_slot(const server_persistent_state_t *state, uint8_t client, uint8_t slot) {
+    const client_t *entry = &state->clients[client];
+    if (slot == STATE_LOG_RUNNING_SLOT) {
+        return &entry->running_client_state;
+    }
+    if (entry->preset_set == CLIENT_NO_PRESET_SET) {
+        return NULL;
+    }
+    return &state->preset_sets[entry->preset_set].presets[slot - 1];
+}
+
+/**
+ * @brief Returns true if anything but device ON/OFF states differs for client `client`.
+ *
+ * Such changes (client ID, connection, topology, UART pin reservations, a
+ * preset set taken or given back) are rare and have no record type, they are
+ * written through a new snapshot. Preset reservations follow the running
+ * state (`server_client_set_reserved_mask()`), so only the latter is compared.
+ */
+static bool state_log_client_layout_changed(const server_persistent_state_t *a_state,
+                                            const server_persistent_state_t *b_state, uint8_t client) {
+    const client_t *a = &a_state->clients[client];
+    const client_t *b = &b_state->clients[client];
+
+    return a->client_id != b->client_id ||
+           (a->preset_set == CLIENT_NO_PRESET_SET) != (b->preset_set == CLIENT_NO_PRESET_SET) ||
+           a->running_client_state.reserved_mask != b->running_client_state.reserved_mask ||
+           a->uart_connection.pin_pair.tx != b->uart_connection.pin_pair.tx ||
+           a->uart_connection.pin_pair.rx != b->uart_connection.pin_pair.rx ||
+           a->uart_connection.uart_instance != b->uart_connection.uart_instance ||
+           a->topology.is_known != b->topology.is_known ||
+           a->topology.client_to_server_pin_pair.tx != b->topology.client_to_server_pin_pair.tx ||
+           a->topology.client_to_server_pin_pair.rx != b->topology.client_to_server_pin_pair.rx ||
+           a->recency != b->recency;
+}
+
+/**
+ * @brief Returns true if a record slot was never programmed since the last erase.
+ */
+static bool state_log_record_is_erased(const state_log_record_t *record) {
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Applies a record to `stored_state`.
+ *
+ * A preset record of a client without a preset set takes one from the pool.
+ *
+ * @return false if the record is torn or out of range.
+ */
+static bool state_log_apply_record(const state_log_record_t *record) {
+    if (record->crc8 != protocol_crc8((const uint8_t *)record, offsetof(state_log_record_t, crc8)) ||
+        record->client >= stored_state.clients_number ||
+        record->slot > NUMBER_OF_POSSIBLE_PRESETS ||
+        record->device >= MAX_NUMBER_OF_GPIOS) {
+        return false;
+    }
+
+    client_state_t *state = record->slot == STATE_LOG_RUNNING_SLOT ?
+        &stored_state.clients[record->client].running_client_state :
+        server_client_edit_preset(&stored_state, record->client, record->slot - 1);
+    if (!state) {
+        return false;
+    }
+    client_state_set(state, record->device, record->value);
+    return true;
+}
+
+/**
+ * @brief Packs client `index` into its snapshot image.
+ *
+ * @param preset_words Where the ON masks of its non-empty presets go.
+ * @return The position after the last mask written.
+ */
+static uint32_t *state_flash_pack_client(const server_persistent_state_t *state, uint8_t index,
+                                         state_flash_client_t *packed, uint32_t *preset_words) {
+    const client_t *client = &state->clients[index];
+    memset(packed, 0, sizeof(*packed));
+
+    packed->client_id = client->client_id;
+    packed->on_mask = client->running_client_state.on_mask;
+    packed->reserved_mask = client->running_client_state.reserved_mask;
+    packed->pin_pair = client->uart_connection.pin_pair;
+    packed->uart_index = client->uart_connection.uart_instance ? uart_get_index(client->uart_connection.uart_instance) : STATE_FLASH_NO_UART;
+    packed->is_topology_known = client->topology.is_known;
+    packed->client_to_server_pin_pair = client->topology.client_to_server_pin_pair;
+    packed->recency = client->recency;
+
+    for (uint8_t preset = 0; preset < NUMBER_OF_POSSIBLE_PRESETS; preset++) {
+        uint32_t on_mask = server_client_get_preset(state, index, preset).on_mask;
+        if (on_mask) {
+            packed->preset_mask |= 1u << preset;
+            *preset_words++ = on_mask;
+        }
+    }
+    return preset_words;
+}
+
+/**
+ * @brief Appends a client to `stored_state` from its snapshot image.
+ *
+ * @param preset_masks ON mask of every preset flagged in the image, in order.
+ * @param presets_number Presets of the build that wrote the image; others are dropped.
+ */
+static void state_flash_add_client(const state_flash_client_t *packed, const uint32_t *preset_masks, uint8_t presets_number) {
+    uint8_t index = stored_state.clients_number++;
+    uint32_t reserved_mask = packed->reserved_mask & STATE_FLASH_DEVICES_MASK;
+
+    stored_state.clients[index] = (client_t){
+        .client_id = packed->client_id,
+        .running_client_state = {
+            .on_mask = packed->on_mask & STATE_FLASH_DEVICES_MASK & ~reserved_mask,
+            .reserved_mask = reserved_mask,
+        },
+        .preset_set = CLIENT_NO_PRESET_SET,
+        .uart_connection = {
+            .pin_pair = packed->pin_pair,
+            .uart_instance = packed->uart_index == STATE_FLASH_NO_UART ? NULL : uart_get_instance(packed->uart_index),
+        },
+        .topology = {
+            .is_known = packed->is_topology_known,
+            .client_to_server_pin_pair = packed->client_to_server_pin_pair,
+        },
+        .recency = packed->recency,
+    };
+
+    for (uint32_t presets = packed->preset_mask; presets; presets &= presets - 1) {
+        uint8_t preset = __builtin_ctz(presets);
+        uint32_t on_mask;
+        memcpy(&on_mask, preset_masks++, sizeof(on_mask));
+
+        client_state_t *state = preset < presets_number && preset < NUMBER_OF_POSSIBLE_PRESETS ?
+            server_client_edit_preset(&stored_state, index, preset) : NULL;
+        if (!state) {
+            is_log_outdated = true;
+            continue;
+        }
+        state->on_mask = on_mask & STATE_FLASH_DEVICES_MASK & ~reserved_mask;
+    }
+}
+
+/**
+ * @brief Empties `stored_state` before it is rebuilt from flash.
+ */
+static void state_flash_reset_stored_state(void) {
+    memset(&stored_state, 0, sizeof(stored_state));
+    server_client_registry_clear(&stored_state);
+}
+
+/**
+ * @brief Returns the flash offset of `bank`.
+ */
+static inline uint32_t state_log_bank_offset(uint8_t bank) {
+    return SERVER_FLASH_OFFSET + bank * STATE_LOG_BANK_SIZE;
+}
+
+/**
+ * @brief Returns the header of `bank` if it is complete, intact and in the current format, NULL otherwise.
+ */
+static const state_log_header_t *state_log_get_valid_header(uint8_t bank) {
+    const state_log_header_t *header = (const state_log_header_t *)(XIP_BASE + state_log_bank_offset(bank));
+    if (header->magic != STATE_LOG_MAGIC ||
+        header->version != STATE_LOG_FORMAT_VERSION ||
+        header->header_crc != compute_crc32(header, offsetof(state_log_header_t, header_crc))) {
+        return NULL;
+    }
+    return header;
+}
+
+/**
+ * @brief Rebuilds `stored_state` from a snapshot.
+ *
+ * @return false if the preset masks do not fill the snapshot exactly.
+ */
+static bool state_flash_read_registry(const uint8_t *snapshot, const state_log_header_t *header) {
+    const uint8_t *preset_masks = snapshot + header->clients_number * sizeof(state_flash_client_t);
+    uint32_t preset_masks_number = 0;
+    state_flash_client_t packed;
+
+    if (header->snapshot_size < (uint32_t)(preset_masks - snapshot)) {
+        return false;
+    }
+    for (uint8_t index = 0; index < header->clients_number; index++) {
+        memcpy(&packed, snapshot + index * sizeof(packed), sizeof(packed));
+        preset_masks_number += __builtin_popcount(packed.preset_mask);
+    }
+    if (header->snapshot_size != (uint32_t)(preset_masks - snapshot) + preset_masks_number * sizeof(uint32_t)) {
+        return false;
+    }
+
+    state_flash_reset_stored_state();
+    for (uint8_t index = 0; index < header->clients_number; index++) {
+        if (index >= MAX_REGISTERED_CLIENTS) {
+            // Records of the dropped clients are rejected as out of range
+            is_log_outdated = true;
+            break;
+        }
+        memcpy(&packed, snapshot + index * sizeof(packed), sizeof(packed));
+        state_flash_add_client(&packed, (const uint32_t *)preset_masks, header->presets_number);
+        preset_masks += __builtin_popcount(packed.preset_mask) * sizeof(uint32_t);
+    }
+    return true;
+}
+
+/**
+ * @brief Rebuilds `stored_state` from the snapshot of `bank` and the records that follow it.
+ *
+ * Torn records are skipped; the log ends at the first erased record. A
+ * snapshot packed for another number of presets or devices is migrated and
+ * marks the log outdated, so the next commit compacts it.
+ *
+ * @return false if the snapshot is corrupted.
+ */
+static bool state_log_mount_bank(uint8_t bank, const state_log_header_t *header) {
+    const uint8_t *bank_address = (const uint8_t *)(XIP_BASE + state_log_bank_offset(bank));
+    const uint8_t *snapshot = bank_address + SERVER_PAGE_SIZE;
+    uint32_t records_page = header->records_page;
+
+    if (records_page < 1 + STATE_LOG_PAGES_FOR(header->snapshot_size) ||
+        records_page >= STATE_LOG_BANK_PAGES ||
+        compute_crc32(snapshot, header->snapshot_size) != header->snapshot_crc ||
+        !state_flash_read_registry(snapshot, header)) {
+        return false;
+    }
+
+    is_log_outdated |= header->presets_number != NUMBER_OF_POSSIBLE_PRESETS ||
+                       header->devices_number != MAX_NUMBER_OF_GPIOS ||
+                       records_page != STATE_LOG_RECORDS_PAGE;
+    log_bank = bank;
+    log_generation = header->generation;
+    is_stored_state_valid = true;
+
+    uint32_t max_records = (STATE_LOG_BANK_PAGES - records_page) * STATE_LOG_RECORDS_PER_PAGE;
+    const state_log_record_t *records = (const state_log_record_t *)(bank_address + records_page * SERVER_PAGE_SIZE);
+    for (log_next_record = 0; log_next_record < max_records; log_next_record++) {
+        if (state_log_record_is_erased(&records[log_next_record])) {
+            break;
+        }
+        state_log_apply_record(&records[log_next_record]);
+    }
+
+    if (is_log_outdated) {
+        // Appends go to this build's record page, the bank is compacted first
+        log_next_record = STATE_LOG_MAX_RECORDS;
+    }
+    return true;
+}
+
+/**
+ * @brief Rebuilds `stored_state` from the current bank, once at boot.
+ *
+ * Only the two headers are read to pick the bank with the highest valid
+ * generation. If its snapshot turns out corrupted, the other bank is used.
+ */
+static void state_log_mount(void) {
+    is_stored_state_valid = false;
+    is_log_outdated = false;
+    // Without a valid bank the first compaction goes to bank 0, which keeps the
+    // last sector (`STATE_FLASH_V0_ADDR`) until the imported state is durable
+    log_bank = STATE_LOG_BANKS - 1;
+    log_generation = 0;
+    log_next_record = STATE_LOG_MAX_RECORDS;
+
+    const state_log_header_t *headers[STATE_LOG_BANKS];
+    for (uint8_t bank = 0; bank < STATE_LOG_BANKS; bank++) {
+        headers[bank] = state_log_get_valid_header(bank);
+    }
+
+    uint8_t newest = (headers[1] && (!headers[0] || headers[1]->generation > headers[0]->generation)) ? 1 : 0;
+    uint8_t oldest = newest ^ 1;
+
+    if (headers[newest] && state_log_mount_bank(newest, headers[newest])) {
+        return;
+    }
+    if (headers[oldest]) {
+        // The next compaction overwrites the corrupted bank
+        state_log_mount_bank(oldest, headers[oldest]);
+    }
+}
+
+/**
+ * @brief Counts the leading erased sectors of the spare bank, once at boot.
+ */
+static void state_log_scan_spare(void) {
+    const uint32_t *words = (const uint32_t *)(XIP_BASE + state_log_bank_offset(log_bank ^ 1));
+
+    for (spare_erased_sectors = 0; spare_erased_sectors < STATE_LOG_BANK_SECTORS; spare_erased_sectors++) {
+        for (uint32_t i = 0; i < SERVER_SECTOR_SIZE / sizeof(uint32_t); i++) {
+            if (words[i] != 0xFFFFFFFF) {
+                return;
+            }
+        }
+        words += SERVER_SECTOR_SIZE / sizeof(uint32_t);
+    }
+}
+
+/**
+ * @brief Erases the next sector of the spare bank.
+ *
+ * One sector per call bounds how long core 1 and the interrupts are held.
+ */
+static void __not_in_flash_func(state_log_erase_spare_sector)(void) {
+    uint32_t offset = state_log_bank_offset(log_bank ^ 1) + spare_erased_sectors * SERVER_SECTOR_SIZE;
+
+    uint32_t ints = flash_guard_begin();
+    flash_range_erase(offset, SERVER_SECTOR_SIZE);
+    flash_guard_end(ints);
+
+    spare_erased_sectors++;
+}
+
+/**
+ * @brief Writes `state_in` as a new snapshot with an empty log, into the other bank.
+ *
+ * The current bank is left untouched until the new header is programmed, so
+ * a commit cut short at any point still boots on the previous state.
+ */
+static void __not_in_flash_func(state_log_compact)(const server_persistent_state_t *state_in) {
+    uint8_t bank = log_bank ^ 1;
+    uint32_t bank_offset = state_log_bank_offset(bank);
+
+    memset(flash_program_buffer, 0, sizeof(flash_program_buffer));
+    state_flash_client_t *snapshot = (state_flash_client_t *)flash_program_buffer;
+    uint32_t *preset_words = (uint32_t *)&snapshot[state_in->clients_number];
+    for (uint8_t index = 0; index < state_in->clients_number; index++) {
+        preset_words = state_flash_pack_client(state_in, index, &snapshot[index], preset_words);
+    }
+    uint32_t snapshot_size = (uint32_t)((uint8_t *)preset_words - flash_program_buffer);
+    uint32_t snapshot_crc = compute_crc32(flash_program_buffer, snapshot_size);
+
+    // Normally erased in idle time already (`state_log_erase_spare_sector()`)
+    while (spare_erased_sectors < STATE_LOG_BANK_SECTORS) {
+        state_log_erase_spare_sector();
+    }
+
+    // One page per guarded section, to keep core 1 held as briefly as for a record
+    uint32_t ints;
+    for (uint32_t page = 0; page < STATE_LOG_PAGES_FOR(snapshot_size); page++) {
+        ints = flash_guard_begin();
+        flash_range_program(bank_offset + (1 + page) * SERVER_PAGE_SIZE, flash_program_buffer + page * SERVER_PAGE_SIZE, SERVER_PAGE_SIZE);
+        flash_guard_end(ints);
+    }
+
+    // Header last: it switches the current bank
+    memset(flash_program_buffer, 0xFF, SERVER_PAGE_SIZE);
+    state_log_header_t *header = (state_log_header_t *)flash_program_buffer;
+    header->magic = STATE_LOG_MAGIC;
+    header->version = STATE_LOG_FORMAT_VERSION;
+    header->generation = log_generation + 1;
+    header->snapshot_crc = snapshot_crc;
+    header->snapshot_size = snapshot_size;
+    header->clients_number = state_in->clients_number;
+    header->presets_number = NUMBER_OF_POSSIBLE_PRESETS;
+    header->devices_number = MAX_NUMBER_OF_GPIOS;
+    header->records_page = STATE_LOG_RECORDS_PAGE;
+    memset(header->reserved, 0, sizeof(header->reserved));
+    header->header_crc = compute_crc32(header, offsetof(state_log_header_t, header_crc));
+
+    ints = flash_guard_begin();
+    flash_range_program(bank_offset, flash_program_buffer, SERVER_PAGE_SIZE);
+    flash_guard_end(ints);
+
+    log_bank = bank;
+    log_generation++;
+    log_next_record = 0;
+    spare_erased_sectors = 0;
+    is_log_outdated = false;
+    is_stored_state_valid = true;
+}
+
+/**
+ * @brief Programs the records staged in `flash_program_buffer` for log page `page`.
+ */
+static void __not_in_flash_func(state_log_program_page)(uint32_t page) {
+    uint32_t offset = state_log_bank_offset(log_bank) + (STATE_LOG_RECORDS_PAGE + page) * SERVER_PAGE_SIZE;
+
+    uint32_t ints = flash_guard_begin();
+    flash_range_program(offset, flash_program_buffer, SERVER_PAGE_SIZE);
+    flash_guard_end(ints);
+}
+
+/**
+ * @brief Walks the device changes between `stored_state` and `state_in`.
+ *
+ * @param append true to append a record for every change, false to only count them.
+ * @return Number of changed devices.
+ */
+static uint32_t state_log_changes(const server_persistent_state_t *state_in, bool append) {
+    uint32_t changes = 0;
+    uint32_t staged_page = UINT32_MAX;
+
+    for (uint8_t client = 0; client < state_in->clients_number; client++) {
+        for (uint8_t slot = 0; slot <= NUMBER_OF_POSSIBLE_PRESETS; slot++) {
+            const client_state_t *stored = state_log_get_slot(&stored_state, client, slot);
+            const client_state_t *wanted = state_log_get_slot(state_in, client, slot);
+            if (!stored || !wanted) {
+                // No preset set on either side: nothing saved, nothing to log
+                break;
+            }
+
+            uint32_t diff = client_state_diff(stored, wanted);
+            if (!append) {
+                changes += __builtin_popcount(diff);
+                continue;
+            }
+
+            for (; diff; diff &= diff - 1) {
+                uint8_t device = __builtin_ctz(diff);
+                changes++;
+
+                uint32_t page = log_next_record / STATE_LOG_RECORDS_PER_PAGE;
+                if (page != staged_page) {
+                    if (staged_page != UINT32_MAX) {
+                        state_log_program_page(staged_page);
+                    }
+                    memset(flash_program_buffer, 0xFF, SERVER_PAGE_SIZE);
+                    staged_page = page;
+                }
+
+                state_log_record_t *record = (state_log_record_t *)flash_program_buffer +
+                    (log_next_record % STATE_LOG_RECORDS_PER_PAGE);
+                record->client = client;
+                record->slot = slot;
+                record->device = device;
+                record->value = client_state_is_on(wanted, device);
+                record->crc8 = protocol_crc8((const uint8_t *)record, offsetof(state_log_record_t, crc8));
+                log_next_record++;
+            }
         }
     }
 
-    return ~crc;
+    if (staged_page != UINT32_MAX) {
+        state_log_program_page(staged_page);
+    }
+    return changes;
 }
 
-bool load_server_state(server_persistent_state_t *out_state) {
-    const server_persistent_state_t *flash_state = (const server_persistent_state_t *)SERVER_FLASH_ADDR;
-    memcpy(out_state, flash_state, sizeof(server_persistent_state_t));
+/**
+ * @brief Returns true if committing `state_in` takes a new snapshot rather than records.
+ *
+ * @param changes Receives the number of changed devices, 0 when a snapshot is needed anyway.
+ */
+static bool state_log_needs_snapshot(const server_persistent_state_t *state_in, uint32_t *changes) {
+    *changes = 0;
 
-    uint32_t saved_crc = out_state->crc;
-    out_state->crc = 0;
-    uint32_t computed_crc = compute_crc32(out_state, sizeof(server_persistent_state_t));
-    out_state->crc = saved_crc;
+    if (!is_stored_state_valid || is_log_outdated || stored_state.clients_number != state_in->clients_number) {
+        return true;
+    }
+    for (uint8_t client = 0; client < state_in->clients_number; client++) {
+        if (state_log_client_layout_changed(&stored_state, state_in, client)) {
+            return true;
+        }
+    }
 
-    return (saved_crc == computed_crc);
+    *changes = state_log_changes(state_in, false);
+    // Compact when the log is full, or when a snapshot is cheaper than the records
+    return *changes > STATE_LOG_MAX_RECORDS - log_next_record ||
+           *changes > STATE_LOG_SNAPSHOT_PAGES * STATE_LOG_RECORDS_PER_PAGE;
 }
 
-void __not_in_flash_func(save_server_state)(const server_persistent_state_t *state_in) {
-    server_persistent_state_t temp;
-    memcpy(&temp, state_in, sizeof(temp));
+/**
+ * @brief Writes `state_in` to the log, as records or as a new snapshot.
+ */
+static void __not_in_flash_func(state_log_commit)(const server_persistent_state_t *state_in) {
+    uint32_t changes;
+    if (state_log_needs_snapshot(state_in, &changes)) {
+        state_log_compact(state_in);
+    } else if (changes) {
+        state_log_changes(state_in, true);
+    } else {
+        return;
+    }
 
-    temp.crc = 0;
-    temp.crc = compute_crc32(&temp, sizeof(temp));
+    memcpy(&stored_state, state_in, sizeof(stored_state));
+}
 
-    uint8_t buffer[SERVER_SECTOR_SIZE] = {0};
-    memcpy(buffer, &temp, sizeof(temp));
+void server_state_init(void) {
+    state_log_mount();
+    state_log_scan_spare();
+    memcpy(&server_state, &stored_state, sizeof(server_state));
+    is_server_state_valid = is_stored_state_valid;
+
+    if (is_log_outdated) {
+        // Rewrite a migrated state in this build's layout once the boot settles
+        server_state_begin_edit();
+        server_state_end_edit();
+    }
+}
+
+bool server_state_is_valid(void) {
+    return is_server_state_valid;
+}
+
+const server_persistent_state_t *server_state_get(void) {
+    return &server_state;
+}
+
+server_persistent_state_t *server_state_begin_edit(void) {
+    server_state_sequence++;
+    __dmb();
+    return &server_state;
+}
+
+void server_state_end_edit(void) {
+    absolute_time_t now = get_absolute_time();
+
+    __dmb();
+    server_state_sequence++;
+
+    is_server_state_valid = true;
+    if (!is_server_state_dirty) {
+        server_state_first_edit_time = now;
+    }
+    server_state_last_edit_time = now;
+    is_server_state_dirty = true;
+}
+
+bool server_state_read_client(uint32_t flash_client_index, client_t *out_client) {
+    while (true) {
+        uint32_t sequence = server_state_sequence;
+        if (sequence & 1) {
+            tight_loop_contents();
+            continue;
+        }
 
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(SERVER_FLASH_OFFSET, SERVER_SECTOR_SIZE);
-    flash_range_program(SERVER_FLASH_OFFSET, buffer, SERVER_SECTOR_SIZE);
-    restore_interrupts(ints);
+        __dmb();
+        memcpy(out_client, &server_state.clients[flash_client_index], sizeof(client_t));
+        __dmb();
+
+        if (sequence == server_state_sequence) {
+            return is_server_state_valid;
+        }
+    }
+}
+
+/**
+ * @brief Returns the UART of a client saved by the first releases, from its `uart_inst_t` pointer.
+ */
+static uart_inst_t *state_flash_v0_uart(const state_flash_v0_client_t *old_client) {
+    if (old_client->uart_instance == (uint32_t)(uintptr_t)uart0) {
+        return uart0;
+    }
+    if (old_client->uart_instance == (uint32_t)(uintptr_t)uart1) {
+        return uart1;
+    }
+    return NULL;
+}
+
+bool load_legacy_server_state(server_persistent_state_t *state) {
+    const state_flash_v0_state_t *image = (const state_flash_v0_state_t *)STATE_FLASH_V0_ADDR;
+
+    // The CRC was computed with its own field at 0, read in place rather than copied
+    static const uint32_t zero_crc = 0;
+    uint32_t crc = crc32_update(CRC32_INITIAL_VALUE, image, offsetof(state_flash_v0_state_t, crc));
+    if (~crc32_update(crc, &zero_crc, sizeof(zero_crc)) != image->crc) {
+        return false;
+    }
+
+    for (uint8_t index = 0; index < STATE_FLASH_V0_CLIENTS; index++) {
+        const state_flash_v0_client_t *old_client = &image->clients[index];
+        uint32_t on_masks[1 + STATE_FLASH_V0_PRESETS] = {0};
+        uint32_t reserved_mask = 0;
+        uint32_t any_on = 0;
+
+        for (uint8_t slot = 0; slot <= STATE_FLASH_V0_PRESETS; slot++) {
+            for (uint8_t device = 0; device < STATE_FLASH_V0_DEVICES && device < MAX_NUMBER_OF_GPIOS; device++) {
+                if (old_client->states[slot][device].gpio_number == UART_CONNECTION_FLAG_NUMBER) {
+                    reserved_mask |= 1u << device;
+                } else if (old_client->states[slot][device].is_on) {
+                    on_masks[slot] |= 1u << device;
+                }
+            }
+            any_on |= on_masks[slot];
+        }
+        if (!any_on) {
+            // Nothing to keep, the client is registered when it links
+            continue;
+        }
+
+        // Keyed like a client without ID, it takes the entry over on its first handshake
+        server_uart_connection_t connection = {
+            .pin_pair = old_client->pin_pair,
+            .uart_instance = state_flash_v0_uart(old_client),
+            .client_id = server_legacy_client_id(old_client->pin_pair),
+        };
+        uint8_t flash_client_index = server_client_registry_register(state, &connection);
+        server_client_set_reserved_mask(state, flash_client_index, reserved_mask);
+        state->clients[flash_client_index].running_client_state.on_mask = on_masks[0] & ~reserved_mask;
+
+        for (uint8_t preset = 0; preset < STATE_FLASH_V0_PRESETS && preset < NUMBER_OF_POSSIBLE_PRESETS; preset++) {
+            client_state_t *preset_state = on_masks[1 + preset] ? server_client_edit_preset(state, flash_client_index, preset) : NULL;
+            if (preset_state) {
+                preset_state->on_mask = on_masks[1 + preset] & ~reserved_mask;
+            }
+        }
+    }
+    return true;
+}
+
+void server_state_flush(void) {
+    if (!is_server_state_dirty) {
+        return;
+    }
+
+    // Only core 0 edits the state, it cannot change during the commit
+    is_server_state_dirty = false;
+    state_log_commit(&server_state);
+}
+
+void server_state_service(void) {
+    if (!is_server_state_dirty) {
+        // The spare bank holds the previous generation, kept until a compaction needs it
+        return;
+    }
+
+    absolute_time_t now = get_absolute_time();
+    if (absolute_time_diff_us(server_state_last_edit_time, now) >= SERVER_STATE_COMMIT_DEBOUNCE_MS * MS_TO_US_MULTIPLIER ||
+        absolute_time_diff_us(server_state_first_edit_time, now) >= SERVER_STATE_COMMIT_MAX_AGE_MS * MS_TO_US_MULTIPLIER) {
+        server_state_flush();
+        return;
+    }
+
+    // The pending commit compacts: prepare the spare bank while the edits settle
+    uint32_t changes;
+    if (spare_erased_sectors < STATE_LOG_BANK_SECTORS && state_log_needs_snapshot(&server_state, &changes)) {
+        state_log_erase_spare_sector();
+    }
 }
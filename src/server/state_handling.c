@@ -3,8 +3,9 @@
  * @brief Logic for loading, syncing, and managing client running states on the server.
  *
  * This file handles:
- * - Mapping between persistent flash state and active UART clients
- * - Loading each client's last known GPIO state and sending it via UART
+ * - Mapping between the client registry and active UART clients, through
+ *   index tables updated when a client connects (see client_registry.c)
+ * - Loading each client's last known GPIO state and syncing it via UART
  * - Verifying flash integrity using CRC and reinitializing if needed
  * - Managing dormant/active flags for each client based on GPIO activity
  *
@@ -17,79 +18,156 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#include "hardware/sync.h"
+
 #include "server.h"
 
-uint32_t get_active_client_connection_index_from_flash_client_index(uint32_t flash_client_index, server_persistent_state_t state){
-    for (uint8_t active_client_index = 0; active_client_index < active_server_connections_number; active_client_index++){
-        if (active_uart_server_connections[active_client_index].pin_pair.tx == state.clients[flash_client_index].uart_connection.pin_pair.tx){
-            return active_client_index;
-        }
+/// Saved client of each active connection, `CLIENT_INDEX_NOT_CONNECTED` if none.
+static volatile uint8_t flash_index_of_active[MAX_SERVER_CONNECTIONS] = {
+    [0 ... MAX_SERVER_CONNECTIONS - 1] = CLIENT_INDEX_NOT_CONNECTED
+};
+/// Active connection of each saved client, `CLIENT_INDEX_NOT_CONNECTED` if none.
+static volatile uint8_t active_index_of_flash[MAX_REGISTERED_CLIENTS] = {
+    [0 ... MAX_REGISTERED_CLIENTS - 1] = CLIENT_INDEX_NOT_CONNECTED
+};
+
+/**
+ * @brief Links an active connection and a saved client in both tables.
+ *
+ * Any previous link of the connection is dropped first.
+ *
+ * @note Must be called with `client_index_map_lock` held.
+ */
+static void server_client_index_map_link(uint8_t active_client_index, uint8_t flash_client_index) {
+    uint8_t previous_flash_client_index = flash_index_of_active[active_client_index];
+    if (previous_flash_client_index != CLIENT_INDEX_NOT_CONNECTED) {
+        active_index_of_flash[previous_flash_client_index] = CLIENT_INDEX_NOT_CONNECTED;
+    }
+
+    flash_index_of_active[active_client_index] = flash_client_index;
+    if (flash_client_index != CLIENT_INDEX_NOT_CONNECTED) {
+        active_index_of_flash[flash_client_index] = active_client_index;
     }
-    return INVALID_CLIENT_INDEX;
 }
 
-bool client_has_active_devices(client_t client){
-    for (uint8_t device_index = 0; device_index < MAX_NUMBER_OF_GPIOS; device_index++){
-        if (client.running_client_state.devices[device_index].is_on){
-            return true;
+void server_client_index_map_rebuild(void) {
+    const server_persistent_state_t *server_persistent_state = server_state_get();
+    spin_lock_t *lock = client_index_map_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+
+    for (uint8_t index = 0; index < MAX_SERVER_CONNECTIONS; index++) {
+        flash_index_of_active[index] = CLIENT_INDEX_NOT_CONNECTED;
+    }
+    for (uint8_t index = 0; index < MAX_REGISTERED_CLIENTS; index++) {
+        active_index_of_flash[index] = CLIENT_INDEX_NOT_CONNECTED;
+    }
+    if (server_state_is_valid()) {
+        for (uint8_t index = 0; index < active_server_connections_number; index++) {
+            client_id_t client_id = active_uart_server_connections[index].client_id;
+            server_client_index_map_link(index, server_client_registry_find(server_persistent_state, client_id));
         }
     }
-    return false;
+
+    spin_unlock(lock, irq_state);
+}
+
+void server_client_index_map_set(uint8_t active_client_index, uint8_t flash_client_index) {
+    spin_lock_t *lock = client_index_map_lock;
+    uint32_t irq_state = spin_lock_blocking(lock);
+
+    server_client_index_map_link(active_client_index, flash_client_index);
+
+    spin_unlock(lock, irq_state);
+}
+
+uint8_t server_flash_index_of_active(uint32_t active_client_index) {
+    return active_client_index < MAX_SERVER_CONNECTIONS ? flash_index_of_active[active_client_index] : CLIENT_INDEX_NOT_CONNECTED;
+}
+
+uint8_t server_active_index_of_flash(uint32_t flash_client_index) {
+    return flash_client_index < MAX_REGISTERED_CLIENTS ? active_index_of_flash[flash_client_index] : CLIENT_INDEX_NOT_CONNECTED;
+}
+
+uint32_t client_state_get_gpio_mask(const client_state_t *client_state){
+    uint32_t gpio_mask = 0;
+    uint32_t on_mask = client_state->on_mask & ~client_state->reserved_mask;
+    while (on_mask){
+        uint8_t device_index = __builtin_ctz(on_mask);
+        gpio_mask |= (1u << board_device_to_gpio(device_index));
+        on_mask &= on_mask - 1;
+    }
+    return gpio_mask;
 }
 
 /**
  * @brief Updates the dormant status of all connected clients based on their active devices.
  *
- * For each active UART client, this function compares its active server connections TX pins with the
- * persistent state list and sets its `is_dormant` flag to true if all devices are OFF.
+ * For each active UART client, looks up its saved client and sets its
+ * `is_dormant` flag to true if all devices are OFF.
  *
  * @param server_persistent_state Pointer to the saved state containing all client info.
  */
-static void set_dormant_flag_to_standby_clients(server_persistent_state_t *server_persistent_state){
+static void set_dormant_flag_to_standby_clients(const server_persistent_state_t *server_persistent_state){
     for (uint8_t active_client_index = 0; active_client_index < active_server_connections_number; active_client_index++){
-        for (uint8_t persistent_state_client_index = 0; persistent_state_client_index < MAX_SERVER_CONNECTIONS; persistent_state_client_index++){
-            if (active_uart_server_connections[active_client_index].pin_pair.tx == server_persistent_state->clients[persistent_state_client_index].uart_connection.pin_pair.tx){
-                active_uart_server_connections[active_client_index].is_dormant = !client_has_active_devices(server_persistent_state->clients[persistent_state_client_index]);
-                return;
-            }
+        uint8_t flash_client_index = server_flash_index_of_active(active_client_index);
+        if (flash_client_index != CLIENT_INDEX_NOT_CONNECTED){
+            active_uart_server_connections[active_client_index].is_dormant = !client_has_active_devices(&server_persistent_state->clients[flash_client_index]);
         }
     }
 }
 
 /**
- * @brief Loads the running state for an active client and sends it over UART.
+ * @brief Loads the running state for an active client and syncs it over UART.
  *
- * - Sends the device states to the client
+ * - Sends only the devices that are ON, since a freshly connected client starts with all devices OFF
  *
- * @param server_uart_connection Connection info (pin pair + instance).
- * @param server_persistent_state Pointer to loaded flash state.
+ * @param active_client_index Index of the client in `active_uart_server_connections`.
+ * @param server_persistent_state Pointer to the persistent state.
  */
-static void server_load_client_state(server_uart_connection_t server_uart_connection, server_persistent_state_t *server_persistent_state) {
-    for (uint8_t flash_client_index = 0; flash_client_index < MAX_SERVER_CONNECTIONS; flash_client_index++) {
-        client_t *saved_client = &server_persistent_state->clients[flash_client_index];
-        
-        if (saved_client->uart_connection.pin_pair.tx == server_uart_connection.pin_pair.tx &&
-            saved_client->uart_connection.pin_pair.rx == server_uart_connection.pin_pair.rx &&
-            saved_client->uart_connection.uart_instance == server_uart_connection.uart_instance) {
-                
-            server_send_client_state(server_uart_connection.pin_pair, server_uart_connection.uart_instance, &saved_client->running_client_state);
-            return;
-        }
+static void server_load_client_state(uint8_t active_client_index, const server_persistent_state_t *server_persistent_state) {
+    uint8_t flash_client_index = server_flash_index_of_active(active_client_index);
+    if (flash_client_index != CLIENT_INDEX_NOT_CONNECTED) {
+        server_sync_client_state(active_client_index, &server_persistent_state->clients[flash_client_index].running_client_state);
+    }
+}
+
+void server_load_running_state_to_client(uint8_t active_client_index){
+    uint8_t flash_client_index = server_flash_index_of_active(active_client_index);
+    if (flash_client_index == CLIENT_INDEX_NOT_CONNECTED) {
+        return;
+    }
+
+    client_t saved_client;
+    if (!server_state_read_client(flash_client_index, &saved_client)) {
+        return;
+    }
+
+    server_sync_client_state(active_client_index, &saved_client.running_client_state);
+    if (!client_has_active_devices(&saved_client)) {
+        active_uart_server_connections[active_client_index].is_dormant = true;
+        send_dormant_flag_to_client(active_client_index);
     }
 }
 
 void server_load_running_states_to_active_clients(void){
-    server_persistent_state_t server_persistent_state = {0};
-    bool valid_crc = load_server_state(&server_persistent_state);
+    if (!server_state_is_valid()) {
+        server_configure_persistent_state();
+    }
 
-    if (valid_crc) {
-        for (uint8_t index = 0; index < active_server_connections_number; index++) {
-            server_load_client_state(active_uart_server_connections[index], &server_persistent_state);
+    server_client_index_map_rebuild();
+    for (uint8_t index = 0; index < active_server_connections_number; index++) {
+        if (server_flash_index_of_active(index) == CLIENT_INDEX_NOT_CONNECTED) {
+            server_client_registry_link(index);
         }
-    } else {
-        server_configure_persistent_state(&server_persistent_state);
+    }
+    // Committed only if it changed: an unchanged state writes nothing to flash
+    server_update_topology(server_state_begin_edit());
+    server_state_end_edit();
+
+    for (uint8_t index = 0; index < active_server_connections_number; index++) {
+        server_load_client_state(index, server_state_get());
     }
 
-    set_dormant_flag_to_standby_clients(&server_persistent_state);
+    set_dormant_flag_to_standby_clients(server_state_get());
     send_dormant_to_standby_clients();
 }
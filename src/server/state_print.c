@@ -28,7 +28,7 @@
  * @param client_state Pointer to the client_state_t structure.
  */
 static void server_print_gpio_state(uint8_t gpio_index, const client_state_t *client_state){
-    if (client_state->devices[gpio_index].gpio_number == UART_CONNECTION_FLAG_NUMBER){
+    if (client_state_is_reserved(client_state, gpio_index)){
         char string[BUFFER_MAX_STRING_SIZE];
         snprintf(string, sizeof(string), "%2u. UART connection, no access.\n", gpio_index + 1);
         printf_and_update_buffer(string);
@@ -36,8 +36,8 @@ static void server_print_gpio_state(uint8_t gpio_index, const client_state_t *cl
         char string[BUFFER_MAX_STRING_SIZE];
         snprintf(string, sizeof(string), "%2u. GPIO_NO: %2u  Power: %s\n",
             gpio_index + 1,
-            client_state->devices[gpio_index].gpio_number,
-            client_state->devices[gpio_index].is_on ? "ON" : "OFF");
+            board_device_to_gpio(gpio_index),
+            client_state_is_on(client_state, gpio_index) ? "ON" : "OFF");
         printf_and_update_buffer(string);
     }
 }
@@ -53,16 +53,18 @@ void server_print_running_client_state(const client_t *client){
     server_print_state_devices(&client->running_client_state);
 }
 
-void server_print_client_preset_configuration(const client_t *client, uint8_t client_preset_index){
+void server_print_client_preset_configuration(uint32_t flash_client_index, uint8_t client_preset_index){
     char string[BUFFER_MAX_STRING_SIZE];
     snprintf(string, sizeof(string), "Preset Config[%u] Devices:\n", client_preset_index + 1);
     printf_and_update_buffer(string);
-    server_print_state_devices(&client->preset_configs[client_preset_index]);
+
+    client_state_t preset = server_client_get_preset(server_state_get(), flash_client_index, client_preset_index);
+    server_print_state_devices(&preset);
 }
 
-void server_print_client_preset_configurations(const client_t *client){
+void server_print_client_preset_configurations(uint32_t flash_client_index){
     for (uint32_t preset_config_index = 0; preset_config_index < NUMBER_OF_POSSIBLE_PRESETS; preset_config_index++){
-        server_print_client_preset_configuration(client, preset_config_index);
+        server_print_client_preset_configuration(flash_client_index, preset_config_index);
         printf_and_update_buffer("\n");
     }
 }
\ No newline at end of file
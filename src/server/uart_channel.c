@@ -0,0 +1,87 @@
+/**
+ * @file uart_channel.c
+ * @brief Persistent hardware UART configuration with on-demand pin-mux switching.
+ *
+ * Each hardware UART (`uart0`, `uart1`) is shared by several clients through
+ * pin muxing. Instead of deinitializing and reinitializing the peripheral for
+ * every message, this module:
+ * - Initializes each UART instance once, on first use
+ * - Remembers which TX pin is currently routed to the UART
+ * - Switches GPIO functions only when the target client changes
+ * - Switches the baud rate only when the target client uses a different one
+ *
+ * Only the TX pin of a pair is routed to the UART. After the handshake the
+ * server never reads from clients, and the RX pin stays under SIO control so it
+ * can drive the wake-up pulse for dormant clients.
+ *
+ * @note All functions in this file must be called with the lock of the UART
+ *       being configured (`uart_locks`) held.
+ *
+ * @see queue_uart_message()
+ * @see server_sync_client_state()
+ */
+
+#include "hardware/uart.h"
+#include "hardware/gpio.h"
+
+#include "server.h"
+
+/**
+ * @brief Runtime state of a single hardware UART instance.
+ */
+typedef struct{
+    bool is_configured;         ///< UART peripheral has been initialized
+    bool has_pin_pair;          ///< A client TX pin is currently routed to the UART
+    uart_pin_pair_t pin_pair;   ///< Pin pair of the currently routed client
+    uint32_t baudrate;          ///< Baud rate the UART currently runs at
+}uart_channel_t;
+
+static uart_channel_t uart_channels[NUM_UARTS];
+
+/**
+ * @brief Returns a TX pin to SIO control, holding the line at UART idle level.
+ *
+ * Driving the pin high before releasing it from the UART keeps the client's
+ * RX line idle, so the switch does not look like a start bit.
+ *
+ * @param tx_pin GPIO number of the TX pin to park.
+ */
+static void uart_channel_park_tx_pin(uint8_t tx_pin){
+    gpio_put(tx_pin, true);
+    gpio_set_dir(tx_pin, GPIO_OUT);
+    gpio_set_function(tx_pin, GPIO_FUNC_SIO);
+}
+
+void uart_channel_select(uart_inst_t *uart, uart_pin_pair_t pin_pair, uint32_t baudrate){
+    uart_channel_t *channel = &uart_channels[uart_get_index(uart)];
+
+    if (!channel->is_configured){
+        uart_init(uart, baudrate);
+        channel->baudrate = baudrate;
+        channel->is_configured = true;
+    }else if (channel->baudrate != baudrate){
+        uart_set_baudrate(uart, baudrate);
+        channel->baudrate = baudrate;
+    }
+
+    if (channel->has_pin_pair && channel->pin_pair.tx == pin_pair.tx){
+        return;
+    }
+
+    if (channel->has_pin_pair){
+        uart_channel_park_tx_pin(channel->pin_pair.tx);
+    }
+
+    gpio_set_function(pin_pair.tx, GPIO_FUNC_UART);
+    channel->pin_pair = pin_pair;
+    channel->has_pin_pair = true;
+}
+
+void uart_channel_release(uart_inst_t *uart, uart_pin_pair_t pin_pair){
+    uart_channel_t *channel = &uart_channels[uart_get_index(uart)];
+
+    if (channel->has_pin_pair && channel->pin_pair.tx == pin_pair.tx){
+        uart_channel_park_tx_pin(pin_pair.tx);
+        channel->has_pin_pair = false;
+    }
+}
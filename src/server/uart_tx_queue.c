@@ -0,0 +1,434 @@
+/**
+ * @file uart_tx_queue.c
+ * @brief Asynchronous, DMA-driven transmission of commands to clients.
+ *
+ * Every active client owns a small FIFO of encoded frames. Each hardware UART
+ * has one engine that serves the clients muxed onto it, and each PIO UART
+ * channel has one engine for its single client. Engines run one job at a time:
+ * - Routes the UART to the client's TX pin (see uart_channel.c, hardware only)
+ * - Optionally drives the wake-up pulse on the client's RX pin (alarm-timed)
+ * - Streams the frame into the UART (or PIO state machine) TX FIFO through a DMA channel
+ * - Waits for the shift register to drain, then completes the job
+ *
+ * Callers only encode and enqueue, so neither the CLI on core 0 nor the
+ * heartbeat on core 1 blocks on the UART. Frames for one client are always
+ * sent in the order they were queued.
+ *
+ * Each engine, together with the queues of its clients, is protected by the
+ * lock of its own UART (`uart_locks`), so both UARTs run fully in parallel.
+ * PIO engines share `pio_uart_lock`, each guarding a single client.
+ * The DMA interrupt and the alarms run on core 0, where `uart_tx_queue_init()`
+ * is called. They are held off during flash writes, like the core 1 loop
+ * (see flash_guard.c).
+ *
+ * @see queue_uart_message()
+ */
+
+#include <string.h>
+
+#include "hardware/uart.h"
+#include "hardware/gpio.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+#include "server.h"
+#include "protocol.h"
+
+/**
+ * @brief A single frame waiting to be sent to a client.
+ */
+typedef struct{
+    uint8_t frame[PROTOCOL_MAX_FRAME_LEN];
+    uint8_t frame_length;
+    bool wake_up_first;                         ///< Pulse the client's wake-up line before the frame
+    uart_tx_complete_callback_t on_complete;    ///< Called once the last bit has left the UART, may be NULL
+    uint32_t context;                           ///< Passed to `on_complete`
+}uart_tx_job_t;
+
+/**
+ * @brief Outbound FIFO of one client.
+ */
+typedef struct{
+    uart_tx_job_t jobs[UART_TX_QUEUE_DEPTH];
+    uint8_t head;               ///< Next free slot
+    uint8_t tail;               ///< Job currently sent or next to send
+    volatile uint8_t depth;     ///< Jobs queued, including the one in flight
+    uint8_t high_water_mark;    ///< Largest depth seen since boot
+    volatile bool is_suspended; ///< Client is being handshaken again, new frames are dropped
+}uart_tx_client_queue_t;
+
+typedef enum{
+    UART_TX_ENGINE_IDLE,
+    UART_TX_ENGINE_WAKE_PULSE_HIGH,
+    UART_TX_ENGINE_WAKE_PULSE_LOW,
+    UART_TX_ENGINE_SENDING,
+    UART_TX_ENGINE_DRAINING,
+}uart_tx_engine_state_t;
+
+/**
+ * @brief Transmit engine of one hardware UART or PIO UART channel.
+ */
+typedef struct{
+    uart_transport_t transport;
+    uart_inst_t *uart;          ///< Hardware engines only
+    uint8_t pio_channel;        ///< PIO engines only
+    spin_lock_t *lock;          ///< Lock of this UART from `uart_locks`, or the shared PIO lock
+    uint dma_channel;
+    volatile bool is_initialized;   ///< Set once `dma_channel` is claimed and its IRQ enabled
+    uint32_t char_time_us;      ///< Character time of the client in flight, used to poll for drain
+    volatile uart_tx_engine_state_t state;
+    uint8_t client_index;       ///< Owner of the job in flight
+    uint8_t next_client_index;  ///< Round-robin start point for the next job
+}uart_tx_engine_t;
+
+static uart_tx_client_queue_t client_queues[MAX_SERVER_CONNECTIONS];
+static uart_tx_engine_t engines[NUM_UARTS + PIO_UART_MAX_CHANNELS];
+static bool is_initialized = false;
+
+static int64_t uart_tx_engine_on_alarm(alarm_id_t alarm_id, void *user_data);
+
+/**
+ * @brief Returns the engine serving a client.
+ *
+ * Engines `[0, NUM_UARTS)` belong to the hardware UARTs, the following ones
+ * to the PIO UART channels.
+ */
+static inline uart_tx_engine_t *uart_tx_engine_of_client(uint8_t client_index){
+    const server_uart_connection_t *connection = &active_uart_server_connections[client_index];
+    if (connection->transport == UART_TRANSPORT_PIO){
+        return &engines[NUM_UARTS + connection->pio_channel];
+    }
+    return &engines[uart_get_index(connection->uart_instance)];
+}
+
+/**
+ * @brief Returns true while the engine's transmitter still shifts out bits.
+ */
+static inline bool uart_tx_engine_is_busy(const uart_tx_engine_t *engine){
+    if (engine->transport == UART_TRANSPORT_PIO){
+        return pio_uart_is_tx_busy(engine->pio_channel);
+    }
+    return uart_get_hw(engine->uart)->fr & UART_UARTFR_BUSY_BITS;
+}
+
+/**
+ * @brief Duration of one 10-bit UART character, rounded up.
+ *
+ * @param baudrate Baud rate of the link.
+ */
+static inline uint32_t uart_tx_char_time_us(uint32_t baudrate){
+    return (10u * 1000000u + baudrate - 1) / baudrate;
+}
+
+/**
+ * @brief Starts the DMA transfer of the engine's current job.
+ *
+ * @note Must be called with `engine->lock` held.
+ */
+static void uart_tx_engine_start_dma(uart_tx_engine_t *engine){
+    uart_tx_job_t *job = &client_queues[engine->client_index].jobs[client_queues[engine->client_index].tail];
+
+    dma_channel_config config = dma_channel_get_default_config(engine->dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+
+    volatile void *tx_fifo;
+    if (engine->transport == UART_TRANSPORT_PIO){
+        channel_config_set_dreq(&config, pio_uart_get_tx_dreq(engine->pio_channel));
+        tx_fifo = pio_uart_get_tx_fifo(engine->pio_channel);
+    }else{
+        channel_config_set_dreq(&config, uart_get_dreq(engine->uart, true));
+        tx_fifo = &uart_get_hw(engine->uart)->dr;
+    }
+
+    engine->state = UART_TX_ENGINE_SENDING;
+    dma_channel_configure(engine->dma_channel, &config, tx_fifo, job->frame, job->frame_length, true);
+}
+
+/**
+ * @brief Runs `uart_tx_engine_on_alarm()` for an engine after `delay_us`.
+ *
+ * If no alarm slot is left, the step is run in place after a busy wait
+ * instead, so the engine never stays stuck waiting for an alarm that was
+ * never scheduled.
+ *
+ * @note Must be called without `engine->lock` held.
+ */
+static void uart_tx_engine_schedule(uart_tx_engine_t *engine, uint32_t delay_us){
+    while (add_alarm_in_us(delay_us, uart_tx_engine_on_alarm, engine, true) < 0){
+        busy_wait_us_32(delay_us);
+        int64_t reschedule_us = uart_tx_engine_on_alarm(0, engine);
+        if (!reschedule_us){
+            return;
+        }
+        delay_us = (uint32_t)reschedule_us;
+    }
+}
+
+/**
+ * @brief Picks the next client with queued frames and starts its first job.
+ *
+ * Clients sharing the UART are served round-robin, so a busy client cannot
+ * starve the others. Does nothing if the engine is busy or no job is pending.
+ *
+ * @note Must be called with `engine->lock` held.
+ * @return true if the job starts with a wake-up pulse: the caller times its
+ *         high phase (`WAKE_UP_PULSE_MS`) once the lock is released.
+ */
+static bool uart_tx_engine_kick(uart_tx_engine_t *engine){
+    if (engine->state != UART_TX_ENGINE_IDLE){
+        return false;
+    }
+
+    for (uint8_t offset = 0; offset < active_server_connections_number; offset++){
+        uint8_t client_index = (engine->next_client_index + offset) % active_server_connections_number;
+        if (uart_tx_engine_of_client(client_index) != engine || !client_queues[client_index].depth){
+            continue;
+        }
+
+        uart_tx_client_queue_t *queue = &client_queues[client_index];
+        uart_pin_pair_t pin_pair = active_uart_server_connections[client_index].pin_pair;
+        uint32_t baudrate = active_uart_server_connections[client_index].baudrate;
+
+        engine->client_index = client_index;
+        engine->next_client_index = (client_index + 1) % active_server_connections_number;
+        engine->char_time_us = uart_tx_char_time_us(baudrate);
+        if (engine->transport == UART_TRANSPORT_HARDWARE){
+            uart_channel_select(engine->uart, pin_pair, baudrate);
+        }
+
+        if (queue->jobs[queue->tail].wake_up_first){
+            gpio_put(pin_pair.rx, true);
+            gpio_set_dir(pin_pair.rx, GPIO_OUT);
+            engine->state = UART_TX_ENGINE_WAKE_PULSE_HIGH;
+            return true;
+        }
+
+        uart_tx_engine_start_dma(engine);
+        return false;
+    }
+    return false;
+}
+
+/**
+ * @brief Alarm handler driving the timed steps of a job.
+ *
+ * - End of the wake-up pulse high phase: drives the line low
+ * - End of the low phase: releases the line and starts the DMA transfer
+ * - While draining: polls the transmitter until the last stop bit is out,
+ *   then pops the job, runs its callback and starts the next one
+ *
+ * @return Microseconds until the alarm fires again, or 0 to stop.
+ */
+static int64_t uart_tx_engine_on_alarm(alarm_id_t alarm_id, void *user_data){
+    uart_tx_engine_t *engine = (uart_tx_engine_t *)user_data;
+    uart_tx_complete_callback_t on_complete = NULL;
+    uint32_t context = 0;
+    uint8_t client_index = 0;
+    int64_t reschedule_us = 0;
+
+    uint32_t irq = spin_lock_blocking(engine->lock);
+    switch (engine->state){
+        case UART_TX_ENGINE_WAKE_PULSE_HIGH:
+            gpio_put(active_uart_server_connections[engine->client_index].pin_pair.rx, false);
+            engine->state = UART_TX_ENGINE_WAKE_PULSE_LOW;
+            reschedule_us = WAKE_UP_PULSE_MS * MS_TO_US_MULTIPLIER;
+            break;
+
+        case UART_TX_ENGINE_WAKE_PULSE_LOW:
+            gpio_set_dir(active_uart_server_connections[engine->client_index].pin_pair.rx, GPIO_IN);
+            uart_tx_engine_start_dma(engine);
+            break;
+
+        case UART_TX_ENGINE_DRAINING:
+            if (uart_tx_engine_is_busy(engine)){
+                reschedule_us = engine->char_time_us;
+                break;
+            }
+
+            uart_tx_client_queue_t *queue = &client_queues[engine->client_index];
+            on_complete = queue->jobs[queue->tail].on_complete;
+            context = queue->jobs[queue->tail].context;
+            client_index = engine->client_index;
+
+            queue->tail = (queue->tail + 1) % UART_TX_QUEUE_DEPTH;
+            queue->depth--;
+            engine->state = UART_TX_ENGINE_IDLE;
+            if (uart_tx_engine_kick(engine)){
+                // The next job starts with a wake-up pulse, timed by this alarm
+                reschedule_us = WAKE_UP_PULSE_MS * MS_TO_US_MULTIPLIER;
+            }
+            break;
+
+        default:
+            break;
+    }
+    spin_unlock(engine->lock, irq);
+
+    if (on_complete){
+        on_complete(client_index, context);
+    }
+
+    return reschedule_us;
+}
+
+/**
+ * @brief DMA completion handler shared by all engines.
+ *
+ * The last byte is now in the TX FIFO but not yet on the wire, so the job
+ * moves to the draining state, finished by `uart_tx_engine_on_alarm()`.
+ * For PIO engines the stall flag is cleared here, after the last write, so it
+ * only rises again once the state machine has run out of data.
+ */
+static void uart_tx_on_dma_complete(void){
+    for (uint8_t engine_index = 0; engine_index < NUM_UARTS + PIO_UART_MAX_CHANNELS; engine_index++){
+        uart_tx_engine_t *engine = &engines[engine_index];
+        if (!engine->is_initialized || !dma_channel_get_irq0_status(engine->dma_channel)){
+            continue;
+        }
+
+        dma_channel_acknowledge_irq0(engine->dma_channel);
+        if (engine->transport == UART_TRANSPORT_PIO){
+            pio_uart_clear_tx_stall(engine->pio_channel);
+        }
+
+        uint32_t irq = spin_lock_blocking(engine->lock);
+        engine->state = UART_TX_ENGINE_DRAINING;
+        spin_unlock(engine->lock, irq);
+
+        uart_tx_engine_schedule(engine, engine->char_time_us);
+    }
+}
+
+void uart_tx_queue_add_pio_channel(uint8_t pio_channel){
+    uart_tx_engine_t *engine = &engines[NUM_UARTS + pio_channel];
+    if (engine->is_initialized){
+        return;
+    }
+
+    engine->transport = UART_TRANSPORT_PIO;
+    engine->pio_channel = pio_channel;
+    engine->lock = pio_uart_lock;
+    engine->state = UART_TX_ENGINE_IDLE;
+
+    engine->dma_channel = dma_claim_unused_channel(true);
+    dma_channel_set_irq0_enabled(engine->dma_channel, true);
+    __dmb();
+    engine->is_initialized = true;
+}
+
+void uart_tx_queue_init(void){
+    if (is_initialized){
+        return;
+    }
+
+    for (uint8_t uart_index = 0; uart_index < NUM_UARTS; uart_index++){
+        engines[uart_index].transport = UART_TRANSPORT_HARDWARE;
+        engines[uart_index].uart = uart_get_instance(uart_index);
+        engines[uart_index].lock = uart_locks[uart_index];
+        engines[uart_index].dma_channel = dma_claim_unused_channel(true);
+        engines[uart_index].state = UART_TX_ENGINE_IDLE;
+        dma_channel_set_irq0_enabled(engines[uart_index].dma_channel, true);
+        engines[uart_index].is_initialized = true;
+    }
+
+    // PIO engines only exist for channels that found a client, saving DMA channels
+    for (uint8_t client_index = 0; client_index < active_server_connections_number; client_index++){
+        if (active_uart_server_connections[client_index].transport == UART_TRANSPORT_PIO){
+            uart_tx_queue_add_pio_channel(active_uart_server_connections[client_index].pio_channel);
+        }
+    }
+
+    irq_set_exclusive_handler(DMA_IRQ_0, uart_tx_on_dma_complete);
+    irq_set_enabled(DMA_IRQ_0, true);
+    is_initialized = true;
+}
+
+bool uart_tx_queue_send(uint8_t client_index, uint8_t code, uint32_t value, bool wake_up_first,
+                        uart_tx_complete_callback_t on_complete, uint32_t context){
+    protocol_command_t command = {.code = code, .value = value};
+    uint8_t frame[PROTOCOL_MAX_FRAME_LEN];
+    size_t frame_length = protocol_encode_command(&command, frame);
+    uart_tx_client_queue_t *queue = &client_queues[client_index];
+    uart_tx_engine_t *engine = uart_tx_engine_of_client(client_index);
+
+    uint32_t irq = spin_lock_blocking(engine->lock);
+    if (queue->is_suspended || queue->depth == UART_TX_QUEUE_DEPTH){
+        spin_unlock(engine->lock, irq);
+        return false;
+    }
+
+    uart_tx_job_t *job = &queue->jobs[queue->head];
+    memcpy(job->frame, frame, frame_length);
+    job->frame_length = (uint8_t)frame_length;
+    job->wake_up_first = wake_up_first;
+    job->on_complete = on_complete;
+    job->context = context;
+
+    queue->head = (queue->head + 1) % UART_TX_QUEUE_DEPTH;
+    queue->depth++;
+    if (queue->depth > queue->high_water_mark){
+        queue->high_water_mark = queue->depth;
+    }
+
+    bool is_wake_up_pulse_started = uart_tx_engine_kick(engine);
+    spin_unlock(engine->lock, irq);
+
+    if (is_wake_up_pulse_started){
+        uart_tx_engine_schedule(engine, WAKE_UP_PULSE_MS * MS_TO_US_MULTIPLIER);
+    }
+    return true;
+}
+
+void uart_tx_queue_flush(void){
+    for (uint8_t client_index = 0; client_index < active_server_connections_number; client_index++){
+        while (client_queues[client_index].depth){
+            tight_loop_contents();
+        }
+    }
+}
+
+uint8_t uart_tx_queue_get_depth(uint8_t client_index){
+    return client_queues[client_index].depth;
+}
+
+uint8_t uart_tx_queue_get_high_water_mark(uint8_t client_index){
+    return client_queues[client_index].high_water_mark;
+}
+
+bool uart_tx_queue_suspend_client(uint8_t client_index){
+    uart_tx_client_queue_t *queue = &client_queues[client_index];
+    uart_tx_engine_t *engine = uart_tx_engine_of_client(client_index);
+
+    uint32_t irq = spin_lock_blocking(engine->lock);
+    queue->is_suspended = true;
+    spin_unlock(engine->lock, irq);
+
+    absolute_time_t deadline = make_timeout_time_ms(UART_TX_SUSPEND_TIMEOUT_MS);
+    while (queue->depth){
+        if (time_reached(deadline)){
+            return false;
+        }
+        tight_loop_contents();
+    }
+
+    if (active_uart_server_connections[client_index].transport == UART_TRANSPORT_HARDWARE){
+        irq = spin_lock_blocking(engine->lock);
+        uart_channel_release(engine->uart, active_uart_server_connections[client_index].pin_pair);
+        spin_unlock(engine->lock, irq);
+    }
+    return true;
+}
+
+void uart_tx_queue_resume_client(uint8_t client_index){
+    client_queues[client_index].is_suspended = false;
+}
+
+void uart_tx_queue_init_wake_up_line(uint8_t pin){
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+    gpio_pull_down(pin);
+}
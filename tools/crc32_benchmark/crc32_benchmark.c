@@ -0,0 +1,104 @@
+/**
+ * @file crc32_benchmark.c
+ * @brief Host benchmark of the software CRC32 engines of crc32.c.
+ *
+ * - Checks both engines against the standard check value ("123456789")
+ *   and against each other on every block size, at odd alignments
+ * - Times each engine over the blocks the state log checksums: a bank
+ *   header, a small and the largest snapshot, and a full 4 KB sector
+ *
+ * Exits with a non-zero status if the engines disagree.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "crc32.h"
+
+/// CRC32 of "123456789", the usual check value.
+#define CRC32_CHECK_VALUE 0xCBF43926u
+/// Largest block timed, and room for the misaligned copies.
+#define BENCHMARK_MAX_LENGTH 4096
+/// Bytes hashed per engine and block size, so every timing lasts long enough.
+#define BENCHMARK_BYTES_PER_RUN (64u * 1024u * 1024u)
+
+static uint8_t buffer[BENCHMARK_MAX_LENGTH + 8];
+
+/**
+ * @brief Returns a monotonic time in nanoseconds.
+ */
+static uint64_t now_ns(void){
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+/**
+ * @brief Returns the nanoseconds per byte of an engine over a block.
+ */
+static double time_ns_per_byte(uint32_t (*engine)(const void *, uint32_t), uint32_t length){
+    uint32_t rounds = BENCHMARK_BYTES_PER_RUN / length;
+    volatile uint32_t sink = 0;
+
+    uint64_t start = now_ns();
+    for (uint32_t round = 0; round < rounds; round++){
+        sink ^= engine(buffer, length);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    (void)sink;
+    return (double)elapsed / ((double)rounds * length);
+}
+
+/**
+ * @brief Compares both engines on every length up to `BENCHMARK_MAX_LENGTH`, at 8 alignments.
+ *
+ * @return true if they always agree.
+ */
+static bool engines_agree(void){
+    if (crc32_compute("123456789", 9) != CRC32_CHECK_VALUE ||
+        crc32_compute_bitwise("123456789", 9) != CRC32_CHECK_VALUE){
+        return false;
+    }
+
+    for (uint32_t offset = 0; offset < 8; offset++){
+        for (uint32_t length = 0; length <= BENCHMARK_MAX_LENGTH; length++){
+            if (crc32_compute(buffer + offset, length) != crc32_compute_bitwise(buffer + offset, length)){
+                printf("Mismatch at offset %u, length %u\n", offset, length);
+                return false;
+            }
+        }
+    }
+
+    // A running CRC split at any point gives the same result
+    uint32_t crc = crc32_update(CRC32_INITIAL_VALUE, buffer, 1001);
+    return ~crc32_update(crc, buffer + 1001, 3000) == crc32_compute_bitwise(buffer, 4001);
+}
+
+int main(void){
+    // Header fields, 13 and 32 packed clients, one sector
+    const uint32_t lengths[] = {28, 312, 768, BENCHMARK_MAX_LENGTH};
+
+    crc32_init();
+    for (uint32_t i = 0; i < sizeof(buffer); i++){
+        buffer[i] = (uint8_t)(i * 31u + 7u);
+    }
+
+    if (!engines_agree()){
+        printf("FAIL: slicing-by-8 and bitwise CRC32 disagree\n");
+        return 1;
+    }
+    printf("OK: slicing-by-8 matches the bitwise CRC32\n\n");
+
+    printf("%8s %18s %18s %9s\n", "bytes", "bitwise ns/byte", "sliced ns/byte", "speedup");
+    for (uint8_t index = 0; index < sizeof(lengths) / sizeof(lengths[0]); index++){
+        double bitwise = time_ns_per_byte(crc32_compute_bitwise, lengths[index]);
+        double sliced = time_ns_per_byte(crc32_compute, lengths[index]);
+        printf("%8u %18.3f %18.3f %8.1fx\n", lengths[index], bitwise, sliced, bitwise / sliced);
+    }
+    return 0;
+}